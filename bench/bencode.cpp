@@ -0,0 +1,61 @@
+/// Time taken to parse a large single-file torrent, with 250000 piece hashes,
+/// into a tape and into a tree of `BencodeValue`
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <string>
+
+#include "bencode/bencode_parser.hpp"
+#include "bencode/bencode_tape.hpp"
+
+/// Minimum time spent measuring each case
+const auto MEASURE_TIME = std::chrono::milliseconds(500);
+
+/// @return average time in microseconds taken by `parse`
+static double measure(const std::function<void()>& parse) {
+  using clock = std::chrono::steady_clock;
+
+  size_t iterations = 0;
+  auto begin = clock::now();
+  auto elapsed = clock::duration::zero();
+  while (elapsed < MEASURE_TIME) {
+    parse();
+    iterations += 1;
+    elapsed = clock::now() - begin;
+  }
+
+  double seconds = std::chrono::duration<double>(elapsed).count();
+  return seconds / static_cast<double>(iterations) * 1e6;
+}
+
+int main() {
+  const size_t PIECES = 250000;
+
+  std::mt19937 gen(42);
+  std::string pieces(PIECES * 20, '\0');
+  for (auto& byte : pieces) byte = static_cast<char>(gen());
+
+  std::string torrent = "d8:announce23:http://tracker/announce4:infod" +
+                        std::string("6:lengthi") +
+                        std::to_string(PIECES * 262144) +
+                        "e4:name4:file12:piece lengthi262144e6:pieces" +
+                        std::to_string(pieces.size()) + ":" + pieces + "ee";
+
+  std::printf("torrent of %zu bytes\n", torrent.size());
+
+  volatile size_t sink = 0;
+  double tape = measure([&] {
+    auto parsed = fur::bencode::Tape::parse(torrent);
+    sink = sink + parsed->size();
+  });
+  std::printf("%-8s %10.1f us\n", "tape", tape);
+
+  fur::bencode::BencodeParser parser;
+  double tree = measure([&] {
+    auto parsed = parser.decode(torrent);
+    sink = sink + parsed.valid();
+  });
+  std::printf("%-8s %10.1f us\n", "tree", tree);
+}
@@ -0,0 +1,61 @@
+/// Time taken to decode and encode single peer wire messages, a 16KB piece
+/// block being the most common message received while downloading
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <variant>
+#include <vector>
+
+#include "download/message.hpp"
+
+using namespace fur::download::message;
+
+/// Minimum time spent measuring each case
+const auto MEASURE_TIME = std::chrono::milliseconds(500);
+
+/// @return average time in nanoseconds taken by `run`
+static double measure(const std::function<void()>& run) {
+  using clock = std::chrono::steady_clock;
+
+  size_t iterations = 0;
+  auto begin = clock::now();
+  auto elapsed = clock::duration::zero();
+  while (elapsed < MEASURE_TIME) {
+    run();
+    iterations += 1;
+    elapsed = clock::now() - begin;
+  }
+
+  double seconds = std::chrono::duration<double>(elapsed).count();
+  return seconds / static_cast<double>(iterations) * 1e9;
+}
+
+int main() {
+  std::vector<uint8_t> block(16384, 1);
+  std::vector<uint8_t> have;
+  encode(HaveMessage{7}, have);
+  std::vector<uint8_t> piece;
+  encode(PieceMessage{7, 16384, Bytes{block.data(), block.size()}}, piece);
+
+  volatile size_t sink = 0;
+  double decode_have = measure([&] {
+    auto message = decode(have);
+    sink = sink + std::get<HaveMessage>(*message).index;
+  });
+  std::printf("%-16s %10.1f ns\n", "decode have", decode_have);
+
+  double decode_piece = measure([&] {
+    auto message = decode(piece);
+    sink = sink + std::get<PieceMessage>(*message).block.size;
+  });
+  std::printf("%-16s %10.1f ns\n", "decode piece", decode_piece);
+
+  std::vector<uint8_t> buffer;
+  double encode_request = measure([&] {
+    buffer.clear();
+    encode(RequestMessage{7, 16384, 16384}, buffer);
+    sink = sink + buffer.size();
+  });
+  std::printf("%-16s %10.1f ns\n", "encode request", encode_request);
+}
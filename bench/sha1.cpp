@@ -0,0 +1,91 @@
+/// Throughput of every SHA-1 backend supported by the CPU compared to
+/// smallsha1, hashing buffers of typical piece sizes. Multi-buffer backends
+/// hash the buffer split in as many pieces as they have lanes
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "sha1/sha1.hpp"
+#include "smallsha1/sha1.hpp"
+
+/// Minimum time spent measuring each case
+const auto MEASURE_TIME = std::chrono::milliseconds(500);
+
+/// @return throughput in MB/s of `hash` over buffers of `len` bytes
+static double measure(const std::function<void()>& hash, size_t len) {
+  using clock = std::chrono::steady_clock;
+
+  size_t iterations = 0;
+  auto begin = clock::now();
+  auto elapsed = clock::duration::zero();
+  while (elapsed < MEASURE_TIME) {
+    hash();
+    iterations += 1;
+    elapsed = clock::now() - begin;
+  }
+
+  double seconds = std::chrono::duration<double>(elapsed).count();
+  return static_cast<double>(len * iterations) / seconds / 1e6;
+}
+
+int main() {
+  std::mt19937 gen(42);
+  std::vector<uint8_t> data(16 * 1024 * 1024);
+  for (auto& byte : data) byte = static_cast<uint8_t>(gen());
+
+  std::printf("best backend: %s\n\n",
+              fur::sha1::backend_name(fur::sha1::best_backend()));
+  std::printf("%-10s %12s %12s %12s\n", "backend", "16 KiB", "1 MiB",
+              "16 MiB");
+
+  const size_t LENGTHS[] = {16 * 1024, 1024 * 1024, data.size()};
+
+  std::printf("%-10s", "smallsha1");
+  for (size_t len : LENGTHS) {
+    uint8_t out[20];
+    double mbps = measure(
+        [&] { ::sha1::calc(data.data(), static_cast<int>(len), out); }, len);
+    std::printf(" %7.0f MB/s", mbps);
+  }
+  std::printf("\n");
+
+  for (auto backend : fur::sha1::BACKENDS) {
+    if (!fur::sha1::supported(backend)) continue;
+
+    std::printf("%-10s", fur::sha1::backend_name(backend));
+    for (size_t len : LENGTHS) {
+      volatile uint8_t sink = 0;
+      auto hash = [&] {
+        sink = sink + fur::sha1::digest(data.data(), len, backend)[0];
+      };
+      std::printf(" %7.0f MB/s", measure(hash, len));
+    }
+    std::printf("\n");
+  }
+
+  for (auto backend : fur::sha1::MULTI_BACKENDS) {
+    if (!fur::sha1::supported(backend)) continue;
+    const size_t lanes = fur::sha1::lanes(backend);
+
+    std::printf("%-10s", fur::sha1::backend_name(backend));
+    for (size_t len : LENGTHS) {
+      std::vector<const uint8_t*> pieces;
+      std::vector<size_t> lens(lanes, len / lanes);
+      std::vector<fur::sha1::Digest> digests(lanes);
+      for (size_t i = 0; i < lanes; i++)
+        pieces.push_back(data.data() + i * (len / lanes));
+
+      auto hash = [&] {
+        fur::sha1::digest_many(pieces.data(), lens.data(), lanes,
+                               digests.data(), backend);
+      };
+      std::printf(" %7.0f MB/s", measure(hash, len));
+    }
+    std::printf("\n");
+  }
+  return 0;
+}
@@ -0,0 +1,43 @@
+#include "bencode_lexer.hpp"
+
+#include <charconv>
+
+namespace fur::bencode::lexer {
+
+LexResult integer(std::string_view input, size_t pos, long& value) {
+  // Form is 'i', optional '-', digits, 'e'
+  auto end = input.find('e', pos + 1);
+  if (end == std::string_view::npos)
+    return LexResult::ERROR(BencodeParserError::IntFormat);
+
+  auto digits = input.substr(pos + 1, end - pos - 1);
+  auto [ptr, ec] =
+      std::from_chars(digits.data(), digits.data() + digits.size(), value);
+  if (ec != std::errc{} || ptr != digits.data() + digits.size() ||
+      digits == "-0")
+    return LexResult::ERROR(BencodeParserError::IntValue);
+  return LexResult::OK(end + 1);
+}
+
+LexResult string_length(std::string_view input, size_t pos, size_t& len) {
+  // Form is the length, ':', the content
+  auto [ptr, ec] =
+      std::from_chars(input.data() + pos, input.data() + input.size(), len);
+  size_t colon = ptr - input.data();
+  if (ec != std::errc{} || colon >= input.size() || *ptr != ':')
+    return LexResult::ERROR(BencodeParserError::InvalidString);
+  return LexResult::OK(colon + 1);
+}
+
+LexResult string(std::string_view input, size_t pos, std::string_view& value) {
+  size_t len = 0;
+  auto start = string_length(input, pos, len);
+  if (!start.valid()) return start;
+  if (len > input.size() - *start)
+    return LexResult::ERROR(BencodeParserError::InvalidString);
+
+  value = input.substr(*start, len);
+  return LexResult::OK(*start + len);
+}
+
+}  // namespace fur::bencode::lexer
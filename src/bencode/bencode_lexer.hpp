@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string_view>
+
+#include "bencode_parser.hpp"
+#include "util/result.hpp"
+
+/// Reading of the bencode integers and strings, shared by the decoders working
+/// directly on the encoded input
+namespace fur::bencode::lexer {
+
+/// Position in the input right after the value read
+using LexResult = util::Result<size_t, BencodeParserError>;
+
+/// Read the integer starting at `pos`, which must be an 'i'
+/// @param value set to the integer read
+/// @return position after the integer, `IntFormat` if it isn't closed and
+/// `IntValue` if it isn't a valid number
+LexResult integer(std::string_view input, size_t pos, long& value);
+
+/// Read the length of the string starting at `pos`, which must be a digit
+/// @param len set to the length of the content
+/// @return position of the content, `InvalidString` if the length is
+/// malformed or not followed by ':'
+LexResult string_length(std::string_view input, size_t pos, size_t& len);
+
+/// Read the string starting at `pos`, which must be a digit
+/// @param value set to the content of the string, a view into `input`
+/// @return position after the string, `InvalidString` if it is malformed or
+/// longer than the input
+LexResult string(std::string_view input, size_t pos, std::string_view& value);
+
+}  // namespace fur::bencode::lexer
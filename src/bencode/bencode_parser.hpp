@@ -36,28 +36,11 @@ using BencodeResult =
     util::Result<std::unique_ptr<BencodeValue>, BencodeParserError>;
 
 class BencodeParser {
- private:
-  /// The index of the current token used for decoding
-  unsigned int _index{};
-  /// The list of tokens to be decoded
-  std::string _tokens;
-  /// Private method used recursively to decode the bencode data
-  BencodeResult decode();
-  /// Private method used to decode a bencode integer
-  BencodeResult decode_int();
-  /// Private method used to decode a bencode string
-  BencodeResult decode_string();
-  /// Private method used to decode a bencode list
-  BencodeResult decode_list();
-  /// Private method used to decode a bencode dictionary
-  BencodeResult decode_dict();
-
  public:
   BencodeParser() = default;
   ~BencodeParser() = default;
-  /// Parses a bencode string and returns a BencodeValue object, this is public
-  /// and it is not called recursively, in fact it initialize the attributes
-  /// _tokens and _index and then calls the private method decode()
+  /// Parses a bencode string and returns a BencodeValue object. The input is
+  /// first parsed into a `Tape`, then the tree is built from it
   BencodeResult decode(std::string const& decoded);
 
   /// Encodes a BencodeValue object into a bencode string
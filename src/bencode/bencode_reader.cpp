@@ -0,0 +1,123 @@
+#include "bencode_reader.hpp"
+
+#include "bencode_lexer.hpp"
+
+namespace fur::bencode {
+
+/// Longest integer that fits a long, with its sign
+const size_t MAX_INT_DIGITS = 20;
+
+using FeedResult = util::Result<size_t, BencodeParserError>;
+
+void BencodeReader::completed() {
+  if (_open.empty()) {
+    _done = true;
+  } else if (_open.back() == Expect::DictKey) {
+    _open.back() = Expect::DictValue;
+  } else if (_open.back() == Expect::DictValue) {
+    _open.back() = Expect::DictKey;
+  }
+}
+
+auto BencodeReader::feed(std::string_view data, BencodeVisitor& visitor)
+    -> FeedResult {
+  size_t pos = 0;
+  while (!_done && pos < data.size()) {
+    const char token = data[pos];
+    const bool is_key = !_open.empty() && _open.back() == Expect::DictKey;
+
+    if (token == 'e') {
+      // A dict key without its value, or an 'e' outside any container
+      if (_open.empty() || _open.back() == Expect::DictValue)
+        return FeedResult::ERROR(_open.empty()
+                                     ? BencodeParserError::InvalidString
+                                     : BencodeParserError::DictFormat);
+      _open.pop_back();
+      pos += 1;
+      visitor.end();
+      completed();
+      continue;
+    }
+
+    if (is_key && (token < '0' || token > '9'))
+      return FeedResult::ERROR(BencodeParserError::DictKey);
+
+    if (token == 'i') {
+      long value = 0;
+      auto lexing = lexer::integer(data, pos, value);
+      if (!lexing.valid()) {
+        // The closing 'e' may not have arrived yet
+        if (lexing.error() == BencodeParserError::IntFormat &&
+            data.size() - pos - 1 <= MAX_INT_DIGITS)
+          break;
+        return lexing;
+      }
+
+      pos = *lexing;
+      visitor.integer(value);
+      completed();
+    } else if (token >= '0' && token <= '9') {
+      size_t len = 0;
+      auto start = lexer::string_length(data, pos, len);
+      if (!start.valid()) {
+        // The length itself may not have arrived whole yet
+        if (data.find_first_not_of("0123456789", pos) ==
+                std::string_view::npos &&
+            data.size() - pos <= MAX_INT_DIGITS)
+          break;
+        return start;
+      }
+      if (len > data.size() - *start) break;
+
+      auto value = data.substr(*start, len);
+      pos = *start + len;
+      if (is_key)
+        visitor.key(value);
+      else
+        visitor.string(value);
+      completed();
+    } else if (token == 'l' || token == 'd') {
+      pos += 1;
+      if (token == 'l') {
+        _open.push_back(Expect::ListValue);
+        visitor.begin_list();
+      } else {
+        _open.push_back(Expect::DictKey);
+        visitor.begin_dict();
+      }
+    } else {
+      return FeedResult::ERROR(BencodeParserError::InvalidString);
+    }
+  }
+
+  _position += pos;
+  return FeedResult::OK(std::move(pos));
+}
+
+auto BencodeReader::read(std::string_view input, BencodeVisitor& visitor)
+    -> util::Outcome<BencodeParserError> {
+  using Outcome = util::Outcome<BencodeParserError>;
+
+  BencodeReader reader;
+  auto reading = reader.feed(input, visitor);
+  if (!reading.valid()) {
+    auto error = reading.error();
+    return Outcome::ERROR(std::move(error));
+  }
+
+  if (!reader.done()) {
+    // The input ended in the middle of a value
+    if (!reader._open.empty())
+      return Outcome::ERROR(reader._open.back() == Expect::ListValue
+                                ? BencodeParserError::ListFormat
+                                : BencodeParserError::DictFormat);
+    return Outcome::ERROR(*reading < input.size() && input[*reading] == 'i'
+                              ? BencodeParserError::IntFormat
+                              : BencodeParserError::InvalidString);
+  }
+  if (*reading != input.size())
+    return Outcome::ERROR(BencodeParserError::InvalidString);
+  return Outcome::OK({});
+}
+
+}  // namespace fur::bencode
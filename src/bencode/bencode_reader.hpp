@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "bencode_parser.hpp"
+#include "util/result.hpp"
+
+namespace fur::bencode {
+
+/// Receives the values read by a `BencodeReader` in the order they appear.
+/// Every event does nothing by default, so consumers override only the ones
+/// they need. Strings are views into the data being read, valid only during
+/// the call
+class BencodeVisitor {
+ public:
+  virtual ~BencodeVisitor() = default;
+
+  virtual void integer(long /*value*/) {}
+  virtual void string(std::string_view /*value*/) {}
+  /// A key of the innermost dict, the next event is its value
+  virtual void key(std::string_view /*key*/) {}
+  virtual void begin_list() {}
+  virtual void begin_dict() {}
+  /// End of the innermost list or dict
+  virtual void end() {}
+};
+
+/// Reads a bencoded value reporting each part of it to a `BencodeVisitor`,
+/// without building any tree. Data can be fed in pieces as it is received,
+/// values split between two pieces are reported once whole. Keys are not
+/// checked to be sorted, since the previous one may no longer be available
+class BencodeReader {
+  /// What is expected next inside an open container
+  enum class Expect : uint8_t { ListValue, DictKey, DictValue };
+
+  /// Containers still waiting for their closing 'e', innermost last
+  std::vector<Expect> _open;
+  /// Number of bytes consumed since the beginning
+  size_t _position = 0;
+  /// True once a whole value has been read
+  bool _done = false;
+
+  /// Update the open containers after a value has been read
+  void completed();
+
+ public:
+  BencodeReader() = default;
+
+  /// Read as many values as `data` contains, an incomplete value at its end
+  /// is not consumed and must be fed again followed by the next bytes. No
+  /// bytes are consumed past the end of the outermost value
+  /// @return number of bytes consumed from `data`
+  util::Result<size_t, BencodeParserError> feed(std::string_view data,
+                                                BencodeVisitor& visitor);
+
+  /// @return true once a whole value has been read
+  [[nodiscard]] bool done() const { return _done; }
+  /// @return number of bytes consumed since the beginning, which is also the
+  /// position in the whole input of the next byte to read
+  [[nodiscard]] size_t position() const { return _position; }
+
+  /// Read a whole bencoded value, no bytes may follow it
+  static util::Outcome<BencodeParserError> read(std::string_view input,
+                                                BencodeVisitor& visitor);
+};
+
+}  // namespace fur::bencode
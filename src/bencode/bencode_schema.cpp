@@ -0,0 +1,81 @@
+#include "bencode_schema.hpp"
+
+#include "bencode_lexer.hpp"
+
+namespace fur::bencode {
+
+std::string error_to_string(const SchemaError error) {
+  switch (error) {
+    case SchemaError::InvalidBencode:
+      return "InvalidBencode";
+    case SchemaError::MissingKey:
+      return "MissingKey";
+    case SchemaError::WrongType:
+      return "WrongType";
+    case SchemaError::OutOfRange:
+      return "OutOfRange";
+    default:
+      return "<invalid schema error>";
+  }
+}
+
+std::optional<BencodeType> SchemaCursor::peek() const {
+  if (_pos >= _input.size()) return std::nullopt;
+
+  const char token = _input[_pos];
+  if (token == 'i') return BencodeType::Integer;
+  if (token >= '0' && token <= '9') return BencodeType::String;
+  if (token == 'l') return BencodeType::List;
+  if (token == 'd') return BencodeType::Dict;
+  return std::nullopt;
+}
+
+bool SchemaCursor::integer(long& value) {
+  auto lexing = lexer::integer(_input, _pos, value);
+  if (!lexing.valid()) return false;
+  _pos = *lexing;
+  return true;
+}
+
+bool SchemaCursor::string(std::string_view& value) {
+  auto lexing = lexer::string(_input, _pos, value);
+  if (!lexing.valid()) return false;
+  _pos = *lexing;
+  return true;
+}
+
+bool SchemaCursor::leave() {
+  if (_pos >= _input.size() || _input[_pos] != 'e') return false;
+  _pos += 1;
+  return true;
+}
+
+std::optional<std::string_view> SchemaCursor::skip() {
+  const size_t begin = _pos;
+
+  // Number of containers entered and not yet left
+  size_t depth = 0;
+  do {
+    auto type = peek();
+    if (!type) {
+      if (depth == 0 || !leave()) return std::nullopt;
+      depth -= 1;
+      continue;
+    }
+
+    long integer_value = 0;
+    std::string_view string_value;
+    if (*type == BencodeType::Integer) {
+      if (!integer(integer_value)) return std::nullopt;
+    } else if (*type == BencodeType::String) {
+      if (!string(string_value)) return std::nullopt;
+    } else {
+      enter();
+      depth += 1;
+    }
+  } while (depth > 0);
+
+  return _input.substr(begin, _pos - begin);
+}
+
+}  // namespace fur::bencode
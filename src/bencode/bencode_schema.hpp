@@ -0,0 +1,224 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "bencode_value.hpp"
+#include "util/result.hpp"
+
+namespace fur::bencode {
+
+enum class SchemaError {
+  /// The input is not valid bencode
+  InvalidBencode,
+  /// A key required by the schema is missing
+  MissingKey,
+  /// A value has a different type than its field
+  WrongType,
+  /// An integer doesn't fit its field
+  OutOfRange
+};
+
+/// Function to translate a SchemaError into a string
+std::string error_to_string(SchemaError error);
+
+/// A field of a struct decoded from the value of a dict key. Fields with type
+/// `std::optional` may be missing, all other fields are required
+template <typename S, typename T>
+struct Field {
+  std::string_view key;
+  T S::*member;
+};
+
+/// Describe a field of a struct, to be used in `Schema::fields`
+template <typename S, typename T>
+constexpr Field<S, T> field(std::string_view key, T S::*member) {
+  return {key, member};
+}
+
+/// Specialized for each struct decoded from a dict, with a static constexpr
+/// tuple of `Field` named `fields` listing the keys to read, e.g.
+///
+///   template <>
+///   struct Schema<Point> {
+///     static constexpr auto fields =
+///         std::make_tuple(field("x", &Point::x), field("y", &Point::y));
+///   };
+///
+/// Keys not listed in the schema are skipped
+template <typename T>
+struct Schema;
+
+/// A value kept encoded as it appears in the input, e.g. to hash it or to
+/// decode it later with a different schema
+struct RawValue {
+  std::string_view bytes;
+};
+
+/// Reads bencoded values one at a time from the input, without building any
+/// tree. Used by `decode`
+class SchemaCursor {
+  std::string_view _input;
+  size_t _pos = 0;
+
+ public:
+  explicit SchemaCursor(std::string_view input) : _input{input} {}
+
+  /// @return type of the next value, nothing at the end of a container or on
+  /// invalid input
+  [[nodiscard]] std::optional<BencodeType> peek() const;
+  /// @return true if the whole input has been read
+  [[nodiscard]] bool finished() const { return _pos == _input.size(); }
+
+  /// Read an integer
+  /// @return false on invalid input
+  bool integer(long& value);
+  /// Read a string, as a view into the input
+  /// @return false on invalid input
+  bool string(std::string_view& value);
+  /// Enter a list or a dict
+  void enter() { _pos += 1; }
+  /// Leave the current container if its end has been reached
+  /// @return true if the container has been left
+  bool leave();
+  /// Skip a whole value, returning its bytes
+  /// @return nothing on invalid input
+  std::optional<std::string_view> skip();
+};
+
+namespace detail {
+
+template <typename T>
+struct is_optional : std::false_type {};
+template <typename T>
+struct is_optional<std::optional<T>> : std::true_type {};
+
+template <typename T>
+struct is_vector : std::false_type {};
+template <typename T>
+struct is_vector<std::vector<T>> : std::true_type {};
+
+template <typename T>
+std::optional<SchemaError> decode_value(SchemaCursor& cursor, T& out);
+
+template <typename T, typename Fn, size_t... I>
+void for_each_field(Fn&& fn, std::index_sequence<I...>) {
+  (fn(std::get<I>(Schema<T>::fields), I), ...);
+}
+
+/// Call `fn(field, index)` for each field in the schema of `T`
+template <typename T, typename Fn>
+void for_each_field(Fn&& fn) {
+  constexpr size_t FIELDS =
+      std::tuple_size_v<std::decay_t<decltype(Schema<T>::fields)>>;
+  static_assert(FIELDS <= 64, "Too many fields in a schema");
+  for_each_field<T>(fn, std::make_index_sequence<FIELDS>{});
+}
+
+/// Decode a dict into a struct described by `Schema<T>`
+template <typename T>
+std::optional<SchemaError> decode_struct(SchemaCursor& cursor, T& out) {
+  if (cursor.peek() != BencodeType::Dict) return SchemaError::WrongType;
+  cursor.enter();
+
+  // One bit for each field found
+  uint64_t found = 0;
+  std::optional<std::string_view> last_key;
+  while (!cursor.leave()) {
+    std::string_view key;
+    if (cursor.peek() != BencodeType::String || !cursor.string(key))
+      return SchemaError::InvalidBencode;
+    // Keys must be sorted and unique
+    if (last_key && *last_key >= key) return SchemaError::InvalidBencode;
+    last_key = key;
+
+    bool matched = false;
+    std::optional<SchemaError> error;
+    for_each_field<T>([&](const auto& field, size_t index) {
+      if (matched || field.key != key) return;
+      matched = true;
+      found |= uint64_t{1} << index;
+      error = decode_value(cursor, out.*(field.member));
+    });
+
+    if (error) return error;
+    if (!matched && !cursor.skip()) return SchemaError::InvalidBencode;
+  }
+
+  std::optional<SchemaError> missing;
+  for_each_field<T>([&](const auto& field, size_t index) {
+    using Member = std::decay_t<decltype(out.*(field.member))>;
+    if (!is_optional<Member>::value && (found & (uint64_t{1} << index)) == 0)
+      missing = SchemaError::MissingKey;
+  });
+  return missing;
+}
+
+template <typename T>
+std::optional<SchemaError> decode_value(SchemaCursor& cursor, T& out) {
+  if constexpr (std::is_integral_v<T>) {
+    long value = 0;
+    if (cursor.peek() != BencodeType::Integer) return SchemaError::WrongType;
+    if (!cursor.integer(value)) return SchemaError::InvalidBencode;
+
+    // Compare as signed or unsigned depending on the sign of the value
+    if (value < 0 ? (!std::is_signed_v<T> ||
+                     value < static_cast<long>(std::numeric_limits<T>::min()))
+                  : static_cast<unsigned long>(value) >
+                        static_cast<unsigned long>(
+                            std::numeric_limits<T>::max()))
+      return SchemaError::OutOfRange;
+    out = static_cast<T>(value);
+    return std::nullopt;
+  } else if constexpr (std::is_same_v<T, std::string> ||
+                       std::is_same_v<T, std::string_view>) {
+    std::string_view value;
+    if (cursor.peek() != BencodeType::String) return SchemaError::WrongType;
+    if (!cursor.string(value)) return SchemaError::InvalidBencode;
+    out = T(value);
+    return std::nullopt;
+  } else if constexpr (std::is_same_v<T, RawValue>) {
+    auto bytes = cursor.skip();
+    if (!bytes) return SchemaError::InvalidBencode;
+    out.bytes = *bytes;
+    return std::nullopt;
+  } else if constexpr (is_optional<T>::value) {
+    return decode_value(cursor, out.emplace());
+  } else if constexpr (is_vector<T>::value) {
+    if (cursor.peek() != BencodeType::List) return SchemaError::WrongType;
+    cursor.enter();
+    while (!cursor.leave()) {
+      if (!cursor.peek()) return SchemaError::InvalidBencode;
+      auto error = decode_value(cursor, out.emplace_back());
+      if (error) return error;
+    }
+    return std::nullopt;
+  } else {
+    return decode_struct(cursor, out);
+  }
+}
+
+}  // namespace detail
+
+/// Decode a whole bencoded value into `T`, which is either an integer, a
+/// string, `RawValue`, a vector or a struct with a `Schema`. Strings views
+/// point into `input`
+template <typename T>
+util::Result<T, SchemaError> decode(std::string_view input) {
+  T result{};
+  SchemaCursor cursor(input);
+  auto error = detail::decode_value(cursor, result);
+  if (!error && !cursor.finished()) error = SchemaError::InvalidBencode;
+
+  if (error) return util::Result<T, SchemaError>::ERROR(std::move(*error));
+  return util::Result<T, SchemaError>::OK(std::move(result));
+}
+
+}  // namespace fur::bencode
@@ -0,0 +1,142 @@
+#include "bencode_tape.hpp"
+
+#include "bencode_lexer.hpp"
+
+namespace fur::bencode {
+
+std::optional<TapeRef> TapeRef::find(std::string_view key) const {
+  if (!is_dict()) return std::nullopt;
+
+  for (auto it = begin(); it != end(); ++it) {
+    auto current = (*it).string();
+    ++it;
+    if (current == key) return *it;
+    // Keys are sorted, the key can't appear later
+    if (current > key) break;
+  }
+  return std::nullopt;
+}
+
+namespace {
+/// A list or dict still waiting for its closing 'e'
+struct Open {
+  /// Index of the container node
+  size_t node;
+  /// Position of the container in the input
+  size_t begin;
+  /// For dicts, true if the next value is a key
+  bool expect_key;
+  /// For dicts, the last key read, to check their order
+  std::optional<std::string_view> last_key;
+};
+}  // namespace
+
+auto Tape::parse(std::string_view input) -> TapeResult {
+  std::vector<TapeNode> nodes;
+  std::vector<Open> open;
+  size_t pos = 0;
+
+  do {
+    if (pos >= input.size()) {
+      // The input ended with some containers still open
+      if (open.empty())
+        return TapeResult::ERROR(BencodeParserError::InvalidString);
+      return TapeResult::ERROR(nodes[open.back().node].type == BencodeType::List
+                                   ? BencodeParserError::ListFormat
+                                   : BencodeParserError::DictFormat);
+    }
+    const char token = input[pos];
+
+    if (token == 'e' && !open.empty()) {
+      auto& top = open.back();
+      auto& node = nodes[top.node];
+      // A dict key without its value
+      if (node.type == BencodeType::Dict && !top.expect_key)
+        return TapeResult::ERROR(BencodeParserError::DictFormat);
+
+      node.span = static_cast<uint32_t>(nodes.size() - top.node);
+      pos += 1;
+      node.raw = input.substr(top.begin, pos - top.begin);
+      open.pop_back();
+      continue;
+    }
+
+    const bool is_key = !open.empty() &&
+                        nodes[open.back().node].type == BencodeType::Dict &&
+                        open.back().expect_key;
+    if (is_key && (token < '0' || token > '9'))
+      return TapeResult::ERROR(BencodeParserError::DictKey);
+
+    const size_t begin = pos;
+    TapeNode node{BencodeType::Integer, 1, 0, 0, {}, {}};
+    if (token == 'i') {
+      auto lexing = lexer::integer(input, pos, node.integer);
+      if (!lexing.valid())
+        return TapeResult::ERROR(BencodeParserError(lexing.error()));
+      pos = *lexing;
+    } else if (token >= '0' && token <= '9') {
+      node.type = BencodeType::String;
+      auto lexing = lexer::string(input, pos, node.string);
+      if (!lexing.valid())
+        return TapeResult::ERROR(BencodeParserError(lexing.error()));
+      pos = *lexing;
+    } else if (token == 'l' || token == 'd') {
+      // The span is known only once the container is closed
+      node.type = token == 'l' ? BencodeType::List : BencodeType::Dict;
+      pos += 1;
+    } else {
+      return TapeResult::ERROR(BencodeParserError::InvalidString);
+    }
+
+    // Containers are completed once closed
+    node.raw = input.substr(begin, pos - begin);
+
+    if (!open.empty()) {
+      auto& top = open.back();
+      nodes[top.node].size += 1;
+      if (is_key) {
+        if (top.last_key && *top.last_key >= node.string)
+          return TapeResult::ERROR(BencodeParserError::DictKeyOrder);
+        top.last_key = node.string;
+      }
+      if (nodes[top.node].type == BencodeType::Dict)
+        top.expect_key = !top.expect_key;
+    }
+
+    nodes.push_back(node);
+    if (node.type == BencodeType::List || node.type == BencodeType::Dict)
+      open.push_back({nodes.size() - 1, begin, true, std::nullopt});
+  } while (!open.empty());
+
+  if (pos != input.size())
+    return TapeResult::ERROR(BencodeParserError::InvalidString);
+  return TapeResult::OK(Tape(std::move(nodes)));
+}
+
+std::unique_ptr<BencodeValue> to_value(TapeRef ref) {
+  switch (ref.type()) {
+    case BencodeType::Integer:
+      return std::make_unique<BencodeInt>(ref.integer());
+    case BencodeType::String:
+      return std::make_unique<BencodeString>(std::string(ref.string()));
+    case BencodeType::List: {
+      std::vector<std::unique_ptr<BencodeValue>> list;
+      list.reserve(ref.size());
+      for (auto element : ref) list.push_back(to_value(element));
+      return std::make_unique<BencodeList>(std::move(list));
+    }
+    case BencodeType::Dict:
+    default: {
+      std::map<std::string, std::unique_ptr<BencodeValue>> dict;
+      // Keys are sorted, each one is inserted at the end of the map
+      for (auto it = ref.begin(); it != ref.end(); ++it) {
+        std::string key((*it).string());
+        ++it;
+        dict.emplace_hint(dict.end(), std::move(key), to_value(*it));
+      }
+      return std::make_unique<BencodeDict>(std::move(dict));
+    }
+  }
+}
+
+}  // namespace fur::bencode
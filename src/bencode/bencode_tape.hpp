@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "bencode_parser.hpp"
+#include "bencode_value.hpp"
+#include "util/result.hpp"
+
+namespace fur::bencode {
+
+/// A single bencode value stored in a `Tape`
+struct TapeNode {
+  BencodeType type;
+  /// Number of nodes taken by this value, itself and all its descendants. The
+  /// next sibling is this many nodes ahead
+  uint32_t span;
+  /// Number of elements of a list, or keys and values of a dict
+  uint32_t size;
+  /// Value of an integer
+  long integer;
+  /// Content of a string, a view into the parsed input
+  std::string_view string;
+  /// The whole encoded value exactly as it appears in the input
+  std::string_view raw;
+};
+
+/// Read-only handle to a value of a `Tape`, cheap to copy
+class TapeRef {
+  const TapeNode* _node;
+
+ public:
+  explicit TapeRef(const TapeNode* node) : _node{node} {}
+
+  /// Iterates over the elements of a list or the keys and values of a dict
+  class Iterator {
+    const TapeNode* _node;
+
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = TapeRef;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = TapeRef;
+
+    explicit Iterator(const TapeNode* node) : _node{node} {}
+    TapeRef operator*() const { return TapeRef(_node); }
+    Iterator& operator++() {
+      _node += _node->span;
+      return *this;
+    }
+    bool operator==(const Iterator& other) const {
+      return _node == other._node;
+    }
+    bool operator!=(const Iterator& other) const {
+      return _node != other._node;
+    }
+  };
+
+  [[nodiscard]] BencodeType type() const { return _node->type; }
+  [[nodiscard]] bool is_int() const { return type() == BencodeType::Integer; }
+  [[nodiscard]] bool is_string() const { return type() == BencodeType::String; }
+  [[nodiscard]] bool is_list() const { return type() == BencodeType::List; }
+  [[nodiscard]] bool is_dict() const { return type() == BencodeType::Dict; }
+
+  /// @return value of an integer, undefined behaviour for other types
+  [[nodiscard]] long integer() const { return _node->integer; }
+  /// @return content of a string, undefined behaviour for other types
+  [[nodiscard]] std::string_view string() const { return _node->string; }
+  /// @return number of elements of a list, or keys and values of a dict
+  [[nodiscard]] size_t size() const { return _node->size; }
+  /// @return the encoded value as it appears in the input, e.g. to hash it
+  [[nodiscard]] std::string_view raw() const { return _node->raw; }
+
+  /// Children of a list or dict, keys and values of a dict alternate
+  [[nodiscard]] Iterator begin() const { return Iterator(_node + 1); }
+  [[nodiscard]] Iterator end() const { return Iterator(_node + _node->span); }
+
+  /// Value of `key` in a dict
+  /// @return nothing if this is not a dict or the key is missing
+  [[nodiscard]] std::optional<TapeRef> find(std::string_view key) const;
+};
+
+/// Bencode values laid out flat in a single vector, in the order they appear
+/// in the input. Strings are views into the input, which must outlive the
+/// tape, so parsing allocates only the vector of nodes
+class Tape {
+  std::vector<TapeNode> _nodes;
+
+  explicit Tape(std::vector<TapeNode> nodes) : _nodes{std::move(nodes)} {}
+
+ public:
+  /// Parse a whole bencoded value, no bytes may follow it
+  static util::Result<Tape, BencodeParserError> parse(std::string_view input);
+
+  /// @return the outermost value
+  [[nodiscard]] TapeRef root() const { return TapeRef(_nodes.data()); }
+  /// @return number of values, including nested ones
+  [[nodiscard]] size_t size() const { return _nodes.size(); }
+};
+
+/// Result of parsing a tape
+using TapeResult = util::Result<Tape, BencodeParserError>;
+
+/// Build a tree of `BencodeValue` copying a value of a tape
+std::unique_ptr<BencodeValue> to_value(TapeRef ref);
+
+}  // namespace fur::bencode
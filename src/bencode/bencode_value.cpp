@@ -1,19 +1,25 @@
 #include "bencode_value.hpp"
 
-#include <regex>
 #include <string>
 #include <utility>
 
+#include "bencode_writer.hpp"
+
 using namespace fur::bencode;
 
+std::string BencodeValue::to_string() const {
+  BencodeWriter writer;
+  encode(writer);
+  return writer.take();
+}
+
 // ================
 // BencodeInt
 // ================
 BencodeInt::BencodeInt(long data) { _val = data; }
 
-std::string BencodeInt::to_string() const {
-  // Return the encoded string of the BencodeInt i + val + e
-  return "i" + std::to_string(_val) + "e";
+void BencodeInt::encode(BencodeWriter& writer) const {
+  writer.integer(_val);
 }
 
 BencodeType BencodeInt::get_type() const { return BencodeType::Integer; }
@@ -25,9 +31,8 @@ long BencodeInt::value() const { return _val; }
 // ================
 BencodeString::BencodeString(std::string data) { _val = std::move(data); }
 
-std::string BencodeString::to_string() const {
-  // Return the encoded string of the BencodeString size: + val
-  return std::to_string(_val.size()) + ":" + _val;
+void BencodeString::encode(BencodeWriter& writer) const {
+  writer.string(_val);
 }
 
 BencodeType BencodeString::get_type() const { return BencodeType::String; }
@@ -41,14 +46,12 @@ BencodeList::BencodeList(std::vector<std::unique_ptr<BencodeValue>> data) {
   _val = std::move(data);
 }
 
-std::string BencodeList::to_string() const {
-  // Return the encoded string of the BencodeList l + ... + e
-  std::string ret = "l";
+void BencodeList::encode(BencodeWriter& writer) const {
+  writer.begin_list();
   for (auto& v : _val) {
-    ret += v->to_string();
+    v->encode(writer);
   }
-  ret += "e";
-  return ret;
+  writer.end();
 }
 
 BencodeType BencodeList::get_type() const { return BencodeType::List; }
@@ -64,17 +67,14 @@ BencodeDict::BencodeDict(
     std::map<std::string, std::unique_ptr<BencodeValue>> data) {
   _val = std::move(data);
 }
-std::string BencodeDict::to_string() const {
-  // Return the encoded string of the BencodeDict d + ... + e
-  std::string ret = "d";
+void BencodeDict::encode(BencodeWriter& writer) const {
+  writer.begin_dict();
   // Map is already sorted by key, so we can just iterate over it
   for (auto const& [key, val] : _val) {
-    // Format of element is size:key + value
-    ret += std::to_string(key.size()) + ":" + key;
-    ret += val->to_string();
+    writer.string(key);
+    val->encode(writer);
   }
-  ret += "e";
-  return ret;
+  writer.end();
 }
 
 BencodeType BencodeDict::get_type() const { return BencodeType::Dict; }
@@ -11,10 +11,14 @@ namespace fur::bencode {
 /// Enumeration for the different types of bencode data
 enum class BencodeType { Integer, String, List, Dict };
 
+class BencodeWriter;
+
 class BencodeValue {
  public:
   /// Returns the string representation of the bencode value
-  [[nodiscard]] virtual std::string to_string() const = 0;
+  [[nodiscard]] std::string to_string() const;
+  /// Appends the string representation of the bencode value to `writer`
+  virtual void encode(BencodeWriter& writer) const = 0;
   /// Returns the type of the bencode value as a BencodeType enum
   [[nodiscard]] virtual BencodeType get_type() const = 0;
   virtual ~BencodeValue() = default;
@@ -27,7 +31,7 @@ class BencodeInt : public BencodeValue {
 
  public:
   explicit BencodeInt(long data);
-  [[nodiscard]] std::string to_string() const override;
+  void encode(BencodeWriter& writer) const override;
   [[nodiscard]] BencodeType get_type() const override;
   /// Returns the integer value of the bencode value
   [[nodiscard]] long value() const;
@@ -40,7 +44,7 @@ class BencodeString : public BencodeValue {
 
  public:
   explicit BencodeString(std::string data);
-  [[nodiscard]] std::string to_string() const override;
+  void encode(BencodeWriter& writer) const override;
   [[nodiscard]] BencodeType get_type() const override;
   /// Returns the string value of the bencode value
   [[nodiscard]] std::string& value();
@@ -53,7 +57,7 @@ class BencodeList : public BencodeValue {
 
  public:
   explicit BencodeList(std::vector<std::unique_ptr<BencodeValue>> data);
-  [[nodiscard]] std::string to_string() const override;
+  void encode(BencodeWriter& writer) const override;
   [[nodiscard]] BencodeType get_type() const override;
   /// Returns the list of BencodeValue objects that are contained in the list
   [[nodiscard]] std::vector<std::unique_ptr<BencodeValue>>& value();
@@ -68,7 +72,7 @@ class BencodeDict : public BencodeValue {
   /// Constructs a BencodeDict object from a map of strings and BencodeValue
   explicit BencodeDict(
       std::map<std::string, std::unique_ptr<BencodeValue>> data);
-  [[nodiscard]] std::string to_string() const override;
+  void encode(BencodeWriter& writer) const override;
   [[nodiscard]] BencodeType get_type() const override;
   /// Returns the dictionary of BencodeValue objects that are contained in the
   /// dict
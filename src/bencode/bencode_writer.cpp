@@ -0,0 +1,55 @@
+#include "bencode_writer.hpp"
+
+#include <charconv>
+
+namespace fur::bencode {
+
+/// Append the decimal representation of `value` to `buffer`
+template <typename T>
+static void append_number(std::string& buffer, T value) {
+  char digits[24];
+  auto result = std::to_chars(digits, digits + sizeof(digits), value);
+  buffer.append(digits, result.ptr);
+}
+
+BencodeWriter& BencodeWriter::integer(long value) {
+  _buffer += 'i';
+  append_number(_buffer, value);
+  _buffer += 'e';
+  return *this;
+}
+
+BencodeWriter& BencodeWriter::string(std::string_view value) {
+  append_number(_buffer, value.size());
+  _buffer += ':';
+  _buffer.append(value);
+  return *this;
+}
+
+BencodeWriter& BencodeWriter::begin_list() {
+  _buffer += 'l';
+  return *this;
+}
+
+BencodeWriter& BencodeWriter::begin_dict() {
+  _buffer += 'd';
+  return *this;
+}
+
+BencodeWriter& BencodeWriter::end() {
+  _buffer += 'e';
+  return *this;
+}
+
+BencodeWriter& BencodeWriter::value(const BencodeValue& value) {
+  value.encode(*this);
+  return *this;
+}
+
+std::string BencodeWriter::take() {
+  std::string result = std::move(_buffer);
+  _buffer.clear();
+  return result;
+}
+
+}  // namespace fur::bencode
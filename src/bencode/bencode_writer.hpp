@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "bencode_value.hpp"
+
+namespace fur::bencode {
+
+/// Encodes bencode values appending them to a single buffer, which grows as
+/// needed and can be reused for many encodings. Lists and dicts are opened
+/// and closed explicitly, so values can be written without building a tree
+/// of `BencodeValue` first. Keys of a dict must be written in sorted order
+class BencodeWriter {
+  std::string _buffer;
+
+ public:
+  BencodeWriter() = default;
+
+  /// Append an integer
+  BencodeWriter& integer(long value);
+  /// Append a string, which may contain arbitrary bytes
+  BencodeWriter& string(std::string_view value);
+  /// Append the beginning of a list, closed by `end`
+  BencodeWriter& begin_list();
+  /// Append the beginning of a dict, closed by `end`. Keys are written with
+  /// `string` and each one is followed by its value
+  BencodeWriter& begin_dict();
+  /// Append the end of the innermost list or dict
+  BencodeWriter& end();
+  /// Append a whole tree of values
+  BencodeWriter& value(const BencodeValue& value);
+
+  /// @return the encoded values
+  [[nodiscard]] const std::string& buffer() const { return _buffer; }
+  /// Take the encoded values, leaving the writer empty
+  std::string take();
+  /// Remove the encoded values keeping the memory allocated
+  void clear() { _buffer.clear(); }
+};
+
+}  // namespace fur::bencode
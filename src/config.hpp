@@ -1,5 +1,9 @@
 #pragma once
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <platform/io.hpp>
 #include <string>
 
 namespace fur::config {
@@ -7,4 +11,81 @@ namespace fur::config {
 /// Where newly downloaded files are to be stored
 static std::string DOWNLOAD_FOLDER = "output";
 
+/// How the space for the files of a new torrent is reserved by default
+static constexpr platform::io::Preallocation PREALLOCATION =
+    platform::io::Preallocation::Sparse;
+
+/// Memory of all piece buffers, being downloaded or waiting to be written. Must
+/// be well above WRITE_BEHIND_MEMORY to leave room for the downloads
+static constexpr size_t PIECE_POOL_MEMORY = 256 * 1024 * 1024;
+
+/// Back large piece buffers with transparent huge pages, reducing page faults
+/// and TLB misses with big pieces
+static constexpr bool PIECE_POOL_HUGE_PAGES = false;
+
+/// Number of corrupt pieces after which a peer is banned from a torrent, a
+/// few are tolerated since honest peers can relay bad data by mistake
+static constexpr uint32_t PEER_MAX_STRIKES = 3;
+
+/// Throughput, in bytes per second, assumed for peers that never sent a piece.
+/// High enough that untried peers keep being picked now and then
+static constexpr double PEER_PRIOR_THROUGHPUT = 256 * 1024;
+
+/// Round trip time assumed for peers that never sent a piece
+static constexpr std::chrono::milliseconds PEER_PRIOR_RTT{200};
+
+/// Weight of each new measure in the moving averages of a peer's quality
+static constexpr double PEER_SAMPLE_WEIGHT = 0.25;
+
+/// Time after which what is known about a peer counts half, its quality
+/// then drifts back towards the prior until it is measured again
+static constexpr std::chrono::seconds PEER_STATS_HALF_LIFE{120};
+
+/// Time a peer is left alone after its connection failed, doubled after each
+/// consecutive failure
+static constexpr std::chrono::seconds PEER_BACKOFF_BASE{10};
+
+/// Consecutive connection failures after which a peer is blacklisted, most
+/// likely it is gone for good
+static constexpr uint32_t PEER_BLACKLIST_FAILURES = 4;
+
+/// Time a blacklisted peer is left alone before it is tried again
+static constexpr std::chrono::minutes PEER_BLACKLIST_TIME{30};
+
+/// Connection attempts in flight at once across all torrents, so that the
+/// first pieces come from the fastest peers to answer
+static constexpr size_t CONNECT_HALF_OPEN = 16;
+
+/// Time after which a connection attempt is given up
+static constexpr std::chrono::seconds CONNECT_TIMEOUT{5};
+
+/// Time a peer may keep us choked before its connection is closed. Should be
+/// greater than 10 seconds for a realistic torrent client but smaller values
+/// result in quicker testing
+static constexpr std::chrono::seconds UNCHOKE_TIMEOUT{15};
+
+/// Connections to peers across all torrents
+static constexpr size_t CONNECTIONS_MAX = 200;
+
+/// Connections to the peers of a single torrent
+static constexpr size_t CONNECTIONS_PER_TORRENT = 40;
+
+/// Threads verifying downloaded pieces. Blocks are hashed while they arrive
+/// so little work is left, raise it if the hash queue keeps growing
+static constexpr size_t HASHING_THREADS = 2;
+
+/// Memory that verified pieces can occupy while waiting to be written
+static constexpr size_t WRITE_BEHIND_MEMORY = 64 * 1024 * 1024;
+
+/// Maximum time a verified piece waits for its neighbours before being written
+static constexpr std::chrono::milliseconds WRITE_BEHIND_DELAY{2000};
+
+/// Write pieces bypassing the page cache (O_DIRECT), useful for huge torrents
+/// that would otherwise evict everything else from memory
+static constexpr bool DIRECT_IO = false;
+
+/// Number of pieces written to disk between two saves of the resume data of a
+/// torrent, it is also saved when a torrent completes or is removed
+static constexpr size_t RESUME_SAVE_INTERVAL = 64;
+
 }  // namespace fur::config
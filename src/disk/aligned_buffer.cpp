@@ -0,0 +1,26 @@
+#include <disk/aligned_buffer.hpp>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+namespace fur::disk {
+
+AlignedBuffer::AlignedBuffer(size_t size, size_t alignment)
+    : _data{nullptr}, _size{size} {
+  void* memory = nullptr;
+  if (posix_memalign(&memory, alignment, size) != 0) throw std::bad_alloc();
+  _data = static_cast<uint8_t*>(memory);
+}
+
+AlignedBuffer::~AlignedBuffer() { free(_data); }
+
+AlignedBuffer::AlignedBuffer(AlignedBuffer&& o) noexcept
+    : _data{std::exchange(o._data, nullptr)}, _size{std::exchange(o._size, 0)} {}
+
+AlignedBuffer& AlignedBuffer::operator=(AlignedBuffer&& o) noexcept {
+  std::swap(_data, o._data);
+  std::swap(_size, o._size);
+  return *this;
+}
+
+}  // namespace fur::disk
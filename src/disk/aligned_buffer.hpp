@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <platform/io.hpp>
+
+namespace fur::disk {
+
+/// Heap memory whose address is aligned to a given boundary, as required by
+/// direct I/O. The content is not initialized. Movable but not copyable
+class AlignedBuffer {
+  /// Beginning of the memory, nullptr if moved from
+  uint8_t* _data;
+  /// Size in bytes
+  size_t _size;
+
+ public:
+  /// Allocate a new buffer, throws `std::bad_alloc` on failure
+  /// @param size size in bytes
+  /// @param alignment alignment of the address, must be a power of two
+  explicit AlignedBuffer(
+      size_t size, size_t alignment = platform::io::DIRECT_IO_ALIGNMENT);
+  ~AlignedBuffer();
+
+  AlignedBuffer(const AlignedBuffer&) = delete;
+  AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+  AlignedBuffer(AlignedBuffer&& o) noexcept;
+  AlignedBuffer& operator=(AlignedBuffer&& o) noexcept;
+
+  [[nodiscard]] uint8_t* data() { return _data; }
+  [[nodiscard]] const uint8_t* data() const { return _data; }
+  [[nodiscard]] size_t size() const { return _size; }
+};
+
+}  // namespace fur::disk
@@ -0,0 +1,240 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <disk/recheck.hpp>
+#include <hash.hpp>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace fur::disk {
+
+/// Memory used by pieces read and not yet hashed
+const size_t RECHECK_READ_AHEAD = 64 * 1024 * 1024;
+
+/// A piece read from disk, waiting to be hashed
+struct ReadPiece {
+  size_t index;
+  /// False if the piece couldn't be read entirely
+  bool readable;
+  std::vector<uint8_t> content;
+};
+
+/// Bounded queue between the reader threads and the hashing threads
+class ReadQueue {
+  std::mutex _mutex;
+  std::condition_variable _not_full;
+  std::condition_variable _not_empty;
+  std::deque<ReadPiece> _pieces;
+  /// Bytes of the pieces in the queue
+  size_t _bytes = 0;
+  /// Readers still running
+  size_t _readers;
+
+ public:
+  explicit ReadQueue(size_t readers) : _readers{readers} {}
+
+  /// Blocks while the read-ahead memory is exhausted
+  void push(ReadPiece piece) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    // A single piece larger than the limit must still be accepted
+    _not_full.wait(lock, [&] {
+      return _pieces.empty() ||
+             _bytes + piece.content.size() <= RECHECK_READ_AHEAD;
+    });
+    _bytes += piece.content.size();
+    _pieces.push_back(std::move(piece));
+    _not_empty.notify_one();
+  }
+
+  /// Signals that a reader has no more pieces
+  void reader_done() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _readers -= 1;
+    _not_empty.notify_all();
+  }
+
+  /// Blocks until a piece is available, then takes up to `max` pieces
+  /// @return false once all readers are done and the queue is empty
+  bool pop(std::vector<ReadPiece>& pieces, size_t max) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _not_empty.wait(lock, [&] { return !_pieces.empty() || _readers == 0; });
+    if (_pieces.empty()) return false;
+
+    pieces.clear();
+    while (!_pieces.empty() && pieces.size() < max) {
+      _bytes -= _pieces.front().content.size();
+      pieces.push_back(std::move(_pieces.front()));
+      _pieces.pop_front();
+    }
+    _not_full.notify_all();
+    return true;
+  }
+};
+
+/// Keeps the last opened file of a reader, pieces are read in order so
+/// consecutive subpieces usually belong to the same file
+class FileCursor {
+  std::string _filepath;
+  int _fd = -1;
+
+ public:
+  FileCursor() = default;
+  FileCursor(const FileCursor&) = delete;
+  FileCursor& operator=(const FileCursor&) = delete;
+  ~FileCursor() {
+    if (_fd >= 0) close(_fd);
+  }
+
+  /// @return descriptor of the file, negative if it can't be opened
+  int open_file(const std::string& filepath) {
+    if (_fd >= 0 && _filepath == filepath) return _fd;
+    if (_fd >= 0) close(_fd);
+
+    _filepath = filepath;
+    _fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+#ifdef POSIX_FADV_SEQUENTIAL
+    // Enlarges the kernel read-ahead window
+    if (_fd >= 0) posix_fadvise(_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return _fd;
+  }
+};
+
+/// Read a subpiece entirely
+static bool read_fully(int fd, uint8_t* dest, size_t len, size_t offset) {
+  while (len > 0) {
+    ssize_t got = pread(fd, dest, len, static_cast<off_t>(offset));
+    if (got < 0 && errno == EINTR) continue;
+    if (got <= 0) return false;
+    dest += got;
+    len -= static_cast<size_t>(got);
+    offset += static_cast<size_t>(got);
+  }
+  return true;
+}
+
+/// Read pieces in order and hand them to the hashing threads, until all are
+/// read or the check is stopped
+static void reader_main(const std::string& folder, const PieceLayout& layout,
+                        const std::vector<size_t>& indices, ReadQueue& queue,
+                        const std::atomic_bool& stopped) {
+  FileCursor cursor;
+  for (size_t index : indices) {
+    if (stopped.load(std::memory_order_relaxed)) break;
+
+    const Piece piece = layout.piece(index);
+    size_t len = 0;
+    for (const auto& subpiece : piece.subpieces) len += subpiece.len;
+
+    ReadPiece read{index, true, std::vector<uint8_t>(len)};
+    uint8_t* dest = read.content.data();
+    for (const auto& subpiece : piece.subpieces) {
+      int fd = cursor.open_file(folder + '/' + layout.path(subpiece.file));
+      if (fd < 0 ||
+          !read_fully(fd, dest, subpiece.len, subpiece.file_offset)) {
+        read.readable = false;
+        read.content.clear();
+        break;
+      }
+      dest += subpiece.len;
+    }
+    queue.push(std::move(read));
+  }
+  queue.reader_done();
+}
+
+download::bitfield::Bitfield recheck(const std::string& folder,
+                                     const TorrentFile& torrent,
+                                     const PieceLayout& layout,
+                                     const ProgressFn& progress,
+                                     size_t threads) {
+  download::bitfield::Bitfield valid(
+      static_cast<uint32_t>(torrent.piece_hashes.size()));
+
+  // Group pieces by the device holding their first file, a piece spanning
+  // two devices is rare and is still read by a single thread
+  std::map<dev_t, std::vector<size_t>> devices;
+  // Device of each file, looked up once per file
+  std::map<uint32_t, dev_t> file_devices;
+  size_t total = 0;
+  for (size_t index = 0; index < layout.pieces_count(); index++) {
+    const Piece piece = layout.piece(index);
+    if (piece.subpieces.empty()) continue;
+
+    const uint32_t file = piece.subpieces[0].file;
+    auto found = file_devices.find(file);
+    if (found == file_devices.end()) {
+      struct stat info {};
+      const std::string filepath = folder + '/' + layout.path(file);
+      dev_t device = stat(filepath.c_str(), &info) == 0 ? info.st_dev : 0;
+      found = file_devices.emplace(file, device).first;
+    }
+    devices[found->second].push_back(index);
+    total += 1;
+  }
+
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+  if (threads == 0) threads = 1;
+
+  ReadQueue queue(devices.size());
+  std::mutex valid_mutex;
+  size_t checked = 0;
+  std::atomic_bool stopped{false};
+
+  std::vector<std::thread> readers;
+  for (const auto& [device, device_pieces] : devices)
+    readers.emplace_back(reader_main, std::cref(folder), std::cref(layout),
+                         std::cref(device_pieces), std::ref(queue),
+                         std::cref(stopped));
+
+  // Pieces have the same length except the last one, so whole groups can be
+  // hashed at once by the multi-buffer backend
+  auto multi = sha1::best_multi_backend();
+  const size_t batch = multi ? sha1::lanes(*multi) : 1;
+
+  std::vector<std::thread> hashers;
+  for (size_t i = 0; i < threads; i++) {
+    hashers.emplace_back([&] {
+      std::vector<ReadPiece> reads;
+      std::vector<hash::PieceView> views;
+      std::vector<hash::hash_t> hashes;
+      std::vector<size_t> indices;
+      while (queue.pop(reads, batch)) {
+        // Pieces read ahead are only drained once stopped
+        if (stopped.load(std::memory_order_relaxed)) continue;
+
+        views.clear();
+        hashes.clear();
+        indices.clear();
+        for (const auto& read : reads) {
+          if (!read.readable || read.index >= torrent.piece_hashes.size())
+            continue;
+          views.push_back({read.content.data(), read.content.size()});
+          hashes.push_back(torrent.piece_hashes[read.index]);
+          indices.push_back(read.index);
+        }
+        auto matches = hash::verify_pieces(views, hashes);
+
+        std::unique_lock<std::mutex> lock(valid_mutex);
+        for (size_t j = 0; j < indices.size(); j++)
+          if (matches[j]) valid.set(static_cast<uint32_t>(indices[j]));
+        for (size_t j = 0; j < reads.size() && !stopped; j++) {
+          checked += 1;
+          if (progress && !progress(checked, total)) stopped = true;
+        }
+      }
+    });
+  }
+
+  for (auto& reader : readers) reader.join();
+  for (auto& hasher : hashers) hasher.join();
+  return valid;
+}
+
+}  // namespace fur::disk
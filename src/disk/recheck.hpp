@@ -0,0 +1,35 @@
+#pragma once
+
+#include <download/bitfield.hpp>
+#include <functional>
+#include <string>
+#include <torrent.hpp>
+#include <vector>
+
+namespace fur::disk {
+
+/// Called after every piece checked
+/// @param checked number of pieces checked so far
+/// @param total number of pieces to check
+/// @return false to stop checking, the pieces left are reported as invalid
+using ProgressFn = std::function<bool(size_t checked, size_t total)>;
+
+/// Verify the data already on disk against the torrent piece hashes. Pieces
+/// are read sequentially by one thread per device, so that each disk sees a
+/// single stream of large reads, while hashing happens on all cores, many
+/// pieces at once on each core if the CPU has multi-buffer SHA1. Reads
+/// run ahead of hashing up to a fixed amount of memory, keeping the disks
+/// busy. Missing or short files simply make their pieces fail
+/// @param folder folder containing all torrent files
+/// @param torrent torrent descriptor with the expected hashes
+/// @param layout mapping of the pieces on the torrent files
+/// @param progress called by the hashing threads, can be empty
+/// @param threads number of hashing threads, 0 to use all cores
+/// @return pieces that are complete and valid
+download::bitfield::Bitfield recheck(const std::string& folder,
+                                     const TorrentFile& torrent,
+                                     const PieceLayout& layout,
+                                     const ProgressFn& progress = {},
+                                     size_t threads = 0);
+
+}  // namespace fur::disk
@@ -0,0 +1,146 @@
+#include <bencode/bencode_parser.hpp>
+#include <bencode/bencode_value.hpp>
+#include <bencode/bencode_writer.hpp>
+#include <chrono>
+#include <disk/resume.hpp>
+#include <filesystem>
+#include <memory>
+#include <platform/io.hpp>
+
+namespace fur::disk {
+
+using namespace fur::bencode;
+using namespace fur::platform;  // For IO operations
+
+/// Name of the resume file inside the torrent folder
+const char* RESUME_FILENAME = ".furrent-resume";
+
+/// @return the value of `key` in `dict` if it has type `T`, nullptr otherwise
+template <typename T>
+static T* find(BencodeDict& dict, const std::string& key, BencodeType type) {
+  auto it = dict.value().find(key);
+  if (it == dict.value().end() || it->second->get_type() != type)
+    return nullptr;
+  return static_cast<T*>(it->second.get());
+}
+
+std::string resume_path(const std::string& folder) {
+  return folder + '/' + RESUME_FILENAME;
+}
+
+std::optional<std::vector<FileStamp>> stamp_files(const std::string& folder,
+                                                  const TorrentFile& torrent) {
+  std::vector<FileStamp> stamps;
+  stamps.reserve(torrent.files.size());
+
+  for (const auto& file : torrent.files) {
+    const std::string filepath = folder + '/' + file.filename();
+
+    std::error_code error;
+    size_t length = std::filesystem::file_size(filepath, error);
+    if (error) return std::nullopt;
+    auto mtime = std::filesystem::last_write_time(filepath, error);
+    if (error) return std::nullopt;
+
+    auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        mtime.time_since_epoch());
+    stamps.push_back({length, static_cast<int64_t>(since_epoch.count())});
+  }
+  return stamps;
+}
+
+ResumeResult<util::Empty> save_resume(const std::string& filepath,
+                                      const ResumeData& data) {
+  auto bytes = data.completed.get_bytes();
+  auto info_hash = hash::hash_to_str(data.info_hash);
+
+  // Keys in sorted order
+  BencodeWriter writer;
+  writer.begin_dict();
+  writer.string("bitfield")
+      .string({reinterpret_cast<const char*>(bytes.data()), bytes.size()});
+  writer.string("files").begin_list();
+  for (const auto& stamp : data.files) {
+    writer.begin_dict()
+        .string("length")
+        .integer(static_cast<long>(stamp.length))
+        .string("mtime")
+        .integer(stamp.mtime)
+        .end();
+  }
+  writer.end();
+  writer.string("info hash").string(info_hash);
+  writer.string("pieces").integer(data.completed.len);
+  writer.end();
+
+  auto saving = io::save_file_text(filepath, writer.buffer());
+  if (!saving.valid())
+    return ResumeResult<util::Empty>::ERROR(ResumeError::CannotWrite);
+  return ResumeResult<util::Empty>::OK({});
+}
+
+ResumeResult<ResumeData> load_resume(const std::string& filepath) {
+  auto reading = io::load_file_text(filepath);
+  if (!reading.valid())
+    return ResumeResult<ResumeData>::ERROR(ResumeError::CannotRead);
+
+  BencodeParser parser;
+  auto tree = parser.decode(*reading);
+  if (!tree.valid() || (*tree)->get_type() != BencodeType::Dict)
+    return ResumeResult<ResumeData>::ERROR(ResumeError::Malformed);
+  auto& root = static_cast<BencodeDict&>(**tree);
+
+  auto* info_hash = find<BencodeString>(root, "info hash", BencodeType::String);
+  auto* pieces = find<BencodeInt>(root, "pieces", BencodeType::Integer);
+  auto* bitfield = find<BencodeString>(root, "bitfield", BencodeType::String);
+  auto* files = find<BencodeList>(root, "files", BencodeType::List);
+  if (!info_hash || !pieces || !bitfield || !files ||
+      info_hash->value().size() != std::tuple_size_v<hash::hash_t> ||
+      pieces->value() < 0 ||
+      bitfield->value().size() !=
+          (static_cast<size_t>(pieces->value()) + 7) / 8)
+    return ResumeResult<ResumeData>::ERROR(ResumeError::Malformed);
+
+  hash::hash_t hash;
+  std::copy(info_hash->value().begin(), info_hash->value().end(),
+            hash.begin());
+
+  ResumeData data{
+      hash,
+      download::bitfield::Bitfield(
+          std::vector<uint8_t>(bitfield->value().begin(),
+                               bitfield->value().end()),
+          static_cast<uint32_t>(pieces->value())),
+      {}};
+
+  for (auto& node : files->value()) {
+    if (node->get_type() != BencodeType::Dict)
+      return ResumeResult<ResumeData>::ERROR(ResumeError::Malformed);
+    auto& file = static_cast<BencodeDict&>(*node);
+
+    auto* length = find<BencodeInt>(file, "length", BencodeType::Integer);
+    auto* mtime = find<BencodeInt>(file, "mtime", BencodeType::Integer);
+    if (!length || !mtime || length->value() < 0)
+      return ResumeResult<ResumeData>::ERROR(ResumeError::Malformed);
+
+    data.files.push_back(
+        {static_cast<size_t>(length->value()), mtime->value()});
+  }
+
+  return ResumeResult<ResumeData>::OK(std::move(data));
+}
+
+bool resume_matches(const ResumeData& data, const TorrentFile& torrent,
+                    const std::vector<FileStamp>& stamps) {
+  if (data.info_hash != torrent.info_hash) return false;
+  if (data.completed.len != torrent.piece_hashes.size()) return false;
+
+  // Any file changed since the resume data was saved might contain pieces
+  // different from the ones marked as completed. Files are compared with
+  // their size on disk, which is below the torrent one for unfinished files
+  // that are not preallocated
+  if (data.files.size() != torrent.files.size()) return false;
+  return data.files == stamps;
+}
+
+}  // namespace fur::disk
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <download/bitfield.hpp>
+#include <hash.hpp>
+#include <optional>
+#include <string>
+#include <torrent.hpp>
+#include <util/result.hpp>
+#include <vector>
+
+namespace fur::disk {
+
+/// Size and last modification time of a file on disk, used to detect files
+/// changed while furrent was not running
+struct FileStamp {
+  size_t length;
+  int64_t mtime;
+
+  bool operator==(const FileStamp& o) const {
+    return length == o.length && mtime == o.mtime;
+  }
+};
+
+/// Progress of a torrent that survives a restart
+struct ResumeData {
+  /// Torrent this data belongs to
+  hash::hash_t info_hash;
+  /// Pieces already written to disk
+  download::bitfield::Bitfield completed;
+  /// Stamps of all torrent files when the data was saved, in the same order
+  /// as `TorrentFile::files`
+  std::vector<FileStamp> files;
+};
+
+enum class ResumeError {
+  /// The resume file doesn't exist or can't be read
+  CannotRead,
+  /// The resume file can't be written
+  CannotWrite,
+  /// The resume file is not valid
+  Malformed,
+};
+
+template <typename T>
+using ResumeResult = util::Result<T, ResumeError>;
+
+/// @return path of the resume file of a torrent saved in `folder`
+std::string resume_path(const std::string& folder);
+
+/// Reads the current stamps of all files of a torrent
+/// @param folder folder containing all torrent files
+/// @return nothing if any of the files can't be accessed
+std::optional<std::vector<FileStamp>> stamp_files(const std::string& folder,
+                                                  const TorrentFile& torrent);
+
+/// Writes resume data, atomically replacing any previous file
+ResumeResult<util::Empty> save_resume(const std::string& filepath,
+                                      const ResumeData& data);
+
+/// Reads resume data saved with `save_resume`
+ResumeResult<ResumeData> load_resume(const std::string& filepath);
+
+/// Checks that resume data can be trusted for a torrent without rehashing:
+/// it belongs to the same torrent and no file has changed since it was saved
+/// @param stamps current stamps of the torrent files
+bool resume_matches(const ResumeData& data, const TorrentFile& torrent,
+                    const std::vector<FileStamp>& stamps);
+
+}  // namespace fur::disk
@@ -0,0 +1,312 @@
+#include <algorithm>
+#include <cstring>
+#include <disk/write_behind.hpp>
+#include <log/logger.hpp>
+#include <platform/io.hpp>
+
+namespace fur::disk {
+
+using namespace fur::platform;  // For IO operations
+
+/// Size of the buffers used to stage unaligned data for direct I/O
+const size_t DIRECT_IO_STAGING_SIZE = 4 * 1024 * 1024;
+
+/// Chunks covering `len` bytes of `chunks`, beginning at byte `from`
+static std::vector<io::Chunk> slice(const std::vector<io::Chunk>& chunks,
+                                    size_t from, size_t len) {
+  std::vector<io::Chunk> result;
+  for (const auto& chunk : chunks) {
+    if (len == 0) break;
+    if (from >= chunk.len) {
+      from -= chunk.len;
+      continue;
+    }
+    size_t taken = std::min(chunk.len - from, len);
+    result.push_back({chunk.data + from, taken});
+    len -= taken;
+    from = 0;
+  }
+  return result;
+}
+
+/// Copy `len` bytes of `chunks`, beginning at byte `from`, to `dest`
+static void gather(const std::vector<io::Chunk>& chunks, size_t from,
+                   size_t len, uint8_t* dest) {
+  for (const auto& chunk : slice(chunks, from, len)) {
+    std::memcpy(dest, chunk.data, chunk.len);
+    dest += chunk.len;
+  }
+}
+
+WriteBehind::WriteBehind(size_t memory_budget,
+                         std::chrono::milliseconds max_delay,
+                         WrittenFn on_written, bool direct_io)
+    : _memory_budget{memory_budget},
+      _max_delay{max_delay},
+      _on_written{std::move(on_written)},
+      _direct_io{direct_io},
+      _pending_bytes{0},
+      _pieces_written{0},
+      _writes_issued{0},
+      _direct_bytes{0},
+      _stop{false} {
+  // A single writer thread needs a single staging buffer
+  if (_direct_io) _staging.put(AlignedBuffer(DIRECT_IO_STAGING_SIZE));
+
+  _writer = std::thread(&WriteBehind::thread_main, this);
+}
+
+WriteBehind::~WriteBehind() {
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _work_available.notify_one();
+  _writer.join();
+}
+
+void WriteBehind::push(TorrentID tid, const std::string& folder,
+                       std::shared_ptr<const PieceLayout> layout, size_t index,
+                       download::piece_pool::PieceBuffer content) {
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    // The writer is lagging behind, wait for it to free some memory
+    _work_done.wait(lock, [this] { return _pending_bytes < _memory_budget; });
+
+    auto& pending = _torrents[tid];
+    pending.folder = folder;
+    pending.layout = std::move(layout);
+
+    // A piece downloaded twice replaces the previous copy
+    auto previous = pending.pieces.find(index);
+    if (previous != pending.pieces.end())
+      _pending_bytes -= previous->second.content.size();
+
+    _pending_bytes += content.size();
+    pending.pieces.insert_or_assign(
+        index, Pending{index, std::move(content),
+                       std::chrono::steady_clock::now()});
+  }
+  _work_available.notify_one();
+}
+
+void WriteBehind::flush(TorrentID tid) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  if (_torrents.find(tid) == _torrents.end()) return;
+
+  _flushing.insert(tid);
+  _work_available.notify_one();
+
+  _work_done.wait(lock, [&] { return _torrents.count(tid) == 0; });
+  _flushing.erase(tid);
+}
+
+WriteBehindStats WriteBehind::stats() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return {_pieces_written, _writes_issued, _pending_bytes, _direct_bytes};
+}
+
+void WriteBehind::thread_main() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (true) {
+    auto runs = take_runs(std::chrono::steady_clock::now());
+    if (runs.empty()) {
+      // Nothing left in memory, we can safely stop
+      if (_stop) break;
+
+      if (_torrents.empty())
+        _work_available.wait(lock);
+      else
+        _work_available.wait_until(lock, next_deadline());
+      continue;
+    }
+
+    // Write without blocking producers
+    lock.unlock();
+    std::vector<std::optional<size_t>> writes(runs.size());
+    for (size_t i = 0; i < runs.size(); i++) {
+      writes[i] = write_run(runs[i]);
+      for (const auto& pending : runs[i].pieces)
+        _on_written(runs[i].tid, pending.index, writes[i].has_value());
+    }
+    lock.lock();
+
+    for (size_t i = 0; i < runs.size(); i++) {
+      auto& torrent = _torrents[runs[i].tid];
+      torrent.in_flight -= runs[i].pieces.size();
+      if (torrent.in_flight == 0 && torrent.pieces.empty())
+        _torrents.erase(runs[i].tid);
+
+      for (const auto& pending : runs[i].pieces)
+        _pending_bytes -= pending.content.size();
+      _pieces_written += runs[i].pieces.size();
+      _writes_issued += writes[i].value_or(0);
+    }
+    _work_done.notify_all();
+  }
+}
+
+auto WriteBehind::take_runs(std::chrono::steady_clock::time_point now)
+    -> std::vector<Run> {
+  std::vector<Run> runs;
+
+  // When out of memory everything is written, coalescing whatever is
+  // available at the moment
+  const bool over_budget = _pending_bytes >= _memory_budget;
+
+  for (auto& [tid, torrent] : _torrents) {
+    const bool flush_all = _stop || over_budget || _flushing.count(tid) > 0;
+
+    auto it = torrent.pieces.begin();
+    while (it != torrent.pieces.end()) {
+      // Find the end of the run of adjacent pieces beginning at `it`, a run
+      // is written as soon as one of its pieces has waited long enough
+      bool expired = false;
+      size_t next_index = it->first;
+      auto run_end = it;
+      while (run_end != torrent.pieces.end() && run_end->first == next_index) {
+        expired = expired || now - run_end->second.queued_at >= _max_delay;
+        next_index += 1;
+        ++run_end;
+      }
+
+      if (!flush_all && !expired) {
+        it = run_end;
+        continue;
+      }
+
+      Run run{tid, torrent.folder, torrent.layout, {}};
+      for (auto piece = it; piece != run_end; ++piece)
+        run.pieces.push_back(std::move(piece->second));
+      torrent.in_flight += run.pieces.size();
+      runs.push_back(std::move(run));
+
+      it = torrent.pieces.erase(it, run_end);
+    }
+  }
+
+  return runs;
+}
+
+auto WriteBehind::next_deadline() const
+    -> std::chrono::steady_clock::time_point {
+  auto deadline = std::chrono::steady_clock::time_point::max();
+  for (const auto& [tid, torrent] : _torrents)
+    for (const auto& [index, pending] : torrent.pieces)
+      deadline = std::min(deadline, pending.queued_at + _max_delay);
+  return deadline;
+}
+
+std::optional<size_t> WriteBehind::write_run(const Run& run) {
+  // Adjacent pieces are consecutive in the torrent byte stream, so subpieces
+  // mapped on the same file can be merged into a single extent
+  std::vector<Extent> extents;
+  for (const auto& pending : run.pieces) {
+    const Piece piece = run.layout->piece(pending.index);
+    size_t piece_offset = 0;
+    for (const auto& subpiece : piece.subpieces) {
+      if (piece_offset >= pending.content.size()) break;
+
+      size_t len =
+          std::min(subpiece.len, pending.content.size() - piece_offset);
+      io::Chunk chunk{pending.content.data() + piece_offset, len};
+      piece_offset += len;
+
+      if (!extents.empty()) {
+        auto& last = extents.back();
+        if (last.file == subpiece.file &&
+            last.file_offset + last.len == subpiece.file_offset) {
+          last.chunks.push_back(chunk);
+          last.len += len;
+          continue;
+        }
+      }
+      extents.push_back(
+          Extent{subpiece.file, subpiece.file_offset, len, {chunk}});
+    }
+  }
+
+  for (const auto& extent : extents) {
+    const std::string filepath =
+        run.folder + '/' + run.layout->path(extent.file);
+    bool written =
+        _direct_io
+            ? write_extent_direct(filepath, extent)
+            : io::write_chunks(filepath, extent.chunks, extent.file_offset)
+                  .valid();
+    if (!written) return std::nullopt;
+  }
+  return extents.size();
+}
+
+bool WriteBehind::write_extent_direct(const std::string& filepath,
+                                      const Extent& extent) {
+  const size_t ALIGNMENT = io::DIRECT_IO_ALIGNMENT;
+
+  // Only whole aligned blocks can be written directly, the head and tail of
+  // the extent that partially cover a block go through the page cache. This
+  // happens at the boundaries of files in multi-file torrents
+  const size_t begin = extent.file_offset;
+  const size_t end = begin + extent.len;
+  const size_t body_begin = (begin + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  const size_t body_end = end / ALIGNMENT * ALIGNMENT;
+  if (body_begin >= body_end)
+    return io::write_chunks(filepath, extent.chunks, begin).valid();
+
+  const size_t head_len = body_begin - begin;
+  const size_t body_len = body_end - body_begin;
+  const size_t tail_len = end - body_end;
+
+  if (head_len > 0 &&
+      !io::write_chunks(filepath, slice(extent.chunks, 0, head_len), begin)
+           .valid())
+    return false;
+  if (tail_len > 0 &&
+      !io::write_chunks(filepath,
+                        slice(extent.chunks, body_end - begin, tail_len),
+                        body_end)
+           .valid())
+    return false;
+
+  auto body = slice(extent.chunks, head_len, body_len);
+  bool aligned = std::all_of(body.begin(), body.end(), [&](const auto& chunk) {
+    return reinterpret_cast<uintptr_t>(chunk.data) % ALIGNMENT == 0 &&
+           chunk.len % ALIGNMENT == 0;
+  });
+
+  bool written = true;
+  bool unsupported = false;
+  if (aligned) {
+    // Pieces memory can be handed to the kernel as it is
+    auto writing = io::write_chunks_direct(filepath, body, body_begin);
+    written = writing.valid();
+    unsupported =
+        !written && writing.error() == io::IOError::DirectIOUnsupported;
+  } else {
+    // Copy through an aligned buffer, one large write at a time
+    auto staging = _staging.get();
+    for (size_t pos = 0; pos < body_len && written; pos += staging->size()) {
+      size_t len = std::min(staging->size(), body_len - pos);
+      gather(body, pos, len, staging->data());
+
+      auto writing = io::write_chunks_direct(
+          filepath, {io::Chunk{staging->data(), len}}, body_begin + pos);
+      written = writing.valid();
+      unsupported =
+          !written && writing.error() == io::IOError::DirectIOUnsupported;
+    }
+  }
+
+  // Not all filesystems support direct I/O, in that case fall back to the
+  // page cache
+  if (unsupported) {
+    auto logger = spdlog::get("custom");
+    logger->warn("Direct I/O is not supported for {}", filepath);
+    return io::write_chunks(filepath, body, body_begin).valid();
+  }
+  if (written) _direct_bytes += body_len;
+  return written;
+}
+
+}  // namespace fur::disk
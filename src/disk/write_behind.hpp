@@ -0,0 +1,179 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <disk/aligned_buffer.hpp>
+#include <download/lender_pool.hpp>
+#include <download/piece_pool.hpp>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <platform/io.hpp>
+#include <string>
+#include <thread>
+#include <torrent.hpp>
+#include <types.hpp>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace fur::disk {
+
+/// Called once a piece has been written to disk, or failed to
+using WrittenFn =
+    std::function<void(TorrentID tid, size_t index, bool success)>;
+
+/// Statistics about the writes performed by a `WriteBehind`
+struct WriteBehindStats {
+  /// Number of pieces written to disk
+  size_t pieces_written;
+  /// Number of write operations issued to the filesystem
+  size_t writes_issued;
+  /// Bytes currently held in memory
+  size_t pending_bytes;
+  /// Bytes written bypassing the page cache
+  size_t direct_bytes;
+};
+
+/// Holds completed and verified pieces in memory for a short time, so that
+/// runs of adjacent pieces can be merged into a few large sequential writes
+/// instead of many scattered ones. A piece is written once it has waited
+/// longer than the maximum delay or when the memory budget is exceeded.
+/// All writes happen on a dedicated thread, optionally bypassing the page
+/// cache with direct I/O. Piece buffers are page aligned, so whole blocks
+/// are written directly from them without copies.
+class WriteBehind {
+  /// A piece waiting to be written
+  struct Pending {
+    /// Global index of the piece
+    size_t index;
+    /// Verified piece content
+    download::piece_pool::PieceBuffer content;
+    /// When the piece has been received
+    std::chrono::steady_clock::time_point queued_at;
+  };
+
+  /// All pieces waiting to be written for a single torrent
+  struct TorrentPending {
+    /// Folder containing all torrent files
+    std::string folder;
+    /// Mapping of the pieces on the torrent files
+    std::shared_ptr<const PieceLayout> layout;
+    /// Pieces ordered by index, so that adjacent pieces are neighbours
+    std::map<size_t, Pending> pieces;
+    /// Number of pieces taken by the writer thread and not yet written
+    size_t in_flight = 0;
+  };
+
+  /// A sequence of adjacent pieces taken from a torrent
+  struct Run {
+    TorrentID tid;
+    std::string folder;
+    std::shared_ptr<const PieceLayout> layout;
+    std::vector<Pending> pieces;
+  };
+
+  /// Consecutive bytes of a single file, possibly coming from many pieces
+  struct Extent {
+    uint32_t file;
+    size_t file_offset;
+    size_t len;
+    std::vector<platform::io::Chunk> chunks;
+  };
+
+  /// Maximum number of bytes held in memory
+  const size_t _memory_budget;
+  /// Maximum time a piece waits for its neighbours
+  const std::chrono::steady_clock::duration _max_delay;
+  /// Notified for every piece written or failed
+  WrittenFn _on_written;
+  /// True if whole blocks are written bypassing the page cache
+  const bool _direct_io;
+  /// Aligned buffers used to stage data for direct I/O when the pieces memory
+  /// is not aligned
+  download::lender_pool::LenderPool<AlignedBuffer> _staging;
+
+  /// Protects all the state below
+  mutable std::mutex _mutex;
+  /// Signals the writer thread that there is work to do
+  std::condition_variable _work_available;
+  /// Signals waiting producers that some pieces have been written
+  std::condition_variable _work_done;
+
+  /// Pending pieces of each torrent
+  std::unordered_map<TorrentID, TorrentPending> _torrents;
+  /// Torrents that must be written entirely as soon as possible
+  std::unordered_set<TorrentID> _flushing;
+  /// Bytes held in memory, including pieces being written
+  size_t _pending_bytes;
+  /// Total number of pieces written
+  size_t _pieces_written;
+  /// Total number of write operations issued
+  size_t _writes_issued;
+  /// Total number of bytes written with direct I/O, updated by the writer
+  /// thread while writing
+  std::atomic_size_t _direct_bytes;
+  /// True if the writer thread should write everything and stop
+  bool _stop;
+
+  std::thread _writer;
+
+ public:
+  /// @param memory_budget maximum number of bytes held in memory
+  /// @param max_delay maximum time a piece waits for its neighbours
+  /// @param on_written called by the writer thread for every piece processed,
+  /// before `flush` returns. Must not call `flush` itself
+  /// @param direct_io true to write with O_DIRECT, if the filesystem allows it
+  WriteBehind(size_t memory_budget, std::chrono::milliseconds max_delay,
+              WrittenFn on_written, bool direct_io = false);
+
+  /// Writes all pending pieces and stops the writer thread
+  ~WriteBehind();
+
+  WriteBehind(const WriteBehind&) = delete;
+  WriteBehind& operator=(const WriteBehind&) = delete;
+
+  /// Queue a verified piece for writing. Blocks if the memory budget is
+  /// exhausted until enough pieces have been written
+  /// @param tid torrent owning the piece
+  /// @param folder folder containing all torrent files
+  /// @param layout mapping of the pieces on the torrent files
+  /// @param index global index of the piece
+  /// @param content verified piece content, returned to its pool once written
+  void push(TorrentID tid, const std::string& folder,
+            std::shared_ptr<const PieceLayout> layout, size_t index,
+            download::piece_pool::PieceBuffer content);
+
+  /// Write all pending pieces of a torrent, blocks until done
+  void flush(TorrentID tid);
+
+  /// @return statistics about the writes performed so far
+  [[nodiscard]] WriteBehindStats stats() const;
+
+ private:
+  /// Main function of the writer thread
+  void thread_main();
+
+  /// Take from the pending pieces all the runs that must be written now,
+  /// must be called with the mutex locked
+  std::vector<Run> take_runs(std::chrono::steady_clock::time_point now);
+
+  /// Earliest time a pending piece expires, must be called with the mutex
+  /// locked
+  [[nodiscard]] std::chrono::steady_clock::time_point next_deadline() const;
+
+  /// Write a run of adjacent pieces with as few operations as possible
+  /// @return number of write operations issued, nothing on failure
+  std::optional<size_t> write_run(const Run& run);
+
+  /// Write an extent with direct I/O, the unaligned head and tail go through
+  /// the page cache
+  /// @return true on success
+  bool write_extent_direct(const std::string& filepath, const Extent& extent);
+};
+
+}  // namespace fur::disk
@@ -1,5 +1,6 @@
 #include "download/bitfield.hpp"
 
+#include <cstring>
 #include <stdexcept>
 
 /// What byte contains the bit at `bit_index`?
@@ -19,9 +20,53 @@ void assert_within_bounds(uint32_t len, uint32_t index) {
 
 const uint8_t INDEX_ZERO = 0 | (1 << 7);
 
+/// Throws an exception if two bitfields have different lengths
+void assert_same_length(uint32_t len, uint32_t other_len) {
+  if (len != other_len) {
+    throw std::invalid_argument("bitfields have different lengths");
+  }
+}
+
+/// Load 8 bytes as a single word. The first bit of the bitfield becomes the
+/// most significant bit of the word, whatever the byte order of the CPU.
+static uint64_t load_word(const uint8_t* bytes) {
+  uint64_t word;
+  std::memcpy(&word, bytes, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  word = __builtin_bswap64(word);
+#endif
+  return word;
+}
+
+/// Combine `src` into `dst` with `op`, a whole word at a time. The order of
+/// the bytes doesn't matter to bitwise operations.
+template <typename Op>
+static void combine(std::vector<uint8_t>& dst,
+                    const std::vector<uint8_t>& src, Op op) {
+  const size_t size = dst.size();
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t a, b;
+    std::memcpy(&a, dst.data() + i, sizeof(a));
+    std::memcpy(&b, src.data() + i, sizeof(b));
+    a = op(a, b);
+    std::memcpy(dst.data() + i, &a, sizeof(a));
+  }
+  for (; i < size; i++)
+    dst[i] = static_cast<uint8_t>(op(uint64_t{dst[i]}, uint64_t{src[i]}));
+}
+
 namespace fur::download::bitfield {
 Bitfield::Bitfield(uint32_t len) : len{len} { storage.resize((len + 7) / 8); }
 
+Bitfield::Bitfield(std::vector<uint8_t> storage, uint32_t len)
+    : len{len}, storage{std::move(storage)} {
+  // Word operations rely on bits past the length being zero
+  this->storage.resize((len + 7) / 8);
+  if (len % 8 != 0)
+    this->storage.back() &= static_cast<uint8_t>(0xFF << (8 - len % 8));
+}
+
 void Bitfield::set(uint32_t index, bool value) {
   assert_within_bounds(len, index);
 
@@ -42,6 +87,62 @@ bool Bitfield::get(uint32_t index) const {
   return storage[_byte_index] & (INDEX_ZERO >> byte_offset(index));
 }
 
+Bitfield& Bitfield::operator&=(const Bitfield& other) {
+  assert_same_length(len, other.len);
+  combine(storage, other.storage, [](uint64_t a, uint64_t b) { return a & b; });
+  return *this;
+}
+
+Bitfield& Bitfield::operator|=(const Bitfield& other) {
+  assert_same_length(len, other.len);
+  combine(storage, other.storage, [](uint64_t a, uint64_t b) { return a | b; });
+  return *this;
+}
+
+Bitfield& Bitfield::and_not(const Bitfield& other) {
+  assert_same_length(len, other.len);
+  combine(storage, other.storage,
+          [](uint64_t a, uint64_t b) { return a & ~b; });
+  return *this;
+}
+
+uint32_t Bitfield::count() const {
+  const size_t size = storage.size();
+  uint32_t result = 0;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, storage.data() + i, sizeof(word));
+    result += static_cast<uint32_t>(__builtin_popcountll(word));
+  }
+  for (; i < size; i++)
+    result += static_cast<uint32_t>(__builtin_popcount(storage[i]));
+  return result;
+}
+
+uint32_t Bitfield::find_next(uint32_t from) const {
+  if (from >= len) return len;
+
+  // The byte holding `from`, without the bits before it
+  size_t i = byte_index(from);
+  const uint8_t first = storage[i] & (0xFF >> byte_offset(from));
+  if (first != 0)
+    return static_cast<uint32_t>(i * 8 + __builtin_clz(first) - 24);
+  i += 1;
+
+  // Bits past the length are zero, so whatever is found is within bounds
+  const size_t size = storage.size();
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word = load_word(storage.data() + i);
+    if (word != 0) return static_cast<uint32_t>(i * 8 + __builtin_clzll(word));
+  }
+  for (; i < size; i++) {
+    if (storage[i] != 0)
+      return static_cast<uint32_t>(i * 8 + __builtin_clz(storage[i]) - 24);
+  }
+  return len;
+}
+
 std::ostream& operator<<(std::ostream& os, const Bitfield& bf) {
   const char BIT_0 = '.';
   const char BIT_1 = '#';
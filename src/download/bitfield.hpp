@@ -12,6 +12,11 @@ namespace fur::download::bitfield {
 /// while a 0-bit is a piece that the peer doesn't have.
 /// \attention A `Bitfield` cannot be resized once created.
 ///
+/// Bits are stored in the same order as the wire format of `BitfieldMessage`:
+/// the first bit is the most significant bit of the first byte. Set algebra,
+/// counting and searching work on whole 64 bits words at a time, so that
+/// they stay fast on torrents with hundreds of thousands of pieces.
+///
 /// Note that we could've used a type from the standard library instead but they
 /// had a couple of disadvantages:
 ///   - `bitset` only works with a number of bits known at compile time but we
@@ -28,9 +33,9 @@ class Bitfield {
 
   /// Create a new `Bitfield` from an existing backing storage. The length
   /// in bits must be provided because the last byte is not necessarily
-  /// used till the last bit.
-  Bitfield(std::vector<uint8_t> storage, uint32_t len)
-      : len{len}, storage{std::move(storage)} {}
+  /// used till the last bit. Missing bytes are taken as zeros, and bits past
+  /// the length are cleared.
+  Bitfield(std::vector<uint8_t> storage, uint32_t len);
 
   /// Set the bit to the provided index to either 1 or 0, depending on `value`.
   void set(uint32_t index, bool value);
@@ -43,6 +48,29 @@ class Bitfield {
   /// Get the value of the bit at the provided index.
   [[nodiscard]] bool get(uint32_t index) const;
 
+  /// Keep only the bits that are also set in `other`, which must have the
+  /// same length.
+  Bitfield& operator&=(const Bitfield& other);
+  /// Set the bits that are set in `other`, which must have the same length.
+  Bitfield& operator|=(const Bitfield& other);
+  /// Clear the bits that are set in `other`, which must have the same length.
+  Bitfield& and_not(const Bitfield& other);
+
+  /// Number of bits set to 1.
+  [[nodiscard]] uint32_t count() const;
+
+  /// Index of the first bit set to 1 at or after `from`, `len` if there is
+  /// none.
+  [[nodiscard]] uint32_t find_next(uint32_t from) const;
+  /// Index of the first bit set to 1, `len` if there is none.
+  [[nodiscard]] uint32_t find_first() const { return find_next(0); }
+
+  /// Call `fn(index)` for each bit set to 1, in increasing order.
+  template <typename Fn>
+  void for_each_set(Fn&& fn) const {
+    for (uint32_t i = find_first(); i < len; i = find_next(i + 1)) fn(i);
+  }
+
   /// Get the bitfield as an array of bytes.
   [[nodiscard]] std::vector<uint8_t> get_bytes() const {
     // Basically just return a copy of `storage`.
@@ -0,0 +1,341 @@
+#include "download/connection_manager.hpp"
+
+#include <utility>
+
+#include "log/logger.hpp"
+
+namespace fur::download::connection_manager {
+
+/// Peers of a torrent picked while already connected before giving up on it,
+/// the best peers being the most likely to be picked again
+const size_t FILL_MAX_MISSES = 8;
+
+/// Time between two attempts to connect to more peers, for those that could
+/// not be picked before
+const auto TICK_INTERVAL = std::chrono::seconds(1);
+
+ConnectionManager::ConnectionManager(Limits limits,
+                                     piece_pool::PiecePool& pool, PickFn pick,
+                                     FailedFn on_failed)
+    : _limits{limits},
+      _pool{pool},
+      _pick{std::move(pick)},
+      _on_failed{std::move(on_failed)},
+      _half_open{0},
+      _total{0},
+      _work{asio::make_work_guard(_ctx)},
+      _tick{_ctx} {
+  schedule_tick();
+  _runner = std::thread([this] { _ctx.run(); });
+}
+
+ConnectionManager::~ConnectionManager() {
+  // Attempts in flight are abandoned, their sockets closed along with `_ctx`
+  _work.reset();
+  _ctx.stop();
+  _runner.join();
+}
+
+void ConnectionManager::add_torrent(
+    TorrentID tid, std::shared_ptr<const TorrentFile> descriptor) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _torrents[tid].descriptor = std::move(descriptor);
+  }
+  fill();
+}
+
+void ConnectionManager::remove_torrent(TorrentID tid) {
+  // Closed once the lock is released
+  std::vector<Connection> closing;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _torrents.find(tid);
+    if (it == _torrents.end()) return;
+
+    // Attempts in flight, connections parked and connections lent keep their
+    // slot until they end
+    closing = std::move(it->second.ready);
+    _total -= closing.size();
+    _torrents.erase(it);
+  }
+
+  // Threads waiting for a connection of the torrent give up
+  _ready.notify_all();
+  fill();
+}
+
+std::optional<Connection> ConnectionManager::acquire(
+    TorrentID tid, size_t piece, std::chrono::steady_clock::duration wait) {
+  fill();
+
+  std::optional<Connection> result;
+  std::unique_lock<std::mutex> lock(_mutex);
+  _ready.wait_for(lock, wait, [&] {
+    auto it = _torrents.find(tid);
+    if (it == _torrents.end()) return true;
+
+    // A connection holding part of the piece resumes it, otherwise the
+    // connections used last come first, they are most likely unchoked
+    auto& ready = it->second.ready;
+    size_t chosen = ready.size();
+    for (size_t i = ready.size(); i-- > 0;) {
+      const downloader::Downloader& downloader = *ready[i].downloader;
+      if (downloader.resumes(piece)) {
+        chosen = i;
+        break;
+      }
+      if (chosen == ready.size() && downloader.may_have(piece)) chosen = i;
+    }
+    if (chosen == ready.size()) return false;
+
+    if (chosen + 1 < ready.size()) std::swap(ready[chosen], ready.back());
+    result = std::move(ready.back());
+    ready.pop_back();
+    return true;
+  });
+  return result;
+}
+
+void ConnectionManager::release(Connection connection) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _torrents.find(connection.tid);
+    if (it != _torrents.end() && connection.downloader->connected()) {
+      it->second.ready.push_back(std::move(connection));
+      _ready.notify_all();
+      return;
+    }
+
+    if (it != _torrents.end()) it->second.peers.erase(connection.index);
+    _total -= 1;
+  }
+
+  // Another peer can take the slot of a connection closed
+  fill();
+}
+
+void ConnectionManager::discard(Connection connection) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _torrents.find(connection.tid);
+    if (it != _torrents.end()) it->second.peers.erase(connection.index);
+    _total -= 1;
+  }
+  connection.downloader.reset();
+  fill();
+}
+
+void ConnectionManager::park(Connection connection) {
+  // The socket moves to `_ctx`, so that the connecting thread waits for the
+  // peer instead of a worker
+  auto handle = connection.downloader->detach_socket().release();
+  auto parked = std::make_shared<Parked>(Parked{
+      std::move(connection), asio::ip::tcp::socket{_ctx},
+      asio::steady_timer{_ctx}});
+  parked->socket.assign(asio::ip::tcp::v4(), handle);
+
+  // The waits are started by the connecting thread, which runs their
+  // handlers, so that the socket and the timer are only used by one thread
+  asio::post(_ctx, [this, parked] {
+    // Cancelling the wait closes the connection once the timeout expires
+    parked->timer.expires_after(_limits.unchoke_timeout);
+    parked->timer.async_wait([parked](const std::error_code& ec) {
+      if (ec) return;
+      std::error_code ignored;
+      parked->socket.cancel(ignored);
+    });
+
+    parked->socket.async_wait(
+        asio::ip::tcp::socket::wait_read,
+        [this, parked](const std::error_code& ec) { unparked(parked, ec); });
+  });
+}
+
+size_t ConnectionManager::connections() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _total;
+}
+
+void ConnectionManager::fill() {
+  // Misses of each torrent in this round, no more peers are picked for a
+  // torrent after too many
+  std::unordered_map<TorrentID, size_t> misses;
+
+  while (true) {
+    TorrentID tid;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (_half_open >= _limits.half_open || _total >= _limits.total) return;
+
+      // The torrent with the fewest connections goes first
+      auto chosen = _torrents.end();
+      size_t fewest = _limits.per_torrent;
+      for (auto it = _torrents.begin(); it != _torrents.end(); ++it) {
+        const size_t count = it->second.peers.size() + it->second.reserved;
+        if (count >= fewest || misses[it->first] >= FILL_MAX_MISSES) continue;
+        chosen = it;
+        fewest = count;
+      }
+      if (chosen == _torrents.end()) return;
+
+      // Reserve the slot while the peer is picked without the lock, since
+      // picking may take the locks of the owner
+      tid = chosen->first;
+      chosen->second.reserved += 1;
+      _half_open += 1;
+      _total += 1;
+    }
+
+    std::optional<Candidate> candidate = _pick(tid);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _torrents.find(tid);
+    if (it != _torrents.end()) it->second.reserved -= 1;
+
+    // No peer can be picked for now, or it is connected already
+    if (it == _torrents.end() || !candidate.has_value() ||
+        !it->second.peers.insert(candidate->index).second) {
+      _half_open -= 1;
+      _total -= 1;
+      misses[tid] = candidate.has_value() ? misses[tid] + 1 : FILL_MAX_MISSES;
+      continue;
+    }
+
+    asio::post(_ctx, [this, tid, candidate = *candidate] {
+      connect(tid, candidate);
+    });
+  }
+}
+
+void ConnectionManager::connect(TorrentID tid, Candidate candidate) {
+  auto attempt = std::make_shared<Attempt>(
+      Attempt{tid, candidate, asio::ip::tcp::socket{_ctx},
+              asio::steady_timer{_ctx}});
+
+  // Closing the socket aborts the attempt once the timeout expires
+  attempt->timer.expires_after(_limits.connect_timeout);
+  attempt->timer.async_wait([attempt](const std::error_code& ec) {
+    if (ec) return;
+    std::error_code ignored;
+    attempt->socket.close(ignored);
+  });
+
+  asio::ip::tcp::endpoint endpoint{asio::ip::address_v4{candidate.peer.ip},
+                                   asio::ip::port_type{candidate.peer.port}};
+  attempt->socket.async_connect(
+      endpoint,
+      [this, attempt](const std::error_code& ec) { connected(attempt, ec); });
+}
+
+void ConnectionManager::connected(const std::shared_ptr<Attempt>& attempt,
+                                  const std::error_code& ec) {
+  attempt->timer.cancel();
+  const size_t index = attempt->candidate.index;
+
+  bool failed = false;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _half_open -= 1;
+
+    // The socket moves to the `Downloader`, which has its own context
+    std::error_code release_ec;
+    auto it = _torrents.find(attempt->tid);
+    asio::ip::tcp::socket::native_handle_type handle{};
+    if (!ec && it != _torrents.end())
+      handle = attempt->socket.release(release_ec);
+
+    if (ec || release_ec || it == _torrents.end()) {
+      // Attempts of removed torrents are not failures of their peers
+      failed = it != _torrents.end();
+      if (failed) it->second.peers.erase(index);
+      _total -= 1;
+    } else {
+      auto& torrent = it->second;
+      torrent.ready.push_back(Connection{
+          attempt->tid, index, torrent.descriptor,
+          std::make_unique<downloader::Downloader>(
+              *torrent.descriptor, attempt->candidate.peer, _pool,
+              socket::Socket(handle))});
+    }
+  }
+
+  if (failed) {
+    auto logger = spdlog::get("custom");
+    logger->debug("Unable to connect to {}: {}",
+                  attempt->candidate.peer.address(), ec.message());
+    _on_failed(attempt->tid, index);
+  } else {
+    _ready.notify_all();
+  }
+  fill();
+}
+
+void ConnectionManager::unparked(const std::shared_ptr<Parked>& parked,
+                                 const std::error_code& ec) {
+  parked->timer.cancel();
+  Connection& connection = parked->connection;
+  const TorrentID tid = connection.tid;
+  const size_t index = connection.index;
+
+  // A peer closing the connection also makes it readable, with nothing to
+  // read. Peeking tells it apart without consuming what arrived
+  std::error_code closed_ec;
+  if (!ec) {
+    uint8_t byte = 0;
+    parked->socket.non_blocking(true, closed_ec);
+    if (!closed_ec)
+      parked->socket.receive(asio::buffer(&byte, 1),
+                             asio::socket_base::message_peek, closed_ec);
+    if (closed_ec == asio::error::would_block) closed_ec.clear();
+    if (!closed_ec) parked->socket.non_blocking(false, closed_ec);
+  }
+
+  bool expired = false;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    // The socket moves back to the `Downloader`, which reads what arrived
+    std::error_code release_ec;
+    auto it = _torrents.find(tid);
+    asio::ip::tcp::socket::native_handle_type handle{};
+    if (!ec && !closed_ec && it != _torrents.end())
+      handle = parked->socket.release(release_ec);
+
+    if (ec || closed_ec || release_ec || it == _torrents.end()) {
+      // Connections of removed torrents are not failures of their peers
+      expired = it != _torrents.end();
+      if (expired) it->second.peers.erase(index);
+      _total -= 1;
+    } else {
+      connection.downloader->attach_socket(socket::Socket(handle));
+      it->second.ready.push_back(std::move(connection));
+    }
+  }
+
+  if (expired) {
+    auto logger = spdlog::get("custom");
+    if (closed_ec)
+      logger->debug("{} closed the connection while choking us: {}",
+                    connection.downloader->remote().address(),
+                    closed_ec.message());
+    else
+      logger->debug("{} kept us choked for too long",
+                    connection.downloader->remote().address());
+    _on_failed(tid, index);
+  } else {
+    _ready.notify_all();
+  }
+  fill();
+}
+
+void ConnectionManager::schedule_tick() {
+  _tick.expires_after(TICK_INTERVAL);
+  _tick.async_wait([this](const std::error_code& ec) {
+    if (ec) return;
+    fill();
+    schedule_tick();
+  });
+}
+
+}  // namespace fur::download::connection_manager
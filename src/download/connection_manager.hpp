@@ -0,0 +1,202 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "asio.hpp"
+#include "download/downloader.hpp"
+#include "download/piece_pool.hpp"
+#include "peer.hpp"
+#include "torrent.hpp"
+#include "types.hpp"
+
+namespace fur::download::connection_manager {
+
+/// A peer worth connecting to
+struct Candidate {
+  /// Index of the peer in its torrent
+  size_t index;
+  peer::Peer peer;
+};
+
+/// Called to choose the next peer of a torrent to connect to, nothing if no
+/// peer should be tried right now. Peers already connected may be returned,
+/// they are skipped
+using PickFn = std::function<std::optional<Candidate>(TorrentID tid)>;
+
+/// Called for every connection attempt that failed, and for every connection
+/// closed because its peer kept us choked for too long or hung up meanwhile
+using FailedFn = std::function<void(TorrentID tid, size_t index)>;
+
+/// Maximum number of connections, counting those being attempted
+struct Limits {
+  /// Connection attempts in flight at once, across all torrents
+  size_t half_open;
+  /// Connections across all torrents
+  size_t total;
+  /// Connections to the peers of a single torrent
+  size_t per_torrent;
+  /// Time after which a connection attempt is given up
+  std::chrono::steady_clock::duration connect_timeout;
+  /// Time a parked connection waits for its peer to unchoke us before it is
+  /// closed
+  std::chrono::steady_clock::duration unchoke_timeout;
+};
+
+/// A connection to a peer of a torrent, lent to a single thread at a time
+struct Connection {
+  TorrentID tid;
+  /// Index of the peer in its torrent
+  size_t index;
+  /// Keeps alive the descriptor referenced by `downloader`
+  std::shared_ptr<const TorrentFile> descriptor;
+  /// Downloads pieces over the connection, the handshake is done on first use
+  std::unique_ptr<downloader::Downloader> downloader;
+};
+
+/// Opens connections to the peers of many torrents ahead of time, so that no
+/// download waits for a connection to be established. Up to a number of
+/// asynchronous connection attempts are kept in flight on a dedicated
+/// thread, each to a peer chosen by the owner. Established connections are
+/// put in a pool of ready connections of their torrent, failed ones are
+/// reported and dropped. Connections are taken from the pool for a download
+/// and given back afterwards, so that they are reused for many pieces.
+/// Connections whose peer chokes us are parked on the connecting thread until
+/// the peer sends something, so that no thread waits to be unchoked.
+/// The number of connections is limited across all torrents and for each of
+/// them
+class ConnectionManager {
+  /// Connections of a single torrent
+  struct TorrentConnections {
+    /// Descriptor of the torrent, shared by all its connections
+    std::shared_ptr<const TorrentFile> descriptor;
+    /// Connections established and not lent
+    std::vector<Connection> ready;
+    /// Peers with a connection, either attempted, ready or lent
+    std::unordered_set<size_t> peers;
+    /// Slots reserved for attempts whose peer is being chosen
+    size_t reserved = 0;
+  };
+
+  /// A connection attempt in flight
+  struct Attempt {
+    TorrentID tid;
+    Candidate candidate;
+    asio::ip::tcp::socket socket;
+    asio::steady_timer timer;
+  };
+
+  /// A connection waiting for its peer to unchoke us
+  struct Parked {
+    Connection connection;
+    /// The socket of the connection, taken from its downloader meanwhile
+    asio::ip::tcp::socket socket;
+    asio::steady_timer timer;
+  };
+
+  const Limits _limits;
+  /// Memory of the pieces downloaded over the connections
+  piece_pool::PiecePool& _pool;
+  /// Chooses the peers to connect to
+  PickFn _pick;
+  /// Notified of the failed attempts
+  FailedFn _on_failed;
+
+  /// Protects all the state below
+  mutable std::mutex _mutex;
+  /// Signals that some connection has become ready
+  std::condition_variable _ready;
+  /// Connections of each torrent
+  std::unordered_map<TorrentID, TorrentConnections> _torrents;
+  /// Connection attempts in flight, including reserved slots
+  size_t _half_open;
+  /// Connections across all torrents, including attempts, and those lent
+  /// out for torrents removed since
+  size_t _total;
+
+  /// Runs the connection attempts
+  asio::io_context _ctx;
+  /// Keeps `_ctx` running while there are no attempts
+  asio::executor_work_guard<asio::io_context::executor_type> _work;
+  /// Tries again to connect every second, for peers that could not be picked
+  asio::steady_timer _tick;
+  std::thread _runner;
+
+ public:
+  /// @param limits maximum number of connections
+  /// @param pool memory of the pieces downloaded over the connections
+  /// @param pick chooses the peers to connect to, called by any thread using
+  /// the manager. Must not call the manager
+  /// @param on_failed called by the connecting thread for every failed
+  /// attempt. Must not call the manager
+  ConnectionManager(Limits limits, piece_pool::PiecePool& pool, PickFn pick,
+                    FailedFn on_failed);
+
+  /// Closes all connections and stops the connecting thread
+  ~ConnectionManager();
+
+  ConnectionManager(const ConnectionManager&) = delete;
+  ConnectionManager& operator=(const ConnectionManager&) = delete;
+
+  /// Start connecting to the peers of a torrent
+  void add_torrent(TorrentID tid,
+                   std::shared_ptr<const TorrentFile> descriptor);
+
+  /// Close all connections of a torrent, connections lent or parked are
+  /// closed once given back or done waiting
+  void remove_torrent(TorrentID tid);
+
+  /// Take a ready connection to a peer of a torrent which may have a piece,
+  /// waiting for one to be established if there is none
+  /// A connection holding part of the piece since its peer choked us is taken
+  /// first, so that the piece is resumed
+  /// @return the connection, nothing if none is ready before the timeout
+  std::optional<Connection> acquire(TorrentID tid, size_t piece,
+                                    std::chrono::steady_clock::duration wait);
+
+  /// Give back a connection after a download, it is reused if it is still
+  /// open and closed otherwise
+  void release(Connection connection);
+
+  /// Close a connection that failed, freeing its slot for another peer
+  void discard(Connection connection);
+
+  /// Give back a connection whose peer is choking us. It is ready again once
+  /// the peer sends something, hopefully an unchoke, and closed if the peer
+  /// sends nothing for too long or closes the connection. Must be connected
+  void park(Connection connection);
+
+  /// @return number of connections, including attempts in flight
+  [[nodiscard]] size_t connections() const;
+
+ private:
+  /// Start attempts to new peers until a limit is reached or no more peers
+  /// can be picked. Must be called with the mutex unlocked
+  void fill();
+
+  /// Connect to a peer on the connecting thread
+  void connect(TorrentID tid, Candidate candidate);
+
+  /// Handle the end of an attempt, on the connecting thread
+  void connected(const std::shared_ptr<Attempt>& attempt,
+                 const std::error_code& ec);
+
+  /// Handle the end of the wait of a parked connection, on the connecting
+  /// thread
+  void unparked(const std::shared_ptr<Parked>& parked,
+                const std::error_code& ec);
+
+  /// Refill every second, on the connecting thread
+  void schedule_tick();
+};
+
+}  // namespace fur::download::connection_manager
@@ -4,18 +4,40 @@
 #include <cassert>
 #include <cstdint>
 #include <stdexcept>
+#include <type_traits>
+#include <variant>
 
+#include "config.hpp"
 #include "download/util.hpp"
 #include "hash.hpp"
 #include "log/logger.hpp"
 
-using fur::download::message::MessageKind;
+namespace fur::download {
+
+bool verify(Downloaded& downloaded, const TorrentFile& torrent) {
+  // Whatever the hasher has not consumed yet is hashed now
+  size_t consumed = downloaded.hasher.consumed();
+  if (consumed < downloaded.content.size())
+    downloaded.hasher.update(downloaded.content.data() + consumed,
+                             downloaded.content.size() - consumed);
+  if (downloaded.hasher.finalize() != torrent.piece_hashes[downloaded.index])
+    return false;
+  if (!torrent.v2) return true;
+
+  // Hybrid torrents must match both hashes, otherwise a peer could send data
+  // that the v2 peers would reject
+  const PieceRoot& expected = torrent.v2->piece_roots[downloaded.index];
+  size_t blocks =
+      (expected.data_len + merkle::BLOCK_SIZE - 1) / merkle::BLOCK_SIZE;
+  if (downloaded.leaves.size() != blocks)
+    return merkle::data_root(downloaded.content.data(), expected.data_len,
+                             expected.width) == expected.root;
+  return merkle::root(downloaded.leaves, expected.width) == expected.root;
+}
 
-namespace fur::download::downloader {
-/// Should be greater than 10 seconds for a realistic torrent client but smaller
-/// values result in quicker testing
-const int UNCHOKE_TIMEOUT = 15;
+}  // namespace fur::download
 
+namespace fur::download::downloader {
 DownloaderError from_socket_error(const socket::SocketError& err) {
   if (err == socket::SocketError::Timeout) {
     return DownloaderError::SocketTimeout;
@@ -24,34 +46,83 @@ DownloaderError from_socket_error(const socket::SocketError& err) {
   }
 }
 
-Downloader::Downloader(const TorrentFile& torrent, const Peer& peer)
-    : torrent{torrent}, peer{peer} {}
+Downloader::Downloader(const TorrentFile& torrent, const Peer& peer,
+                       piece_pool::PiecePool& pool)
+    : torrent{torrent}, peer{peer}, pool{pool} {}
+
+Downloader::Downloader(const TorrentFile& torrent, const Peer& peer,
+                       piece_pool::PiecePool& pool, Socket connected)
+    : torrent{torrent}, peer{peer}, pool{pool} {
+  socket.emplace(std::move(connected));
+}
+
+const Peer& Downloader::remote() const { return peer; }
+
+bool Downloader::may_have(size_t index) const {
+  return !bitfield.has_value() ||
+         (index < bitfield->len && bitfield->get(static_cast<uint32_t>(index)));
+}
+
+bool Downloader::connected() const {
+  return socket.has_value() && socket->is_open();
+}
+
+bool Downloader::resumes(size_t index) const {
+  return partial.has_value() && partial->index == index &&
+         partial->blocks_received > 0;
+}
+
+Socket Downloader::detach_socket() {
+  Socket detached = std::move(*socket);
+  socket.reset();
+  return detached;
+}
+
+void Downloader::attach_socket(Socket detached) {
+  socket.emplace(std::move(detached));
+}
+
+Downloader::Partial::Partial(size_t index, piece_pool::PieceBuffer content,
+                             size_t blocks, size_t leaves)
+    : index{index},
+      content{std::move(content)},
+      received(blocks, false),
+      blocks_received{0},
+      next_request{0},
+      in_flight{0},
+      blocks_hashed{0},
+      leaves(leaves) {}
 
 Outcome<DownloaderError> Downloader::ensure_connected() {
   using Outcome = Outcome<DownloaderError>;
 
   auto logger = spdlog::get("custom");
 
-  if (socket.has_value() && socket->is_open()) return Outcome::OK({});
-
-  // Destroy any zombie socket and reset choked status (only really useful when
-  // the socket is there but unhealthy. That is: `is_open` returns false)
-  socket.reset();
+  // The bitfield is only known once the handshake is done
+  if (connected() && bitfield.has_value()) return Outcome::OK({});
+  bitfield.reset();
   choked = true;
 
-  // Construct the socket
-  socket.emplace();
+  // A socket may have been connected beforehand, otherwise connect now
+  if (!connected()) {
+    // Destroy any zombie socket (only really useful when the socket is there
+    // but unhealthy. That is: `is_open` returns false)
+    socket.reset();
+
+    // Construct the socket
+    socket.emplace();
+
+    // TCP connect
+    auto maybe_connect =
+        socket->connect(peer.ip, peer.port, std::chrono::seconds(5));
+    if (!maybe_connect.valid()) {
+      destroy_socket();
+      return Outcome::ERROR(from_socket_error(maybe_connect.error()));
+    }
 
-  // TCP connect
-  auto maybe_connect =
-      socket->connect(peer.ip, peer.port, std::chrono::seconds(5));
-  if (!maybe_connect.valid()) {
-    destroy_socket();
-    return Outcome::ERROR(from_socket_error(maybe_connect.error()));
+    logger->debug("TCP connected with {}", peer.address());
   }
 
-  logger->debug("TCP connected with {}", peer.address());
-
   // BitTorrent handshake
   auto maybe_handshake = handshake();
   if (!maybe_handshake.valid()) return maybe_handshake;
@@ -62,46 +133,30 @@ Outcome<DownloaderError> Downloader::ensure_connected() {
   auto maybe_message = recv_message(std::chrono::seconds(5));
   if (!maybe_message.valid())
     return Outcome::ERROR(DownloaderError(maybe_message.error()));
-  auto message = std::unique_ptr<Message>(maybe_message->release());
-
-  if (message->kind() != MessageKind::Bitfield) {
+  const auto* bitfield_message = std::get_if<BitfieldMessage>(&*maybe_message);
+  if (bitfield_message == nullptr) {
     destroy_socket();
     return Outcome::ERROR(DownloaderError::NoBitfield);
   }
-  auto& bitfield_message = dynamic_cast<BitfieldMessage&>(*message);
-  bitfield.reset();
-  bitfield.emplace(bitfield_message.bitfield.get_bytes(),
-                   bitfield_message.bitfield.len);
+  const Bytes& bytes = bitfield_message->bitfield;
+  bitfield.emplace(std::vector<uint8_t>(bytes.data, bytes.data + bytes.size),
+                   static_cast<uint32_t>(torrent.piece_hashes.size()));
 
   logger->debug("{} sent its bitfield", peer.address());
 
-  auto maybe_unchoke = send_message(UnchokeMessage(), std::chrono::seconds(5));
+  auto maybe_unchoke = send_message(UnchokeMessage{}, std::chrono::seconds(5));
   if (!maybe_unchoke.valid()) return maybe_unchoke;
   logger->debug("We unchoked {}", peer.address());
 
   auto maybe_interested =
-      send_message(InterestedMessage(), std::chrono::seconds(5));
+      send_message(InterestedMessage{}, std::chrono::seconds(5));
   if (!maybe_interested.valid()) return maybe_interested;
   logger->debug("We are interested in {}", peer.address());
 
-  // Every connection starts chocked
+  // Every connection starts chocked. Waiting to be unchoked is left to the
+  // callers, so that it takes no thread
   choked = true;
-
-  // Now we need to wait to be unchoked by the peer. Only then can we start to
-  // ask for pieces.
-  while (choked) {
-    maybe_message = recv_message(std::chrono::milliseconds(50));
-    if (!maybe_message.valid())
-      return Outcome::ERROR(DownloaderError(maybe_message.error()));
-    message = std::unique_ptr<Message>(maybe_message->release());
-
-    if (message->kind() == MessageKind::Unchoke) {
-      choked = false;
-    }
-    // No need to do anything for all other messages
-  }
-
-  logger->debug("{} unchoked us", peer.address());
+  choked_at = std::chrono::steady_clock::now();
 
   return Outcome::OK({});
 }
@@ -181,18 +236,35 @@ Result<Downloaded, DownloaderError> Downloader::try_download(
     const Piece& task) {
   using Result = Result<Downloaded, DownloaderError>;
 
+  auto maybe_downloaded = try_fetch(task);
+  if (!maybe_downloaded.valid()) return maybe_downloaded;
+
+  if (!verify(*maybe_downloaded, torrent)) {
+    auto logger = spdlog::get("custom");
+    logger->debug("{} sent corrupt piece {}", peer.address(), task.index);
+    return Result::ERROR(DownloaderError::CorruptPiece);
+  }
+  return maybe_downloaded;
+}
+
+Result<Downloaded, DownloaderError> Downloader::try_fetch(const Piece& task) {
+  using Result = Result<Downloaded, DownloaderError>;
+
   auto logger = spdlog::get("custom");
 
+  // Only a choke keeps the blocks received so far, any other error gives the
+  // memory of the piece back
+  auto fail = [&](DownloaderError error) {
+    partial.reset();
+    return Result::ERROR(std::move(error));
+  };
+
   auto maybe_connected = ensure_connected();
   if (!maybe_connected.valid())
-    return Result::ERROR(DownloaderError(maybe_connected.error()));
+    return fail(DownloaderError(maybe_connected.error()));
 
   // Peer doesn't have this piece
-  if (!bitfield->get(task.index))
-    return Result::ERROR(DownloaderError::MissingPiece);
-
-  // The resulting piece
-  std::vector<uint8_t> piece;
+  if (!bitfield->get(task.index)) return fail(DownloaderError::MissingPiece);
 
   auto piece_length = torrent.piece_length;
   // Might be shorter if this is the last piece
@@ -204,105 +276,180 @@ Result<Downloaded, DownloaderError> Downloader::try_download(
     piece_length = torrent.length - before_this_piece;
   }
 
-  piece.resize(piece_length);
-
   // How many bytes to demand in a `RequestMessage`. Should be 16KB.
   constexpr size_t BLOCK_SIZE = 16384;
+  static_assert(BLOCK_SIZE == merkle::BLOCK_SIZE,
+                "Blocks must be the leaves of the v2 merkle trees");
 
   // How many blocks are there to download in total. Integer ceil division.
   const size_t blocks_total = (piece_length + BLOCK_SIZE - 1) / BLOCK_SIZE;
-  // How many blocks have we requested so far.
-  size_t blocks_requested = 0;
-  // How many blocks have we received so far.
-  size_t blocks_received = 0;
+
+  // With v2 metadata each block is also hashed on arrival as a leaf of the
+  // merkle tree of its file. Blocks of the padding after the file have none
+  const size_t data_len =
+      torrent.v2 ? torrent.v2->piece_roots[task.index].data_len : 0;
 
   // How many requested but unreceived blocks do we want to await at once
   constexpr size_t PIPELINE_SIZE_MAX = 5;
 
-  // Dynamically updated to be longer after a Choke and shorter after an Unchoke
-  auto timeout = std::chrono::seconds(5);
+  // A piece interrupted by a choke is resumed, any other is dropped
+  if (partial.has_value() && partial->index != task.index) partial.reset();
+
+  // Until the piece is entirely downloaded
+  while (true) {
+    // The memory of the piece is only borrowed once the peer serves us
+    if (!partial.has_value() && !choked)
+      partial.emplace(task.index, pool.acquire(piece_length), blocks_total,
+                      (data_len + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    if (partial.has_value() && partial->blocks_received == blocks_total) break;
+
+    if (choked) {
+      // Only the messages that have already arrived are handled, waiting for
+      // more is left to the caller
+      if (socket->available() == 0) {
+        if (std::chrono::steady_clock::now() - choked_at >=
+            config::UNCHOKE_TIMEOUT) {
+          logger->debug("{} kept us choked for too long", peer.address());
+          destroy_socket();
+          return fail(DownloaderError::SocketTimeout);
+        }
+
+        // A piece barely started leaves its memory to the others
+        if (partial.has_value() && partial->blocks_received == 0)
+          partial.reset();
+        return Result::ERROR(DownloaderError::Choked);
+      }
+    } else {
+      Partial& state = *partial;
+      while (state.in_flight < PIPELINE_SIZE_MAX) {
+        // Blocks received before a choke are not requested again
+        while (state.next_request < blocks_total &&
+               state.received[state.next_request])
+          state.next_request++;
+        if (state.next_request == blocks_total) break;
 
-  // While the piece is not entirely downloaded
-  while (blocks_received < blocks_total) {
-    if (!choked) {
-      while ((blocks_requested - blocks_received) < PIPELINE_SIZE_MAX &&
-             blocks_requested < blocks_total) {
         // Might be shorter if this is the last block
         auto length = BLOCK_SIZE;
-        if (blocks_requested == blocks_total - 1) {
-          length = piece_length - blocks_requested * BLOCK_SIZE;
+        if (state.next_request == blocks_total - 1) {
+          length = piece_length - state.next_request * BLOCK_SIZE;
         }
 
-        auto offset = blocks_requested * BLOCK_SIZE;
+        auto offset = state.next_request * BLOCK_SIZE;
 
         auto maybe_sent =
-            send_message(RequestMessage(task.index, offset, length),
+            send_message(RequestMessage{static_cast<uint32_t>(task.index),
+                                        static_cast<uint32_t>(offset),
+                                        static_cast<uint32_t>(length)},
                          std::chrono::seconds(5));
         if (!maybe_sent.valid()) {
-          return Result::ERROR(DownloaderError(maybe_sent.error()));
+          return fail(DownloaderError(maybe_sent.error()));
         }
 
-        blocks_requested++;
+        if (!state.first_request)
+          state.first_request = std::chrono::steady_clock::now();
+        state.next_request++;
+        state.in_flight++;
         logger->debug("Requested {} bytes at offset {} of piece {} from {}",
                       length, offset, task.index, peer.address());
       }
     }
 
-    auto maybe_message = recv_message(timeout);
+    auto maybe_message = recv_message(std::chrono::seconds(5));
     if (!maybe_message.valid())
-      return Result::ERROR(DownloaderError(maybe_message.error()));
-    auto message = std::unique_ptr<Message>(maybe_message->release());
-
-    switch (message->kind()) {
-      case MessageKind::Choke:
-        choked = true;
-        // Use a slightly longer timeout to wait to be unchoked
-        timeout = std::chrono::seconds(UNCHOKE_TIMEOUT);
-        logger->debug("{} choked us", peer.address());
-        break;
-      case MessageKind::Unchoke:
-        choked = false;
-        // Reset timeout to the lower one
-        timeout = std::chrono::seconds(5);
-        logger->debug("{} unchoked us", peer.address());
-        break;
-      case MessageKind::Have: {
-        // Nice, the peer has acquired a new piece that it can share
-        auto& have_message = dynamic_cast<HaveMessage&>(*message);
-        auto new_piece_index = have_message.index;
-        bitfield->set(new_piece_index);
-        logger->debug("{} now has piece {}", peer.address(), new_piece_index);
-        break;
-      }
-      case MessageKind::Piece: {
-        // There it is
-        auto& piece_message = dynamic_cast<PieceMessage&>(*message);
-        std::copy(piece_message.block.begin(), piece_message.block.end(),
-                  piece.begin() + piece_message.begin);
-        blocks_received++;
-        logger->debug("{} sent us {} bytes at offset {} of piece {}",
-                      peer.address(), piece_message.block.size(),
-                      piece_message.begin, task.index);
-        break;
-      }
-      default:;  // We can safely ignore other messages (hopefully)
-    }
-  }
-
-  if (!hash::verify_piece(piece, torrent.piece_hashes[task.index])) {
-    logger->debug("{} sent corrupt piece {}", peer.address(), task.index);
-    return Result::ERROR(DownloaderError::CorruptPiece);
+      return fail(DownloaderError(maybe_message.error()));
+    // Each kind of message is handled by its own branch, resolved at compile
+    // time. Other messages can be safely ignored (hopefully)
+    auto error = std::visit(
+        [&](const auto& message) -> std::optional<DownloaderError> {
+          using T = std::decay_t<decltype(message)>;
+          if constexpr (std::is_same_v<T, ChokeMessage>) {
+            choked = true;
+            choked_at = std::chrono::steady_clock::now();
+            // The peer drops our pending requests, they are sent again once
+            // it unchokes us
+            if (partial.has_value()) {
+              partial->next_request = 0;
+              partial->in_flight = 0;
+            }
+            logger->debug("{} choked us", peer.address());
+          } else if constexpr (std::is_same_v<T, UnchokeMessage>) {
+            choked = false;
+            logger->debug("{} unchoked us", peer.address());
+          } else if constexpr (std::is_same_v<T, HaveMessage>) {
+            // Nice, the peer has acquired a new piece that it can share
+            bitfield->set(message.index);
+            logger->debug("{} now has piece {}", peer.address(),
+                          message.index);
+          } else if constexpr (std::is_same_v<T, PieceMessage>) {
+            // Blocks of pieces given up on may still arrive
+            if (!partial.has_value() || message.index != partial->index)
+              return std::nullopt;
+            Partial& state = *partial;
+
+            // There it is
+            const Bytes& block = message.block;
+            if (message.begin >= state.content.size())
+              return DownloaderError::InvalidMessage;
+
+            // Only blocks as we requested them are accepted, whole
+            size_t index = message.begin / BLOCK_SIZE;
+            if (message.begin % BLOCK_SIZE != 0 || state.received[index])
+              return std::nullopt;
+            const size_t length =
+                std::min(BLOCK_SIZE, piece_length - message.begin);
+            if (block.size != length) return DownloaderError::InvalidMessage;
+
+            std::copy(block.data, block.data + block.size,
+                      state.content.begin() + message.begin);
+            if (!state.first_block)
+              state.first_block = std::chrono::steady_clock::now();
+            state.received[index] = true;
+            state.blocks_received++;
+            if (state.in_flight > 0) state.in_flight--;
+
+            if (index < state.leaves.size()) {
+              size_t offset = index * BLOCK_SIZE;
+              state.leaves[index] =
+                  merkle::leaf(state.content.data() + offset,
+                               std::min(BLOCK_SIZE, data_len - offset));
+            }
+
+            // Hash the new in-order prefix of the piece
+            while (state.blocks_hashed < blocks_total &&
+                   state.received[state.blocks_hashed]) {
+              size_t offset = state.blocks_hashed * BLOCK_SIZE;
+              state.hasher.update(state.content.data() + offset,
+                                  std::min(BLOCK_SIZE, piece_length - offset));
+              state.blocks_hashed++;
+            }
+            logger->debug("{} sent us {} bytes at offset {} of piece {}",
+                          peer.address(), block.size, message.begin,
+                          task.index);
+          }
+          return std::nullopt;
+        },
+        *maybe_message);
+    if (error) return fail(std::move(*error));
   }
 
   logger->debug("Piece {} completely downloaded from {}", task.index,
                 peer.address());
 
-  return Result::OK({task.index, std::move(piece)});
+  // An empty piece needs no request and takes no time
+  Partial done = std::move(*partial);
+  partial.reset();
+  const auto now = std::chrono::steady_clock::now();
+  const auto start = done.first_request.value_or(now);
+  return Result::OK({task.index, std::move(done.content), done.hasher,
+                     std::move(done.leaves),
+                     done.first_block.value_or(now) - start, now - start});
 }
 
 Outcome<DownloaderError> Downloader::send_message(const Message& msg,
                                                   timeout timeout) {
-  auto outcome = socket->write(msg.encode(), timeout);
+  send_buffer.clear();
+  encode(msg, send_buffer);
+  auto outcome = socket->write(send_buffer, timeout);
   if (outcome.valid()) {
     return Outcome<DownloaderError>::OK({});
   } else {
@@ -311,40 +458,36 @@ Outcome<DownloaderError> Downloader::send_message(const Message& msg,
   }
 }
 
-Result<std::unique_ptr<Message>, DownloaderError> Downloader::recv_message(
-    timeout timeout) {
-  using Result = Result<std::unique_ptr<Message>, DownloaderError>;
+Result<Message, DownloaderError> Downloader::recv_message(timeout timeout) {
+  using Result = Result<Message, DownloaderError>;
 
   auto before_read_len = std::chrono::steady_clock::now();
 
-  auto maybe_message_len_bytes = socket->read(4, timeout);
-  if (!maybe_message_len_bytes.valid()) {
+  // The whole message is read into `recv_buffer`, length included
+  recv_buffer.resize(4);
+  auto maybe_len = socket->read_into(recv_buffer.data(), 4, timeout);
+  if (!maybe_len.valid()) {
     destroy_socket();
-    return Result::ERROR(from_socket_error(maybe_message_len_bytes.error()));
+    return Result::ERROR(from_socket_error(maybe_len.error()));
   }
-  auto message_len_bytes = *maybe_message_len_bytes;
 
   auto message_len = decode_big_endian(
-      std::array<uint8_t, 4>{message_len_bytes[0], message_len_bytes[1],
-                             message_len_bytes[2], message_len_bytes[3]});
+      std::array<uint8_t, 4>{recv_buffer[0], recv_buffer[1], recv_buffer[2],
+                             recv_buffer[3]});
 
   // The time left is equal to the original timeout minus the time it took to
   // read the message length.
   timeout -= std::chrono::steady_clock::now() - before_read_len;
 
-  auto maybe_rest = socket->read(message_len, timeout);
+  recv_buffer.resize(4 + static_cast<size_t>(message_len));
+  auto maybe_rest =
+      socket->read_into(recv_buffer.data() + 4, message_len, timeout);
   if (!maybe_rest.valid()) {
     destroy_socket();
     return Result::ERROR(from_socket_error(maybe_rest.error()));
   }
-  auto rest = *maybe_rest;
-
-  std::vector<std::uint8_t> whole;
-  whole.reserve(message_len_bytes.size() + rest.size());
-  whole.insert(whole.end(), message_len_bytes.begin(), message_len_bytes.end());
-  whole.insert(whole.end(), rest.begin(), rest.end());
 
-  auto message = Message::decode(torrent, whole);
+  auto message = decode(recv_buffer);
   if (!message.valid()) {
     destroy_socket();
 
@@ -355,7 +498,7 @@ Result<std::unique_ptr<Message>, DownloaderError> Downloader::recv_message(
     return Result::ERROR(DownloaderError::InvalidMessage);
   }
 
-  return Result::OK(std::unique_ptr<Message>(message->release()));
+  return Result::OK(std::move(*message));
 }
 
 void Downloader::destroy_socket() {
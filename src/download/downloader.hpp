@@ -1,12 +1,15 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
 #include <memory>
 #include <optional>
 
 #include "download/bitfield.hpp"
 #include "download/message.hpp"
+#include "download/piece_pool.hpp"
 #include "download/socket.hpp"
+#include "hash.hpp"
 #include "peer.hpp"
 #include "tfriend_fw.hpp"
 #include "torrent.hpp"
@@ -16,15 +19,30 @@ using namespace fur::util;
 using namespace fur::peer;
 using namespace fur::download::socket;
 using namespace fur::download::message;
+using namespace fur::download::bitfield;
 
 namespace fur::download {
 
 /// A downloaded piece for a torrent file.
 struct Downloaded {
   size_t index;
-  std::vector<uint8_t> content;
+  /// Borrowed from the pool of the `Downloader`, returned when destroyed
+  piece_pool::PieceBuffer content;
+  /// Hash of the content, computed while the blocks arrived and not yet
+  /// finalized
+  hash::Hasher hasher;
+  /// Merkle leaves of the blocks of v2 torrents, hashed as they arrived
+  std::vector<merkle::node_t> leaves;
+  /// Time between the first request and the arrival of the first block
+  std::chrono::steady_clock::duration rtt{};
+  /// Time between the first request and the arrival of the last block
+  std::chrono::steady_clock::duration transfer{};
 };
 
+/// Finish hashing a downloaded piece and compare it with its hash, and with
+/// its merkle subtree for v2 torrents
+bool verify(Downloaded& downloaded, const TorrentFile& torrent);
+
 }  // namespace fur::download
 
 namespace fur::download::downloader {
@@ -40,6 +58,9 @@ enum class DownloaderError {
   MissingPiece,
   /// The piece was correctly downloaded but doesn't match the expected hash
   CorruptPiece,
+  /// The peer is choking us. The blocks received so far are kept, so that the
+  /// piece is resumed by the next attempt once the peer unchokes us
+  Choked,
   /// The socket timed out
   SocketTimeout,
   /// The socket experienced some other, generic, error
@@ -54,7 +75,35 @@ DownloaderError from_socket_error(const socket::SocketError& err);
 class Downloader {
  public:
   /// Construct a new `Downloader`. No TCP socket is established at this time.
-  explicit Downloader(const TorrentFile& torrent, const Peer& peer);
+  /// Pieces are downloaded into buffers borrowed from `pool`.
+  explicit Downloader(const TorrentFile& torrent, const Peer& peer,
+                      piece_pool::PiecePool& pool);
+
+  /// Construct a new `Downloader` over a socket already connected to `peer`,
+  /// the BitTorrent handshake is still to be done.
+  Downloader(const TorrentFile& torrent, const Peer& peer,
+             piece_pool::PiecePool& pool, Socket connected);
+
+  /// Returns the peer this `Downloader` downloads from.
+  [[nodiscard]] const Peer& remote() const;
+
+  /// Returns `false` if the peer is known not to have a piece. Before the
+  /// handshake nothing is known, so every piece may be there.
+  [[nodiscard]] bool may_have(size_t index) const;
+
+  /// Returns `true` if the socket is open, either connected or ready.
+  [[nodiscard]] bool connected() const;
+
+  /// Returns `true` if part of piece `index` has been received before the peer
+  /// choked us, the next attempt to download it then resumes it.
+  [[nodiscard]] bool resumes(size_t index) const;
+
+  /// Take the socket away, for example to wait for the peer to unchoke us
+  /// without a thread. Must be connected.
+  [[nodiscard]] Socket detach_socket();
+
+  /// Give back the socket taken by `detach_socket`.
+  void attach_socket(Socket detached);
 
   /// Attempt downloading a piece using this `Downloader`. The function tries
   /// it best not to throw any exception (unless something truly exceptional
@@ -63,11 +112,19 @@ class Downloader {
   ///  - This peer not having the requested piece available
   ///  - The connection timing out
   ///  - The downloaded piece being corrupt
+  ///  - The peer choking us, the download is then resumed by the next attempt
   [[nodiscard]] Result<Downloaded, DownloaderError> try_download(const Piece&);
 
+  /// Same as `try_download` but the piece is not checked against its hash,
+  /// so that verification can happen elsewhere with `verify` while this
+  /// `Downloader` moves on. Never fails with `CorruptPiece`
+  [[nodiscard]] Result<Downloaded, DownloaderError> try_fetch(const Piece&);
+
  private:
   const TorrentFile& torrent;
-  const Peer& peer;
+  /// Copied, so that a `Downloader` can be kept for many pieces
+  const Peer peer;
+  piece_pool::PiecePool& pool;
 
   /// Socket that this `Downloader` has established with a `Peer`. This is
   /// lazily initialized when needed and kept in good health thanks to
@@ -80,14 +137,56 @@ class Downloader {
   /// a `Downloader` is not re-created when a connection drops but recycled,
   /// we should take care to reset this to `true`.
   bool choked = true;
+  /// When the peer last choked us, the connection is closed if it keeps us
+  /// choked for longer than `config::UNCHOKE_TIMEOUT`.
+  std::chrono::steady_clock::time_point choked_at;
   /// Tracks what pieces this peer has available for sharing. Should be reset to
   /// `std::nullopt` when a connection drops and is later recycled.
   std::optional<Bitfield> bitfield;
+  /// A piece being downloaded, kept when the peer chokes us so that the
+  /// blocks already received are not requested again. Its memory is held at
+  /// most until the peer is given up on for keeping us choked too long.
+  struct Partial {
+    /// Borrows the memory of the piece, with room for `blocks` blocks of
+    /// which `leaves` are hashed as merkle leaves.
+    Partial(size_t index, piece_pool::PieceBuffer content, size_t blocks,
+            size_t leaves);
+
+    size_t index;
+    /// Every byte is overwritten by the received blocks
+    piece_pool::PieceBuffer content;
+    /// Which blocks have we received, they might arrive out of order.
+    std::vector<bool> received;
+    size_t blocks_received;
+    /// Blocks before this one have been requested since the last unchoke, or
+    /// received.
+    size_t next_request;
+    /// How many requested blocks are still awaited. A peer choking us drops
+    /// the requests it has not served yet.
+    size_t in_flight;
+    /// The piece is hashed while downloading, consuming the blocks as soon
+    /// as all the ones before them have arrived.
+    hash::Hasher hasher;
+    size_t blocks_hashed;
+    /// Merkle leaves of the blocks of v2 torrents
+    std::vector<merkle::node_t> leaves;
+    /// When the first block was requested and when the first one arrived, to
+    /// measure the round trip time and the throughput of the peer
+    std::optional<std::chrono::steady_clock::time_point> first_request;
+    std::optional<std::chrono::steady_clock::time_point> first_block;
+  };
+  /// The piece being downloaded, if any
+  std::optional<Partial> partial;
+  /// Reused to encode every message sent, so that sending doesn't allocate.
+  std::vector<uint8_t> send_buffer;
+  /// Holds the last message received, which points into it. Reused for every
+  /// message, so that receiving doesn't allocate.
+  std::vector<uint8_t> recv_buffer;
 
  public:
   /// Ensures that the `socket` is present and in good health (not dropped,
-  /// timed out and such). Should always call this method first, before
-  /// accessing the socket.
+  /// timed out and such), and that the handshake has been done. Should always
+  /// call this method first, before accessing the socket.
   Outcome<DownloaderError> ensure_connected();
 
  private:
@@ -95,8 +194,8 @@ class Downloader {
   Outcome<DownloaderError> handshake();
 
   Outcome<DownloaderError> send_message(const Message& msg, timeout timeout);
-  Result<std::unique_ptr<Message>, DownloaderError> recv_message(
-      timeout timeout);
+  /// Receive a message, valid until the next call
+  Result<Message, DownloaderError> recv_message(timeout timeout);
 
   /// Should be called after any socket error to make sure that it is re-created
   /// upon new operations.
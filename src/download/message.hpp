@@ -1,18 +1,16 @@
 #pragma once
 
 #include <cstdint>
-#include <memory>
-#include <optional>
+#include <string>
+#include <variant>
 #include <vector>
 
-#include "download/bitfield.hpp"
-#include "torrent.hpp"
 #include "util/result.hpp"
 
 using namespace fur::util;
-using namespace fur::download::bitfield;
 
 namespace fur::download::message {
+/// Kind of a `Message`, in the same order as its alternatives
 enum class MessageKind {
   KeepAlive,
   Choke,
@@ -40,214 +38,72 @@ enum class DecodeError {
 
 std::string display_decode_error(const DecodeError& err);
 
-/// Virtual class for messages exchanged between BitTorrent clients.
-/// They are all shaped like:
-///   <length><id><payload>
-class Message {
- public:
-  virtual ~Message() = default;
-  /// Encode this message to wire format. This is virtual because
-  /// `KeepAliveMessage` uses a slightly different encoding that all other
-  /// messages. That's the only subclass overriding `encode`.
-  [[nodiscard]] virtual std::vector<uint8_t> encode() const;
-
-  /// Try decoding a finite sequence of bytes into a `Message`. A return value
-  /// `std::nullopt` indicates failure and receding communication with the peer
-  /// is advised to avoid invalid state. The `TorrentFile` is currently only
-  /// required because `BitfieldMessage` needs to know the piece count to
-  /// decode itself nicely.
-  [[nodiscard]] static Result<std::unique_ptr<Message>, DecodeError> decode(
-      const TorrentFile& torrent, const std::vector<uint8_t>& buf);
-
-  /// Returns the kind of this message. Used before `dynamic_cast`ing when the
-  /// underlying type is not known beforehand.
-  [[nodiscard]] virtual MessageKind kind() const = 0;
-
- private:
-  /// Returns the ID of this message type. Used for encoding only.
-  [[nodiscard]] virtual uint8_t message_id() const = 0;
-  /// Encodes the payload section of this message. Overridden by each specific
-  /// message type.
-  [[nodiscard]] virtual std::vector<uint8_t> encode_payload() const = 0;
+/// A sequence of bytes owned by someone else. Decoded messages point into the
+/// buffer they have been decoded from, so they must not outlive it
+struct Bytes {
+  const uint8_t* data;
+  size_t size;
 };
 
 /// Periodically sent to keep the socket alive.
 ///   <length=0> (no id)
-/// Because this is the only message with no ID, we override the `encode`
-/// function in its entirety, instead of only overriding `encode_payload`.
-class KeepAliveMessage final : public Message {
- public:
-  /// This message type is encoded slightly differently than other messages
-  /// (there's no ID) so we use a custom encoding function.
-  [[nodiscard]] std::vector<uint8_t> encode() const override {
-    return {0, 0, 0, 0};
-  }
-
-  [[nodiscard]] MessageKind kind() const override {
-    return MessageKind::KeepAlive;
-  }
-
- private:
-  /// Never really called but must be implemented to make `KeepAliveMessage` a
-  /// complete type.
-  [[nodiscard]] uint8_t message_id() const override { return 0; }
-  /// Never really called but must be implemented to make `KeepAliveMessage` a
-  /// complete type.
-  [[nodiscard]] std::vector<uint8_t> encode_payload() const override {
-    return {};
-  }
-};
+struct KeepAliveMessage {};
 
 /// Inform the peer that we're not going to accept any more requests until
 /// unchoked.
 ///   <length=1><id=0>
-class ChokeMessage final : public Message {
- public:
-  [[nodiscard]] MessageKind kind() const override { return MessageKind::Choke; }
-
- private:
-  [[nodiscard]] uint8_t message_id() const override { return 0; }
-  [[nodiscard]] std::vector<uint8_t> encode_payload() const override {
-    return {};
-  }
-};
+struct ChokeMessage {};
 
 /// Inform the peer that we're ready to accept more piece requests.
 ///   <length=1><id=1>
-class UnchokeMessage final : public Message {
- public:
-  [[nodiscard]] MessageKind kind() const override {
-    return MessageKind::Unchoke;
-  }
-
- private:
-  [[nodiscard]] uint8_t message_id() const override { return 1; }
-  [[nodiscard]] std::vector<uint8_t> encode_payload() const override {
-    return {};
-  }
-};
+struct UnchokeMessage {};
 
 /// Inform the peer that we're interested in requesting pieces from it.
 ///   <length=1><id=2>
-class InterestedMessage final : public Message {
- public:
-  [[nodiscard]] MessageKind kind() const override {
-    return MessageKind::Interested;
-  }
-
- private:
-  [[nodiscard]] uint8_t message_id() const override { return 2; }
-  [[nodiscard]] std::vector<uint8_t> encode_payload() const override {
-    return {};
-  }
-};
+struct InterestedMessage {};
 
 /// Inform the peer that we're no longer interested in requesting pieces from
 /// it.
 ///   <length=1><id=3>
-class NotInterestedMessage final : public Message {
- public:
-  [[nodiscard]] MessageKind kind() const override {
-    return MessageKind::NotInterested;
-  }
-
- private:
-  [[nodiscard]] uint8_t message_id() const override { return 3; }
-  [[nodiscard]] std::vector<uint8_t> encode_payload() const override {
-    return {};
-  }
-};
+struct NotInterestedMessage {};
 
 /// Inform the peer that we have acquired a new piece.
 ///   <length=5><id=4><piece-index>
-class HaveMessage final : public Message {
- public:
+struct HaveMessage {
   /// Index of the newly acquired piece.
-  const uint32_t index;
-
-  explicit HaveMessage(uint32_t index) : index{index} {}
-
-  [[nodiscard]] static Result<std::unique_ptr<HaveMessage>, DecodeError> decode(
-      const std::vector<uint8_t>& buf);
-
-  [[nodiscard]] MessageKind kind() const override { return MessageKind::Have; }
-
- private:
-  [[nodiscard]] uint8_t message_id() const override { return 4; }
-  [[nodiscard]] std::vector<uint8_t> encode_payload() const override;
+  uint32_t index;
 };
 
 /// Used by the peer to inform us of the pieces it has available for sharing.
 ///   <length=1+X><id=5><bitfield>
 /// where X is the length of the bitfield.
-class BitfieldMessage final : public Message {
- public:
-  /// Bitfield representing the pieces available.
-  const Bitfield bitfield;
-
-  explicit BitfieldMessage(Bitfield bitfield) : bitfield{std::move(bitfield)} {}
-
-  [[nodiscard]] static std::unique_ptr<BitfieldMessage> decode(
-      const TorrentFile& torrent, const std::vector<uint8_t>& buf);
-
-  [[nodiscard]] MessageKind kind() const override {
-    return MessageKind::Bitfield;
-  }
-
- private:
-  [[nodiscard]] uint8_t message_id() const override { return 5; }
-  [[nodiscard]] std::vector<uint8_t> encode_payload() const override;
+struct BitfieldMessage {
+  /// Bytes of the bitfield representing the pieces available. Their number
+  /// is not known to the message, it comes from the torrent.
+  Bytes bitfield;
 };
 
 /// Ask the peer to send us a subset of the bytes in a piece.
 ///   <length=13><id=6><index><begin><length>
-class RequestMessage final : public Message {
- public:
+struct RequestMessage {
   /// Index of the piece.
-  const uint32_t index;
+  uint32_t index;
   /// Offset from the beginning of the piece.
-  const uint32_t begin;
+  uint32_t begin;
   /// How many bytes we're asking. Typically 16KB.
-  const uint32_t length;
-
-  RequestMessage(uint32_t index, uint32_t begin, uint32_t length)
-      : index{index}, begin{begin}, length{length} {}
-
-  [[nodiscard]] static Result<std::unique_ptr<RequestMessage>, DecodeError>
-  decode(const std::vector<uint8_t>& buf);
-
-  [[nodiscard]] MessageKind kind() const override {
-    return MessageKind::Request;
-  }
-
- private:
-  [[nodiscard]] uint8_t message_id() const override { return 6; }
-  [[nodiscard]] std::vector<uint8_t> encode_payload() const override;
+  uint32_t length;
 };
 
 /// A message containing a subset of the bytes from a piece.
 ///   <length=9+X><id=7><index><begin><block>
 /// where X is the length of the block.
-class PieceMessage final : public Message {
- public:
+struct PieceMessage {
   /// Index of the piece.
-  const uint32_t index;
+  uint32_t index;
   /// Offset from the beginning of the piece.
-  const uint32_t begin;
+  uint32_t begin;
   /// The actual bytes from the piece.
-  const std::vector<uint8_t> block;
-
-  PieceMessage(uint32_t index, uint32_t begin, std::vector<uint8_t> block)
-      : index{index}, begin{begin}, block{std::move(block)} {}
-
-  [[nodiscard]] static Result<std::unique_ptr<PieceMessage>, DecodeError>
-  decode(const std::vector<uint8_t>& buf);
-
-  [[nodiscard]] MessageKind kind() const override { return MessageKind::Piece; }
-
- private:
-  [[nodiscard]] uint8_t message_id() const override { return 7; }
-  [[nodiscard]] std::vector<uint8_t> encode_payload() const override;
+  Bytes block;
 };
 
 // WARN: BitTorrent specifies a CancelMessage with ID 8, but we don't expect to
@@ -255,4 +111,32 @@ class PieceMessage final : public Message {
 
 // WARN: BitTorrent specifies a PortMessage with ID 9, but we don't expect to
 //  ever send or receive it
+
+/// Messages exchanged between BitTorrent clients. They are all shaped like:
+///   <length><id><payload>
+/// Messages are plain values, meant to be inspected with `std::visit`. The
+/// alternatives are in the same order as `MessageKind`, and the ID of a
+/// message is its index minus one.
+using Message =
+    std::variant<KeepAliveMessage, ChokeMessage, UnchokeMessage,
+                 InterestedMessage, NotInterestedMessage, HaveMessage,
+                 BitfieldMessage, RequestMessage, PieceMessage>;
+
+/// Returns the kind of a message.
+[[nodiscard]] MessageKind kind(const Message& message);
+
+/// Encode a message to wire format, appending it to `out` so that the same
+/// buffer can be reused for every message.
+void encode(const Message& message, std::vector<uint8_t>& out);
+
+/// Try decoding a whole message, as read from wire, length included. A failure
+/// indicates that receding communication with the peer is advised to avoid
+/// invalid state. Nothing is allocated, the bytes of `BitfieldMessage` and
+/// `PieceMessage` point into `buf`.
+[[nodiscard]] Result<Message, DecodeError> decode(const uint8_t* buf,
+                                                  size_t len);
+
+/// Same as above, decoding a whole buffer.
+[[nodiscard]] Result<Message, DecodeError> decode(
+    const std::vector<uint8_t>& buf);
 }  // namespace fur::download::message
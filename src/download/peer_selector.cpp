@@ -0,0 +1,98 @@
+#include "download/peer_selector.hpp"
+
+#include <algorithm>
+
+namespace fur::download::peer_selector {
+
+PeerSelector::PeerSelector() : _tree(1, 0), _total{0}, _usable{0} {}
+
+void PeerSelector::reset(size_t peers, uint64_t weight) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _weights.assign(peers, weight);
+  _removed.assign(peers, false);
+  build();
+}
+
+void PeerSelector::set(size_t peer, uint64_t weight) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (peer >= _weights.size() || _removed[peer]) return;
+  // Relying on unsigned wrap around when the weight decreases
+  update(peer, weight - _weights[peer]);
+}
+
+void PeerSelector::assign(const std::vector<uint64_t>& weights) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  const size_t count = std::min(weights.size(), _weights.size());
+  for (size_t i = 0; i < count; i++)
+    if (!_removed[i]) _weights[i] = weights[i];
+  build();
+}
+
+void PeerSelector::remove(size_t peer) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (peer >= _weights.size() || _removed[peer]) return;
+  // Subtract the weight, relying on unsigned wrap around
+  update(peer, ~_weights[peer] + 1);
+  _removed[peer] = true;
+  _usable -= 1;
+}
+
+std::optional<size_t> PeerSelector::pick(std::mt19937& gen) const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_total == 0) return std::nullopt;
+  std::uniform_int_distribution<uint64_t> point(0, _total - 1);
+  return find(point(gen));
+}
+
+std::vector<uint64_t> PeerSelector::weights() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _weights;
+}
+
+size_t PeerSelector::usable() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _usable;
+}
+
+void PeerSelector::build() {
+  const size_t peers = _weights.size();
+  _total = 0;
+  _usable = 0;
+
+  // Build the tree in linear time, each node adds itself to its parent
+  _tree.assign(peers + 1, 0);
+  for (size_t i = 1; i <= peers; i++) {
+    _tree[i] += _weights[i - 1];
+    size_t parent = i + (i & (~i + 1));
+    if (parent <= peers) _tree[parent] += _tree[i];
+
+    _total += _weights[i - 1];
+    if (!_removed[i - 1]) _usable += 1;
+  }
+}
+
+void PeerSelector::update(size_t peer, uint64_t delta) {
+  _weights[peer] += delta;
+  _total += delta;
+  for (size_t i = peer + 1; i < _tree.size(); i += i & (~i + 1))
+    _tree[i] += delta;
+}
+
+size_t PeerSelector::find(uint64_t point) const {
+  const size_t size = _tree.size() - 1;
+  size_t step = 1;
+  while (step * 2 <= size) step *= 2;
+
+  // Descend the tree, skipping every subtree whose whole weight is not
+  // beyond `point`. Peers without weight are skipped the same way
+  size_t pos = 0;
+  for (; step > 0; step /= 2) {
+    if (pos + step <= size && _tree[pos + step] <= point) {
+      pos += step;
+      point -= _tree[pos];
+    }
+  }
+  return pos;
+}
+
+}  // namespace fur::download::peer_selector
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <vector>
+
+namespace fur::download::peer_selector {
+
+/// Picks peers at random with probability proportional to their weight. The
+/// weights are kept in a Fenwick tree, so that both changing a weight and
+/// picking a peer take O(log n) without copying anything, whatever the
+/// number of peers. Peers with no weight are never picked, and once removed
+/// a peer never gains weight again. Safe to use from many threads
+class PeerSelector {
+  /// Protects all the state below
+  mutable std::mutex _mutex;
+  /// Weight of each peer
+  std::vector<uint64_t> _weights;
+  /// Whether each peer has been removed
+  std::vector<bool> _removed;
+  /// Fenwick tree over `_weights`, 1-based: node `i` holds the sum of the
+  /// weights in `(i - lowbit(i), i]`
+  std::vector<uint64_t> _tree;
+  /// Sum of all weights
+  uint64_t _total;
+  /// Number of peers not removed
+  size_t _usable;
+
+ public:
+  /// Construct a selector with no peers
+  PeerSelector();
+
+  /// Replace all peers with `peers` peers, all with the same weight
+  void reset(size_t peers, uint64_t weight);
+
+  /// Change the weight of a peer, a peer with no weight is not picked until
+  /// it gains some. Ignored for unknown and removed peers
+  void set(size_t peer, uint64_t weight);
+
+  /// Change the weights of all peers at once in linear time. Removed peers
+  /// keep no weight, missing weights are left as they are
+  void assign(const std::vector<uint64_t>& weights);
+
+  /// Remove all the weight of a peer, so it is never picked again
+  void remove(size_t peer);
+
+  /// @return a peer with probability proportional to its weight, nothing if
+  /// no peer has any weight
+  [[nodiscard]] std::optional<size_t> pick(std::mt19937& gen) const;
+
+  /// @return the weight of each peer
+  [[nodiscard]] std::vector<uint64_t> weights() const;
+
+  /// @return number of peers not removed, some may have no weight for now
+  [[nodiscard]] size_t usable() const;
+
+ private:
+  /// Rebuild the tree and the totals from `_weights`, must be called with the
+  /// mutex locked
+  void build();
+
+  /// Add `delta`, modulo 2^64, to a weight and all the tree nodes covering
+  /// it, must be called with the mutex locked
+  void update(size_t peer, uint64_t delta);
+
+  /// Find the peer whose cumulative weight range contains `point`, which is
+  /// lower than the total weight. Must be called with the mutex locked
+  [[nodiscard]] size_t find(uint64_t point) const;
+};
+
+}  // namespace fur::download::peer_selector
@@ -0,0 +1,190 @@
+#include "download/peer_table.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace fur::download::peer_table {
+
+/// @return how much a measure of age `age` still counts, between 0 and 1
+static double fade(Clock::duration age, Clock::duration half_life) {
+  if (age <= Clock::duration::zero()) return 1;
+  return std::exp2(-std::chrono::duration<double>(age).count() /
+                   std::chrono::duration<double>(half_life).count());
+}
+
+/// @return the bytes per second expected from a peer, a piece taking a round
+/// trip before its blocks start to stream
+static double expected_rate(double throughput, double rtt, double failure_rate,
+                            size_t piece_length) {
+  if (piece_length == 0) return 0;
+  const auto length = static_cast<double>(piece_length);
+  return (1 - failure_rate) * length / (rtt + length / throughput);
+}
+
+PeerTable::PeerTable(QualityModel model) : _model{model}, _piece_length{0} {}
+
+void PeerTable::reset(size_t peers, size_t piece_length,
+                      Clock::time_point now) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _piece_length = piece_length;
+
+  const double prior_rtt =
+      std::chrono::duration<double>(_model.prior_rtt).count();
+  _throughput.assign(peers, static_cast<float>(_model.prior_throughput));
+  _rtt.assign(peers, static_cast<float>(prior_rtt));
+  _failure_rate.assign(peers, 0);
+  _updated.assign(peers, now);
+  _pieces.assign(peers, 0);
+  _failures.assign(peers, 0);
+  _connection_failures.assign(peers, 0);
+  _failed.assign(peers, now);
+  _retry.assign(peers, now);
+  _backoffs = {};
+
+  _selector.reset(peers, peers > 0 ? weight(0) : 1);
+}
+
+void PeerTable::record_piece(size_t peer, size_t bytes, Clock::duration rtt,
+                             Clock::duration transfer, Clock::time_point now) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (peer >= _pieces.size()) return;
+  decay(peer, now);
+
+  // Blocks stream once the first one arrives, a piece of a single block
+  // measures no streaming at all
+  const double rtt_seconds = std::chrono::duration<double>(rtt).count();
+  const double stream_seconds =
+      std::max(std::chrono::duration<double>(transfer - rtt).count(), 1e-3);
+  const double throughput = static_cast<double>(bytes) / stream_seconds;
+
+  const double w = _model.sample_weight;
+  _throughput[peer] += static_cast<float>(w * (throughput - _throughput[peer]));
+  _rtt[peer] += static_cast<float>(w * (rtt_seconds - _rtt[peer]));
+  _failure_rate[peer] -= static_cast<float>(w * _failure_rate[peer]);
+  _pieces[peer] += 1;
+
+  // The peer works, even if it failed in the meantime
+  _connection_failures[peer] = 0;
+  _retry[peer] = std::min(_retry[peer], now);
+
+  _selector.set(peer, weight(peer));
+}
+
+void PeerTable::record_failure(size_t peer, bool connection,
+                               Clock::time_point now) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (peer >= _failures.size()) return;
+  decay(peer, now);
+
+  const double w = _model.sample_weight;
+  _failure_rate[peer] += static_cast<float>(w * (1 - _failure_rate[peer]));
+  _failures[peer] += 1;
+  _failed[peer] = now;
+
+  // A peer backing off already stays so
+  if (!connection) {
+    _selector.set(peer, _retry[peer] > now ? 0 : weight(peer));
+    return;
+  }
+
+  // Double the backoff with each consecutive failure, up to the blacklist
+  const uint32_t failures = ++_connection_failures[peer];
+  Clock::duration backoff = _model.blacklist_time;
+  if (!blacklisted(peer)) {
+    const uint32_t doublings = std::min<uint32_t>(failures - 1, 20);
+    backoff = std::min(_model.backoff_base * (1 << doublings), backoff);
+  }
+
+  _retry[peer] = now + backoff;
+  _backoffs.emplace(_retry[peer], peer);
+  _selector.set(peer, 0);
+}
+
+void PeerTable::remove(size_t peer) { _selector.remove(peer); }
+
+void PeerTable::refresh(Clock::time_point now) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  std::vector<uint64_t> weights(_pieces.size());
+  for (size_t i = 0; i < weights.size(); i++) {
+    decay(i, now);
+    weights[i] = _retry[i] > now ? 0 : weight(i);
+  }
+  _selector.assign(weights);
+}
+
+std::optional<size_t> PeerTable::pick(std::mt19937& gen,
+                                      Clock::time_point now) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    while (!_backoffs.empty() && _backoffs.top().first <= now) {
+      auto [retry, peer] = _backoffs.top();
+      _backoffs.pop();
+      if (retry == _retry[peer]) _selector.set(peer, weight(peer));
+    }
+  }
+  return _selector.pick(gen);
+}
+
+std::vector<PeerStats> PeerTable::stats(Clock::time_point now) const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  const std::vector<uint64_t> weights = _selector.weights();
+  const double prior_rtt =
+      std::chrono::duration<double>(_model.prior_rtt).count();
+
+  // Same as `decay`, without changing the averages
+  std::vector<PeerStats> result;
+  result.reserve(_pieces.size());
+  for (size_t i = 0; i < _pieces.size(); i++) {
+    const double kept = fade(now - _updated[i], _model.half_life);
+    const double rtt = prior_rtt + (_rtt[i] - prior_rtt) * kept;
+
+    PeerStats stats{};
+    stats.throughput = _model.prior_throughput +
+                       (_throughput[i] - _model.prior_throughput) * kept;
+    stats.rtt = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::duration<double>(rtt));
+    stats.failure_rate = _failure_rate[i] * kept;
+    stats.pieces = _pieces[i];
+    stats.failures = _failures[i];
+    stats.connection_failures = _connection_failures[i];
+    if (_pieces[i] > 0 || _failures[i] > 0) stats.idle = now - _updated[i];
+    if (_failures[i] > 0) stats.since_failure = now - _failed[i];
+    if (_retry[i] > now) stats.backoff = _retry[i] - now;
+    stats.blacklisted = blacklisted(i);
+    stats.weight = i < weights.size() ? weights[i] : 0;
+    result.push_back(stats);
+  }
+  return result;
+}
+
+std::vector<uint64_t> PeerTable::weights() const {
+  return _selector.weights();
+}
+
+size_t PeerTable::usable() const { return _selector.usable(); }
+
+void PeerTable::decay(size_t peer, Clock::time_point now) {
+  const double kept = fade(now - _updated[peer], _model.half_life);
+  const double prior_rtt =
+      std::chrono::duration<double>(_model.prior_rtt).count();
+
+  _throughput[peer] = static_cast<float>(
+      _model.prior_throughput +
+      (_throughput[peer] - _model.prior_throughput) * kept);
+  _rtt[peer] = static_cast<float>(prior_rtt + (_rtt[peer] - prior_rtt) * kept);
+  _failure_rate[peer] = static_cast<float>(_failure_rate[peer] * kept);
+  _updated[peer] = std::max(_updated[peer], now);
+}
+
+bool PeerTable::blacklisted(size_t peer) const {
+  return _connection_failures[peer] >= _model.blacklist_failures;
+}
+
+uint64_t PeerTable::weight(size_t peer) const {
+  // Weights are in KiB per second, so that the slowest peers keep some
+  const double rate = expected_rate(_throughput[peer], _rtt[peer],
+                                    _failure_rate[peer], _piece_length);
+  return std::max<uint64_t>(1, static_cast<uint64_t>(rate / 1024));
+}
+
+}  // namespace fur::download::peer_table
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "config.hpp"
+#include "download/peer_selector.hpp"
+
+namespace fur::download::peer_table {
+
+using Clock = std::chrono::steady_clock;
+
+/// Parameters of the model estimating the quality of peers, and of how long
+/// they are left alone after their connection failed
+struct QualityModel {
+  /// Throughput, in bytes per second, assumed for peers never measured
+  double prior_throughput = config::PEER_PRIOR_THROUGHPUT;
+  /// Round trip time assumed for peers never measured
+  Clock::duration prior_rtt = config::PEER_PRIOR_RTT;
+  /// Weight of each new measure in the moving averages
+  double sample_weight = config::PEER_SAMPLE_WEIGHT;
+  /// Time after which a measure counts half
+  Clock::duration half_life = config::PEER_STATS_HALF_LIFE;
+  /// Backoff after a connection failure, doubled after each consecutive one
+  Clock::duration backoff_base = config::PEER_BACKOFF_BASE;
+  /// Consecutive connection failures after which a peer is blacklisted
+  uint32_t blacklist_failures = config::PEER_BLACKLIST_FAILURES;
+  /// Backoff of blacklisted peers, also the longest one
+  Clock::duration blacklist_time = config::PEER_BLACKLIST_TIME;
+};
+
+/// What is currently known about a peer
+struct PeerStats {
+  /// Rate at which blocks arrive once requested, in bytes per second
+  double throughput;
+  /// Time between a request and the arrival of its first block
+  std::chrono::microseconds rtt;
+  /// Share of the recent attempts that failed, between 0 and 1
+  double failure_rate;
+  /// Number of pieces received
+  uint32_t pieces;
+  /// Number of failed attempts
+  uint32_t failures;
+  /// Number of connection failures since the last piece
+  uint32_t connection_failures;
+  /// Time since the last piece or failure, nothing if there has been none
+  std::optional<Clock::duration> idle;
+  /// Time since the last failure, nothing if there has been none
+  std::optional<Clock::duration> since_failure;
+  /// Time left before the peer can be picked again, nothing if it can be
+  /// picked right away
+  std::optional<Clock::duration> backoff;
+  /// True if the peer failed so many times that it is left alone for long
+  bool blacklisted;
+  /// Weight given to the peer when picking, zero once removed
+  uint64_t weight;
+};
+
+/// Tracks the quality of the peers of a torrent and picks them accordingly.
+/// Each peer has exponentially weighted averages of its throughput, round
+/// trip time and failure rate, which decay back towards the prior as they
+/// age. A peer is picked with probability proportional to the rate at which
+/// it is expected to deliver pieces. After its connection fails, a peer is
+/// not picked for a backoff doubling with each consecutive failure, until it
+/// is blacklisted for a long time, so that unreachable peers stop wasting
+/// connection timeouts. The state of the peers is stored as a structure of
+/// arrays, so that rescoring them all touches little memory. Safe to use
+/// from many threads
+class PeerTable {
+  QualityModel _model;
+  /// Protects all the state below, except `_selector` which has its own
+  mutable std::mutex _mutex;
+  /// Length of the pieces that peers are expected to deliver
+  size_t _piece_length;
+
+  /// Throughput of each peer in bytes per second
+  std::vector<float> _throughput;
+  /// Round trip time of each peer in seconds
+  std::vector<float> _rtt;
+  /// Failure rate of each peer
+  std::vector<float> _failure_rate;
+  /// Last time each peer has been measured, or added
+  std::vector<Clock::time_point> _updated;
+  /// Number of pieces received from each peer
+  std::vector<uint32_t> _pieces;
+  /// Number of failed attempts with each peer
+  std::vector<uint32_t> _failures;
+  /// Number of connection failures of each peer since its last piece
+  std::vector<uint32_t> _connection_failures;
+  /// Last time each peer failed, if it ever did
+  std::vector<Clock::time_point> _failed;
+  /// When each peer can be picked again, in the past unless it backs off
+  std::vector<Clock::time_point> _retry;
+  /// Peers backing off, soonest retry first. Entries not matching `_retry`
+  /// anymore are stale and skipped
+  std::priority_queue<std::pair<Clock::time_point, size_t>,
+                      std::vector<std::pair<Clock::time_point, size_t>>,
+                      std::greater<>>
+      _backoffs;
+
+  /// Picks peers weighted by their expected rate
+  peer_selector::PeerSelector _selector;
+
+ public:
+  /// Construct a table with no peers
+  explicit PeerTable(QualityModel model = QualityModel{});
+
+  /// Replace all peers with `peers` peers never measured
+  /// @param piece_length length of the pieces of the torrent
+  void reset(size_t peers, size_t piece_length, Clock::time_point now);
+
+  /// Record a piece received from a peer
+  /// @param bytes length of the piece
+  /// @param rtt time between the first request and the first block
+  /// @param transfer time between the first request and the last block
+  void record_piece(size_t peer, size_t bytes, Clock::duration rtt,
+                    Clock::duration transfer, Clock::time_point now);
+
+  /// Record a failed attempt to get a piece from a peer
+  /// @param connection true if the connection failed or broke, rather than
+  /// the peer missing the piece or sending it corrupt. The peer then backs
+  /// off
+  void record_failure(size_t peer, bool connection, Clock::time_point now);
+
+  /// Remove a peer, so it is never picked again
+  void remove(size_t peer);
+
+  /// Score all peers again, those not measured for a while drift back
+  /// towards the prior
+  void refresh(Clock::time_point now);
+
+  /// Pick a peer with probability proportional to its expected rate, peers
+  /// whose backoff is over can be picked again
+  /// @return the peer, nothing if every peer is removed or backing off
+  [[nodiscard]] std::optional<size_t> pick(std::mt19937& gen,
+                                           Clock::time_point now);
+
+  /// @return what is currently known about each peer
+  [[nodiscard]] std::vector<PeerStats> stats(Clock::time_point now) const;
+
+  /// @return the weight of each peer, zero for removed peers
+  [[nodiscard]] std::vector<uint64_t> weights() const;
+
+  /// @return number of peers that have not been removed
+  [[nodiscard]] size_t usable() const;
+
+ private:
+  /// Move the averages of a peer towards the prior as much as their age
+  /// requires, must be called with the mutex locked
+  void decay(size_t peer, Clock::time_point now);
+
+  /// @return the weight of a peer from its averages, at least 1. Must be
+  /// called with the mutex locked
+  [[nodiscard]] uint64_t weight(size_t peer) const;
+
+  /// @return true if a peer is blacklisted, must be called with the mutex
+  /// locked
+  [[nodiscard]] bool blacklisted(size_t peer) const;
+};
+
+}  // namespace fur::download::peer_table
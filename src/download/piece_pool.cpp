@@ -0,0 +1,138 @@
+#include "download/piece_pool.hpp"
+
+#include <sys/mman.h>
+
+#include <new>
+#include <utility>
+
+namespace fur::download::piece_pool {
+
+/// Smallest size class, a single BitTorrent block
+const size_t MIN_SIZE_CLASS = 16 * 1024;
+/// Buffers at least this large are worth backing with huge pages
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+/// Smallest power of two not lower than `size`
+static size_t size_class(size_t size) {
+  size_t capacity = MIN_SIZE_CLASS;
+  while (capacity < size) capacity <<= 1;
+  return capacity;
+}
+
+PieceBuffer::PieceBuffer(PiecePool* pool, uint8_t* data, size_t size,
+                         size_t capacity)
+    : _pool{pool}, _data{data}, _size{size}, _capacity{capacity} {}
+
+PieceBuffer::PieceBuffer()
+    : _pool{nullptr}, _data{nullptr}, _size{0}, _capacity{0} {}
+
+PieceBuffer::~PieceBuffer() { reset(); }
+
+PieceBuffer::PieceBuffer(PieceBuffer&& o) noexcept
+    : _pool{std::exchange(o._pool, nullptr)},
+      _data{std::exchange(o._data, nullptr)},
+      _size{std::exchange(o._size, 0)},
+      _capacity{std::exchange(o._capacity, 0)} {}
+
+PieceBuffer& PieceBuffer::operator=(PieceBuffer&& o) noexcept {
+  std::swap(_pool, o._pool);
+  std::swap(_data, o._data);
+  std::swap(_size, o._size);
+  std::swap(_capacity, o._capacity);
+  return *this;
+}
+
+void PieceBuffer::reset() {
+  if (_pool != nullptr) _pool->release(_data, _capacity);
+  _pool = nullptr;
+  _data = nullptr;
+  _size = 0;
+  _capacity = 0;
+}
+
+PiecePool::PiecePool(size_t memory_cap, bool huge_pages)
+    : _memory_cap{memory_cap},
+      _huge_pages{huge_pages},
+      _allocated_bytes{0},
+      _idle_bytes{0},
+      _buffers_in_use{0} {}
+
+PiecePool::~PiecePool() {
+  for (auto& [capacity, buffers] : _idle)
+    for (uint8_t* data : buffers) munmap(data, capacity);
+}
+
+PieceBuffer PiecePool::acquire(size_t size) {
+  const size_t capacity = size_class(size);
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (true) {
+    // Reuse an idle buffer of the same class, its pages are already mapped
+    auto& idle = _idle[capacity];
+    if (!idle.empty()) {
+      uint8_t* data = idle.back();
+      idle.pop_back();
+      _idle_bytes -= capacity;
+      _buffers_in_use += 1;
+      return {this, data, size, capacity};
+    }
+
+    trim(capacity);
+    if (_allocated_bytes + capacity <= _memory_cap || _allocated_bytes == 0)
+      break;
+
+    // Everything is borrowed, wait for a buffer to come back
+    _returned.wait(lock);
+  }
+
+  // Map a new buffer without blocking other borrowers
+  _allocated_bytes += capacity;
+  _buffers_in_use += 1;
+  lock.unlock();
+
+  void* memory = mmap(nullptr, capacity, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    lock.lock();
+    _allocated_bytes -= capacity;
+    _buffers_in_use -= 1;
+    _returned.notify_all();
+    throw std::bad_alloc();
+  }
+
+#ifdef MADV_HUGEPAGE
+  // Only a hint, the kernel may ignore it
+  if (_huge_pages && capacity >= HUGE_PAGE_SIZE)
+    madvise(memory, capacity, MADV_HUGEPAGE);
+#endif
+
+  return {this, static_cast<uint8_t*>(memory), size, capacity};
+}
+
+PiecePoolStats PiecePool::stats() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return {_allocated_bytes, _idle_bytes, _buffers_in_use};
+}
+
+void PiecePool::release(uint8_t* data, size_t capacity) {
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle[capacity].push_back(data);
+    _idle_bytes += capacity;
+    _buffers_in_use -= 1;
+  }
+  _returned.notify_all();
+}
+
+void PiecePool::trim(size_t needed) {
+  for (auto& [capacity, buffers] : _idle) {
+    while (!buffers.empty() && _allocated_bytes + needed > _memory_cap) {
+      munmap(buffers.back(), capacity);
+      buffers.pop_back();
+      _idle_bytes -= capacity;
+      _allocated_bytes -= capacity;
+    }
+  }
+}
+
+}  // namespace fur::download::piece_pool
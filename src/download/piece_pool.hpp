@@ -0,0 +1,117 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace fur::download::piece_pool {
+
+class PiecePool;
+
+/// Memory holding the content of a single piece, borrowed from a `PiecePool`
+/// and given back to it when destroyed. The content is not initialized and
+/// the address is page aligned. Movable but not copyable, a `PieceBuffer`
+/// must not outlive its pool
+class PieceBuffer {
+  /// Pool owning the memory, nullptr if empty or moved from
+  PiecePool* _pool;
+  uint8_t* _data;
+  /// Requested size in bytes
+  size_t _size;
+  /// Size of the memory in bytes, the size class of the buffer
+  size_t _capacity;
+
+  friend class PiecePool;
+  PieceBuffer(PiecePool* pool, uint8_t* data, size_t size, size_t capacity);
+
+ public:
+  /// Construct an empty buffer
+  PieceBuffer();
+  ~PieceBuffer();
+
+  PieceBuffer(const PieceBuffer&) = delete;
+  PieceBuffer& operator=(const PieceBuffer&) = delete;
+  PieceBuffer(PieceBuffer&& o) noexcept;
+  PieceBuffer& operator=(PieceBuffer&& o) noexcept;
+
+  [[nodiscard]] uint8_t* data() { return _data; }
+  [[nodiscard]] const uint8_t* data() const { return _data; }
+  [[nodiscard]] size_t size() const { return _size; }
+  [[nodiscard]] bool empty() const { return _size == 0; }
+
+  [[nodiscard]] uint8_t* begin() { return _data; }
+  [[nodiscard]] uint8_t* end() { return _data + _size; }
+  [[nodiscard]] const uint8_t* begin() const { return _data; }
+  [[nodiscard]] const uint8_t* end() const { return _data + _size; }
+
+  /// Give the memory back to the pool, leaving the buffer empty
+  void reset();
+};
+
+/// Statistics about the memory managed by a `PiecePool`
+struct PiecePoolStats {
+  /// Bytes currently mapped, both borrowed and idle
+  size_t allocated_bytes;
+  /// Bytes mapped and waiting to be reused
+  size_t idle_bytes;
+  /// Number of buffers currently borrowed
+  size_t buffers_in_use;
+};
+
+/// Recycles the memory of pieces, so that downloading a piece doesn't
+/// allocate, zero-fill and fault in megabytes of fresh memory every time.
+/// Buffers are grouped in power of two size classes and mapped directly with
+/// `mmap`, optionally backed by transparent huge pages. The total memory is
+/// capped: when the cap is reached idle buffers of other sizes are unmapped,
+/// and if that is not enough borrowers wait for a buffer to be returned
+class PiecePool {
+  /// Maximum number of bytes mapped at once
+  const size_t _memory_cap;
+  /// True to ask the kernel for huge pages
+  const bool _huge_pages;
+
+  /// Protects all the state below
+  mutable std::mutex _mutex;
+  /// Signals borrowers waiting for memory that a buffer has been returned
+  std::condition_variable _returned;
+
+  /// Idle buffers of each size class
+  std::map<size_t, std::vector<uint8_t*>> _idle;
+  size_t _allocated_bytes;
+  size_t _idle_bytes;
+  size_t _buffers_in_use;
+
+ public:
+  /// @param memory_cap maximum number of bytes mapped at once. A single
+  /// buffer larger than the cap is still allowed when nothing else is mapped
+  /// @param huge_pages true to back large buffers with huge pages
+  explicit PiecePool(size_t memory_cap, bool huge_pages = false);
+
+  /// Unmaps all buffers, none must be borrowed anymore
+  ~PiecePool();
+
+  PiecePool(const PiecePool&) = delete;
+  PiecePool& operator=(const PiecePool&) = delete;
+
+  /// Borrow a buffer of `size` bytes, blocks while the memory cap is reached.
+  /// Throws `std::bad_alloc` if the memory cannot be mapped
+  PieceBuffer acquire(size_t size);
+
+  /// @return statistics about the memory of the pool
+  [[nodiscard]] PiecePoolStats stats() const;
+
+ private:
+  friend class PieceBuffer;
+
+  /// Make a buffer available again
+  void release(uint8_t* data, size_t capacity);
+
+  /// Unmap idle buffers until `needed` more bytes fit in the cap, must be
+  /// called with the mutex locked
+  void trim(size_t needed);
+};
+
+}  // namespace fur::download::piece_pool
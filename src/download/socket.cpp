@@ -5,6 +5,10 @@
 #include "log/logger.hpp"
 
 namespace fur::download::socket {
+Socket::Socket(asio::ip::tcp::socket::native_handle_type handle) {
+  engine->socket.assign(asio::ip::tcp::v4(), handle);
+}
+
 Outcome<SocketError> Socket::connect(uint32_t ip, uint16_t port,
                                      timeout timeout) {
   asio::ip::tcp::endpoint endpoint{asio::ip::address_v4{ip},
@@ -43,7 +47,7 @@ Outcome<SocketError> Socket::connect(uint32_t ip, uint16_t port,
   return Outcome<SocketError>::OK({});
 }
 
-bool Socket::is_open() { return engine->socket.is_open(); }
+bool Socket::is_open() const { return engine->socket.is_open(); }
 
 Outcome<SocketError> Socket::write(const std::vector<uint8_t>& buf,
                                    timeout timeout) {
@@ -89,6 +93,13 @@ Result<std::vector<uint8_t>, SocketError> Socket::read(uint32_t n,
   std::vector<uint8_t> buf{};
   buf.resize(n);
 
+  auto outcome = read_into(buf.data(), n, timeout);
+  if (!outcome.valid()) return Result::ERROR(SocketError(outcome.error()));
+  return Result::OK(std::move(buf));
+}
+
+Outcome<SocketError> Socket::read_into(uint8_t* dest, size_t n,
+                                       timeout timeout) {
   // Error code set by the socket's callback.
   std::error_code ec;
 
@@ -103,7 +114,7 @@ Result<std::vector<uint8_t>, SocketError> Socket::read(uint32_t n,
   // runtime is able to complete the operation within the timeout bounds, we can
   // stand assured that all bytes have been read.
   asio::async_read(
-      engine->socket, asio::buffer(buf),
+      engine->socket, asio::buffer(dest, n),
       [&](const std::error_code& in_ec, std::size_t) { ec = in_ec; });
 
   run(timeout);
@@ -116,13 +127,13 @@ Result<std::vector<uint8_t>, SocketError> Socket::read(uint32_t n,
 
     switch (ec.value()) {
       case asio::error::operation_aborted:
-        return Result::ERROR(SocketError::Timeout);
+        return Outcome<SocketError>::ERROR(SocketError::Timeout);
       default:
-        return Result::ERROR(SocketError::Other);
+        return Outcome<SocketError>::ERROR(SocketError::Other);
     }
   }
 
-  return Result::OK(std::move(buf));
+  return Outcome<SocketError>::OK({});
 }
 
 void Socket::run(timeout timeout) {
@@ -161,6 +172,17 @@ void Socket::run(timeout timeout) {
   }
 }
 
+size_t Socket::available() const {
+  // A broken socket has nothing to read, the next read reports the error
+  std::error_code ec;
+  size_t bytes = engine->socket.available(ec);
+  return ec ? 0 : bytes;
+}
+
+asio::ip::tcp::socket::native_handle_type Socket::release() {
+  return engine->socket.release();
+}
+
 Outcome<SocketError> Socket::close() {
   try {
     // Ask the socket to cancel any pending task.
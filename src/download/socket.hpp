@@ -31,17 +31,34 @@ struct AsioEngine {
 /// any more threads.
 class Socket {
  public:
+  /// Construct a socket that is not connected yet
+  Socket() = default;
+
+  /// Take over a socket connected elsewhere, for example on another
+  /// `asio::io_context`
+  explicit Socket(asio::ip::tcp::socket::native_handle_type handle);
+
   /// Attempt connecting to a TCP server within the given timeout.
   Outcome<SocketError> connect(uint32_t ip, uint16_t port, timeout timeout);
 
   /// Returns `true` if the socket is open
-  bool is_open();
+  bool is_open() const;
 
   /// Attempt to write all the bytes in `buf` to the socket with the given
   /// timeout.
   Outcome<SocketError> write(const std::vector<uint8_t>& buf, timeout timeout);
   /// Attempt to readn `n` bytes from the socket with the given timeout.
   Result<std::vector<uint8_t>, SocketError> read(uint32_t n, timeout timeout);
+  /// Same as `read` but the bytes are written to `dest`, which must have room
+  /// for `n` bytes, so that the caller can reuse its buffer.
+  Outcome<SocketError> read_into(uint8_t* dest, size_t n, timeout timeout);
+
+  /// Returns the number of bytes that can be read without blocking
+  size_t available() const;
+
+  /// Give up the socket without closing it, so that it can be taken over
+  /// elsewhere. This `Socket` is left closed.
+  asio::ip::tcp::socket::native_handle_type release();
 
   /// Close the socket
   Outcome<SocketError> close();
@@ -1,5 +1,8 @@
 #include <bencode/bencode_parser.hpp>
+#include <chrono>
 #include <config.hpp>
+#include <disk/recheck.hpp>
+#include <disk/resume.hpp>
 #include <fstream>
 #include <furrent.hpp>
 #include <iostream>
@@ -7,85 +10,103 @@
 #include <platform/io.hpp>
 #include <policy/policy.hpp>
 #include <random>
+#include <unordered_set>
 
 namespace fur {
 
-PieceTask::PieceTask() : _data{std::nullopt}, tid{0} {}
+PieceTask::PieceTask()
+    : _data{std::nullopt}, tid{0}, index{0}, used_peer{0} {}
 
 /// Constructs a new piece task
-PieceTask::PieceTask(TorrentID tid, Piece piece, const TorrentFile& descriptor)
+PieceTask::PieceTask(TorrentID tid, size_t index,
+                     std::shared_ptr<const TorrentFile> descriptor,
+                     std::shared_ptr<const PieceLayout> layout)
     : _data{std::nullopt},
       tid{tid},
-      piece{std::move(piece)},
-      descriptor{descriptor} {}
-
-/// Process piece, downloads it from a peer and saves it to file
-PieceTaskStats PieceTask::process(const peer::Peer& peer) {
+      index{index},
+      descriptor{std::move(descriptor)},
+      layout{std::move(layout)},
+      used_peer{0} {}
+
+/// Process piece, downloads it from a peer
+PieceTaskStats PieceTask::process(
+    download::downloader::Downloader& downloader) {
   PieceTaskStats stats{};
-  stats.completed = false;
-
-  if (download(peer) && save()) {
-    stats.completed = true;
-  }
-
+  auto outcome = download(downloader);
+  stats.completed = outcome.valid();
+  if (!outcome.valid()) stats.error = outcome.error();
   return stats;
 }
 
 /// Download from a suitable peer
-bool PieceTask::download(const peer::Peer& peer) {
+auto PieceTask::download(download::downloader::Downloader& downloader)
+    -> util::Outcome<download::downloader::DownloaderError> {
+  using Outcome = util::Outcome<download::downloader::DownloaderError>;
   auto logger = spdlog::get("custom");
   auto clock_beg = std::chrono::high_resolution_clock::now();
 
-  download::downloader::Downloader d(descriptor, peer);
-  auto download = d.try_download(piece);
+  const peer::Peer& peer = downloader.remote();
+  auto download = downloader.try_fetch(layout->piece(index));
   if (download.valid()) {
     auto clock_end = std::chrono::high_resolution_clock::now();
     auto clock_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
         clock_end - clock_beg);
 
-    logger->info("Downloaded piece [{:4}] of T{} from {} ({} ms)", piece.index,
-                 tid, peer.address(), clock_elapsed.count());
+    logger->info("Downloaded piece [{:4}] of T{} from {} ({} ms)", index, tid,
+                 peer.address(), clock_elapsed.count());
 
-    std::optional<download::Downloaded> data(*download);
-    _data.swap(data);
-    return true;
+    transfer = {download->content.size(), download->rtt, download->transfer};
+    _data.emplace(std::move(*download));
+    return Outcome::OK({});
   }
 
   logger->trace("Error while downloading piece [{:4}] of T{} from {}",
-                piece.index, tid, peer.address());
+                index, tid, peer.address());
+  return Outcome::ERROR(
+      download::downloader::DownloaderError(download.error()));
+}
 
-  // TODO: handle error!
-  return false;
+/// Check the downloaded piece against its hash
+bool PieceTask::verify() {
+  if (!_data.has_value()) return false;
+  return download::verify(*_data, *descriptor);
 }
 
-/// Save to file
-bool PieceTask::save() const {
+/// Hand the downloaded piece to the write-behind layer
+bool PieceTask::save(disk::WriteBehind& writer) {
   auto logger = spdlog::get("custom");
 
-  // Write every subpiece
-  for (const auto& subpiece : piece.subpieces) {
-    const std::string filepath =
-        descriptor.folder_name + '/' + subpiece.filepath;
-    if (!fur::platform::io::write_bytes(filepath, _data.value().content,
-                                        subpiece.file_offset)
-             .valid()) {
-      logger->error("Error while saving piece [{:4}] of T{} to {}", piece.index,
-                    tid, piece.subpieces[0].filepath);
-
-      return false;
-    }
-  }
+  if (!_data.has_value()) return false;
 
-  logger->info("Saved piece [{:4}] of T{} to {}", piece.index, tid,
-               piece.subpieces[0].filepath);
+  writer.push(tid, descriptor->folder_name, layout, index,
+              std::move(_data->content));
+  _data.reset();
+
+  logger->info("Queued piece [{:4}] of T{} for writing to {}", index, tid,
+               descriptor->folder_name);
   return true;
 }
 
 // ======================================================================================
 
-Furrent::Furrent() 
-: _descriptor_next_uid{0u}, _download_folder{"."}
-{
+Furrent::Furrent()
+    : _descriptor_next_uid{0u},
+      _download_folder{"."},
+      _closing{false},
+      _buffers{config::PIECE_POOL_MEMORY, config::PIECE_POOL_HUGE_PAGES},
+      _connections{{config::CONNECT_HALF_OPEN, config::CONNECTIONS_MAX,
+                    config::CONNECTIONS_PER_TORRENT, config::CONNECT_TIMEOUT,
+                    config::UNCHOKE_TIMEOUT},
+                   _buffers,
+                   [this](TorrentID tid) { return pick_connection(tid); },
+                   [this](TorrentID tid, size_t peer_index) {
+                     connection_failed(tid, peer_index);
+                   }},
+      _writer{config::WRITE_BEHIND_MEMORY, config::WRITE_BEHIND_DELAY,
+              [this](TorrentID tid, size_t index, bool success) {
+                piece_written(tid, index, success);
+              },
+              config::DIRECT_IO} {
   // Default global logger
   auto logger = spdlog::get("custom");
 
@@ -103,11 +124,47 @@ Furrent::Furrent()
 
   _workers.launch(std::bind(&Furrent::thread_main, this, _1, _2, _3),
                   threads_cnt);
+
+  logger->info("Launching hashing threads (hashers: {})",
+               config::HASHING_THREADS);
+  _hashers.launch(std::bind(&Furrent::hashing_main, this, _1, _2, _3),
+                  config::HASHING_THREADS);
 }
 
 Furrent::~Furrent() {
+  // Checks in progress are stopped, their torrents are checked again on the
+  // next start
+  _closing = true;
+  std::vector<std::thread> checkers;
+  {
+    std::lock_guard<std::mutex> lock(_checkers_mtx);
+    for (auto& [tid, checker] : _checkers)
+      checkers.push_back(std::move(checker));
+    _checkers.clear();
+  }
+  for (auto& checker : checkers) checker.join();
+
   _tasks.begin_skip_waiting();
   _workers.terminate();
+
+  // Pieces already downloaded are verified and written before stopping
+  _verifications.wait_empty();
+  _verifications.begin_skip_waiting();
+  _hashers.terminate();
+
+  // Persist the progress of every torrent once all its pieces are on disk,
+  // the lock is not held while waiting for the writer
+  std::vector<TorrentID> tids;
+  {
+    std::shared_lock<std::shared_mutex> lock(_mtx);
+    for (const auto& item : _torrents) tids.push_back(item.first);
+  }
+  for (TorrentID tid : tids) {
+    _writer.flush(tid);
+
+    std::shared_lock<std::shared_mutex> lock(_mtx);
+    save_resume(_torrents[tid]);
+  }
 }
 
 auto Furrent::set_download_folder(const std::string& folder) -> Result<Empty> {
@@ -138,19 +195,28 @@ auto Furrent::set_download_folder(const std::string& folder) -> Result<Empty> {
 
 const size_t THREAD_TASK_PROCESS_MAX_TRY = 50;
 
-/// Print the peers distribution of a torrent
+/// Longest time a worker waits for a connection before moving on, the piece
+/// going back to the queue
+const auto THREAD_CONNECTION_WAIT = std::chrono::milliseconds(500);
+
+/// Print the peers distribution of a torrent, as the share of pieces each
+/// peer is expected to be picked for along with its measured quality
 static void thread_print_torrent_stats(
-    std::mt19937& gen, PieceTask& task, const std::vector<peer::Peer>& peers,
-    std::discrete_distribution<size_t>& distr) {
-  std::vector<size_t> rolls(peers.size());
-  for (int i = 0; i < 10000; i++) rolls[distr(gen)] += 1;
+    const PieceTask& task, const std::vector<peer::Peer>& peers,
+    const std::vector<download::peer_table::PeerStats>& stats) {
+  uint64_t total = 0;
+  for (const auto& peer : stats) total += peer.weight;
 
   std::stringstream ss;
-  for (size_t i = 0; i < peers.size(); i++) {
+  for (size_t i = 0; i < peers.size() && i < stats.size(); i++) {
+    size_t stars = total == 0 ? 0 : stats[i].weight * 10 * peers.size() / total;
     ss.width(30);
     ss << std::right << peers[i].address();
     ss.width(0);
-    ss << " : " << std::string(rolls[i] * peers.size() / 1000, '*');
+    ss << fmt::format(" : {:8.1f} KiB/s {:6} ms {:3.0f}% failed ",
+                      stats[i].throughput / 1024, stats[i].rtt.count() / 1000,
+                      stats[i].failure_rate * 100);
+    ss << std::string(stars, '*');
     ss << std::endl;
   }
 
@@ -162,18 +228,12 @@ void Furrent::thread_main(mt::Runner runner, WorkerState& state, size_t index) {
   // Default global logger
   auto logger = spdlog::get("custom");
 
-  // Random generator for each thread
-  thread_local std::random_device rng;
-  thread_local std::mt19937 gen(rng());
-
   policy::LIFOPolicy<PieceTask> piece_policy;
   while (runner.alive()) {
     // Try to extract
     auto extraction = _tasks.try_extract(piece_policy);
     if (extraction.valid()) {
-      PieceTask task = *extraction;
-      std::discrete_distribution<size_t> peers_distribution;
-      std::vector<peer::Peer> peers;
+      PieceTask task = std::move(*extraction);
 
       // TODO: update peers if necessary, for now peers are constant!
       {
@@ -185,52 +245,85 @@ void Furrent::thread_main(mt::Runner runner, WorkerState& state, size_t index) {
         // task to queue again
         if (torrent.state.load(std::memory_order_relaxed) ==
             TorrentState::Paused) {
-          _tasks.emplace(task.tid, task.piece, torrent.descriptor());
+          _tasks.emplace(task.tid, task.index, task.descriptor, task.layout);
           continue;
         }
-
-        // Generate peers score distribution
-        peers_distribution = torrent.distribution();
-        peers = torrent.peers();
       }
 
       size_t cur_try = 0;
 
       bool success = false;
+      bool waiting = false;
       while (!success && cur_try < THREAD_TASK_PROCESS_MAX_TRY) {
-        size_t peer_index = peers_distribution(gen);
-        PieceTaskStats stats = task.process(peers[peer_index]);
+        // Take a connection to a peer that may have the piece, waiting for
+        // the first one to be established if none is ready
+        auto connection =
+            _connections.acquire(task.tid, task.index, THREAD_CONNECTION_WAIT);
+        if (!connection) {
+          waiting = true;
+          break;
+        }
+
+        cur_try += 1;
+        PieceTaskStats stats = task.process(*connection->downloader);
         if (stats.completed) {
           state.piece_processed += 1;
           success = true;
 
-          // Lock against writes to the _torrents map
-          std::shared_lock<std::shared_mutex> lock(_mtx);
-          Torrent& torrent = _torrents[task.tid];
+          // Verification and saving happen on the hashing threads, this
+          // worker moves on to the next piece right away
+          task.used_peer = connection->index;
+          _connections.release(std::move(*connection));
+          _verifications.insert(std::move(task));
+          break;
+        }
+
+        // The connection manager waits for the peer to unchoke us, the piece
+        // goes back to the queue to be resumed then, or by another peer
+        if (stats.error == download::downloader::DownloaderError::Choked) {
+          _connections.park(std::move(*connection));
+          waiting = true;
+          break;
+        }
 
-          // Update score of used peer
-          torrent.atomic_add_peer_score(peer_index);
-          size_t processed =
-              torrent.pieces_processed.fetch_add(1, std::memory_order_relaxed);
+        // Peers missing the piece are fine, others are left alone for a while
+        // and their connection is dropped
+        const bool broken =
+            stats.error != download::downloader::DownloaderError::MissingPiece;
+        {
+          std::shared_lock<std::shared_mutex> lock(_mtx);
+          _torrents[task.tid].atomic_record_peer_failure(connection->index,
+                                                         broken);
+        }
+        if (broken)
+          _connections.discard(std::move(*connection));
+        else
+          _connections.release(std::move(*connection));
+      }
+      if (success) continue;
 
-          // Show peers score distribution every 100 pieces processed
-          if (processed % 100 == 0)
-            thread_print_torrent_stats(gen, task, peers, peers_distribution);
+      {
+        std::shared_lock<std::shared_mutex> lock(_mtx);
+        const Torrent& torrent = _torrents[task.tid];
 
-          // Change state to completed if there are no more pieces to process
-          if (processed == torrent.descriptor().pieces_count)
-            torrent.state.exchange(TorrentState::Completed,
-                                   std::memory_order_relaxed);
+        // Tasks of torrents stopped in the meantime are dropped
+        TorrentState torrent_state =
+            torrent.state.load(std::memory_order_relaxed);
+        if (torrent_state != TorrentState::Downloading &&
+            torrent_state != TorrentState::Paused)
+          continue;
 
-          break;
+        // No connection is ready yet, all peers are backing off or choking us
+        if (waiting && torrent.usable_peers() > 0) {
+          _tasks.emplace(task.tid, task.index, task.descriptor, task.layout);
+          continue;
         }
       }
 
-      if (!success) {
-        logger->warn("Unable to process piece of T[{}], setting error!",
-                     task.tid);
-        torrent_error(task.tid);
-      }
+      // Every peer has been banned or failed
+      logger->warn("Unable to process piece of T[{}], setting error!",
+                   task.tid);
+      torrent_error(task.tid);
     }
 
     // Extraction failure or no more elements
@@ -256,11 +349,122 @@ void Furrent::thread_main(mt::Runner runner, WorkerState& state, size_t index) {
   }
 }
 
-bool Furrent::prepare_torrent_files(TorrentFile& descriptor) {
+void Furrent::hashing_main(mt::Runner runner, HasherState& state,
+                           size_t index) {
+  // Default global logger
+  auto logger = spdlog::get("custom");
+
+  policy::FIFOPolicy<PieceTask> piece_policy;
+  while (runner.alive()) {
+    auto extraction = _verifications.try_extract(piece_policy);
+    if (!extraction.valid()) {
+      _verifications.wait_work();
+      continue;
+    }
+
+    PieceTask task = std::move(*extraction);
+    state.pieces_verified += 1;
+
+    if (task.verify()) {
+      task.save(_writer);
+      piece_verified(task);
+      continue;
+    }
+
+    // A corrupt piece is downloaded again, unless its torrent has been
+    // stopped in the meantime. Pieces come from a single peer, which takes
+    // all the blame
+    logger->warn("hasher {:02d} found piece [{:4}] of T{} corrupt", index,
+                 task.index, task.tid);
+
+    std::shared_lock<std::shared_mutex> lock(_mtx);
+    Torrent& torrent = _torrents[task.tid];
+    torrent.atomic_record_peer_failure(task.used_peer, false);
+    if (torrent.atomic_add_peer_strike(task.used_peer))
+      logger->warn("Banned {} from T{} after {} corrupt pieces",
+                   torrent.peer_at(task.used_peer).address(), task.tid,
+                   config::PEER_MAX_STRIKES);
+
+    TorrentState torrent_state = torrent.state.load(std::memory_order_relaxed);
+    if (torrent_state == TorrentState::Downloading ||
+        torrent_state == TorrentState::Paused)
+      _tasks.emplace(task.tid, task.index, task.descriptor, task.layout);
+  }
+}
+
+void Furrent::piece_verified(const PieceTask& task) {
+  bool completed = false;
+  {
+    // Lock against writes to the _torrents map
+    std::shared_lock<std::shared_mutex> lock(_mtx);
+    Torrent& torrent = _torrents[task.tid];
+
+    // Update score of used peer
+    torrent.atomic_record_peer_piece(task.used_peer, task.transfer.bytes,
+                                     task.transfer.rtt, task.transfer.transfer);
+    size_t processed =
+        torrent.pieces_processed.fetch_add(1, std::memory_order_relaxed);
+
+    // Every 100 pieces processed peers not heard of for a while are scored
+    // again, and the distribution is shown
+    if (processed % 100 == 0) {
+      torrent.refresh_peer_scores();
+      thread_print_torrent_stats(task, torrent.peers(), torrent.peer_stats());
+    }
+
+    completed = processed + 1 == torrent.descriptor().pieces_count;
+  }
+
+  // Change state to completed if there are no more pieces to process, once
+  // all of them have reached the disk. The lock is not held while waiting for
+  // the writer
+  if (completed) {
+    _connections.remove_torrent(task.tid);
+    _writer.flush(task.tid);
+
+    std::shared_lock<std::shared_mutex> lock(_mtx);
+    Torrent& torrent = _torrents[task.tid];
+    save_resume(torrent);
+    TorrentState expected = TorrentState::Downloading;
+    torrent.state.compare_exchange_strong(expected, TorrentState::Completed);
+  }
+}
+
+auto Furrent::prepare_torrent_files(TorrentFile& descriptor,
+                                    platform::io::Preallocation preallocation)
+    -> Result<std::optional<download::bitfield::Bitfield>> {
   using namespace fur::platform;  // For IO operations
+  using Prepared = Result<std::optional<download::bitfield::Bitfield>>;
+
+  auto logger = spdlog::get("custom");
 
   std::string torrent_base_path = _download_folder + '/' + descriptor.name;
   auto existence = io::exists(torrent_base_path);
+
+  // Continue a previous download of the same torrent, its files are already
+  // in place. If the resume data is missing or stale but all files have the
+  // expected size, the data on disk is checked instead
+  if (existence.valid() && *existence) {
+    auto stamps = disk::stamp_files(torrent_base_path, descriptor);
+    if (stamps.has_value()) {
+      auto loading = disk::load_resume(disk::resume_path(torrent_base_path));
+      if (loading.valid() &&
+          disk::resume_matches(*loading, descriptor, *stamps)) {
+        descriptor.folder_name = torrent_base_path;
+        return Prepared::OK(std::move(loading->completed));
+      }
+
+      bool in_place = true;
+      for (size_t i = 0; i < descriptor.files.size(); i++)
+        if ((*stamps)[i].length != descriptor.files[i].length) in_place = false;
+      if (in_place) {
+        logger->warn("Resume data of T[{}] in {} is missing or stale",
+                     descriptor.name, torrent_base_path);
+        descriptor.folder_name = torrent_base_path;
+        return Prepared::OK(std::nullopt);
+      }
+    }
+  }
   
   const int MAX_COPY_ATTEMPTS = 10;
   int attempts = 0;
@@ -274,45 +478,61 @@ bool Furrent::prepare_torrent_files(TorrentFile& descriptor) {
 
   // If we tried to many times to generate new folders copy
   if (attempts > MAX_COPY_ATTEMPTS) 
-    return false;
+    return Prepared::ERROR(Error::LoadingTorrentFailed);
 
   // Create output directory
   auto torrent_dirpath = io::create_directories(torrent_base_path);
   if (!torrent_dirpath.valid())
-    return false;
+    return Prepared::ERROR(Error::LoadingTorrentFailed);
 
-  // Create output files
-  bool must_cleanup = false;
   descriptor.folder_name = *torrent_dirpath;
+
+  // Collect all output files and the distinct folders containing them, so
+  // that each folder is created only once even with thousands of files
+  std::vector<io::FileSpec> files;
+  std::unordered_set<std::string> directories;
+  files.reserve(descriptor.files.size());
   for (const auto& file : descriptor.files) {
+    std::string filepath = descriptor.folder_name + '/' + file.filename();
+    if (file.filepath.size() > 1)
+      directories.insert(filepath.substr(0, filepath.find_last_of('/')));
+    files.push_back({std::move(filepath), file.length});
+  }
 
-    // Create nested folders
-    auto file_dirpath = io::create_directories(descriptor.folder_name + '/' + file.filename(), true);
-    if (!file_dirpath.valid()) {
+  // Create nested folders
+  bool must_cleanup = false;
+  for (const auto& directory : directories) {
+    if (!io::create_directories(directory).valid()) {
       must_cleanup = true;
       break;
     }
+  }
 
-    // Create single output file
-    std::string filepath = *file_dirpath + '/' + file.filepath.back();
-    auto creation = io::touch(filepath, file.length);
+  // Create output files
+  if (!must_cleanup) {
+    auto creation = io::touch_all(files, preallocation);
     if (!creation.valid()) {
+      if (creation.error() == io::IOError::NoSpaceLeft)
+        logger->error("Not enough space to allocate T[{}] in {}",
+                      descriptor.name, descriptor.folder_name);
       must_cleanup = true;
-      break;
     }
   }
 
   // Remove created content if we failed to create all files
   if (must_cleanup) {
     io::remove(descriptor.folder_name);
-    return false;
+    return Prepared::ERROR(Error::LoadingTorrentFailed);
   }
 
-  return true;
+  return Prepared::OK(download::bitfield::Bitfield(
+      static_cast<uint32_t>(descriptor.piece_hashes.size())));
 }
 
 /// Begin download of a torrent
-auto Furrent::add_torrent(const std::string& filename) -> Result<TorrentID> {
+auto Furrent::add_torrent(const std::string& filename,
+                          platform::io::Preallocation preallocation)
+    -> Result<TorrentID> {
   auto logger = spdlog::get("custom");
 
   TorrentID tid = _descriptor_next_uid;
@@ -322,37 +542,48 @@ auto Furrent::add_torrent(const std::string& filename) -> Result<TorrentID> {
   auto reading = fur::platform::io::load_file_text(filename);
   if (reading.valid()) {
     // Parse content
-    auto parser = fur::bencode::BencodeParser();
-    auto betree = parser.decode(*reading);
-    if (betree.valid()) {
+    auto parsing = TorrentFile::parse(*reading);
+    if (parsing.valid()) {
       // Create new torrent object and mapped files
-      TorrentFile descriptor(*(*betree));  // WTF IS THIS
-      if (!prepare_torrent_files(descriptor))
+      TorrentFile& descriptor = *parsing;
+      auto prepared = prepare_torrent_files(descriptor, preallocation);
+      if (!prepared.valid())
         return Result<TorrentID>::ERROR(Error::LoadingTorrentFailed);
 
       logger->info("Announcing T{} to tracker at {}", tid,
                    descriptor.announce_url);
 
-      // Lock against concurrent read/write of the _torrents map
-      std::unique_lock<std::shared_mutex> lock(_mtx);
-      _torrents.try_emplace(tid, tid, descriptor);
-      Torrent& torrent = _torrents[tid];
-
-      // Popolate peers
-      std::stringstream ss;
-      ss << "Peers:\n";
-      for (peer::Peer& peer : torrent.peers())
-        ss << "  " << peer.address() << "\n";
-      logger->info("{}", ss.str());
-
-      // Create a task for each piece
-      logger->info("Generating {} pieces for T{} ", descriptor.pieces_count,
-                   tid);
-      std::vector<Piece> pieces = torrent.pieces();
-      for (Piece& piece : pieces)
-        _tasks.emplace(tid, piece, torrent.descriptor());
-
-      torrent.state.exchange(TorrentState::Downloading);
+      {
+        // Lock against concurrent read/write of the _torrents map
+        std::unique_lock<std::shared_mutex> lock(_mtx);
+        _torrents.try_emplace(tid, tid, descriptor, std::move(*prepared));
+        Torrent& torrent = _torrents[tid];
+
+        // Popolate peers
+        std::stringstream ss;
+        ss << "Peers:\n";
+        for (peer::Peer& peer : torrent.peers())
+          ss << "  " << peer.address() << "\n";
+        logger->info("{}", ss.str());
+
+        if (torrent.completed().has_value()) {
+          // Peers are picked under the lock, which must be released first
+          lock.unlock();
+          start_torrent(tid);
+          return Result<TorrentID>::OK(std::move(tid));
+        }
+      }
+
+      // The torrent stays loading while the data on disk is checked, without
+      // blocking the caller. Checkers done since the last one are joined
+      join_checkers(std::nullopt);
+      std::lock_guard<std::mutex> lock(_checkers_mtx);
+      auto check = [this, tid] {
+        check_torrent(tid);
+        std::lock_guard<std::mutex> done_lock(_checkers_mtx);
+        _checkers_done.push_back(tid);
+      };
+      _checkers.emplace(tid, std::thread(check));
       return Result<TorrentID>::OK(std::move(tid));
     }
   }
@@ -361,10 +592,124 @@ auto Furrent::add_torrent(const std::string& filename) -> Result<TorrentID> {
   return Result<TorrentID>::ERROR(Error::LoadingTorrentFailed);
 }
 
+void Furrent::check_torrent(TorrentID tid) {
+  auto logger = spdlog::get("custom");
+
+  std::shared_ptr<const TorrentFile> descriptor;
+  std::shared_ptr<const PieceLayout> layout;
+  {
+    std::shared_lock<std::shared_mutex> lock(_mtx);
+    const Torrent& torrent = _torrents[tid];
+    descriptor = torrent.shared_descriptor();
+    layout = torrent.layout();
+  }
+
+  logger->info("Rechecking T{} in {}", tid, descriptor->folder_name);
+
+  // The check stops early if the torrent is stopped or furrent is closing,
+  // progress is logged every 10%
+  bool stopped = false;
+  auto progress = [&](size_t checked, size_t total) {
+    if (checked * 10 / total != (checked - 1) * 10 / total)
+      logger->info("Rechecked {}/{} pieces of T{}", checked, total, tid);
+
+    std::shared_lock<std::shared_mutex> lock(_mtx);
+    Torrent& torrent = _torrents[tid];
+    torrent.pieces_checked = static_cast<uint32_t>(checked);
+    stopped = _closing ||
+              torrent.state.load(std::memory_order_relaxed) !=
+                  TorrentState::Loading;
+    return !stopped;
+  };
+  auto completed =
+      disk::recheck(descriptor->folder_name, *descriptor, *layout, progress);
+  if (stopped) {
+    logger->info("Recheck of T{} stopped", tid);
+    return;
+  }
+
+  // The result is saved right away, so that the check isn't repeated
+  {
+    std::shared_lock<std::shared_mutex> lock(_mtx);
+    Torrent& torrent = _torrents[tid];
+    torrent.set_completed(std::move(completed));
+    save_resume(torrent);
+  }
+  start_torrent(tid);
+}
+
+void Furrent::join_checkers(std::optional<TorrentID> tid) {
+  // Checkers are joined without the lock, which they take once done
+  std::vector<std::thread> joined;
+  {
+    std::lock_guard<std::mutex> lock(_checkers_mtx);
+    std::vector<TorrentID> tids =
+        tid.has_value() ? std::vector<TorrentID>{*tid} : _checkers_done;
+    for (TorrentID checked : tids) {
+      auto it = _checkers.find(checked);
+      if (it == _checkers.end()) continue;
+      joined.push_back(std::move(it->second));
+      _checkers.erase(it);
+    }
+    if (!tid.has_value()) _checkers_done.clear();
+  }
+  for (auto& checker : joined) checker.join();
+}
+
+void Furrent::start_torrent(TorrentID tid) {
+  auto logger = spdlog::get("custom");
+
+  std::shared_lock<std::shared_mutex> lock(_mtx);
+  Torrent& torrent = _torrents[tid];
+  const auto completed = *torrent.completed();
+  const auto shared_descriptor = torrent.shared_descriptor();
+  const auto layout = torrent.layout();
+
+  const size_t missing = layout->pieces_count() - completed.count();
+  torrent.pieces_processed = static_cast<uint32_t>(completed.count());
+
+  // A torrent stopped while loading is left alone
+  TorrentState expected = TorrentState::Loading;
+  if (!torrent.state.compare_exchange_strong(
+          expected,
+          missing == 0 ? TorrentState::Completed : TorrentState::Downloading))
+    return;
+
+  // Create a task for each piece not already on disk
+  for (size_t index = 0; index < layout->pieces_count(); index++)
+    if (!completed.get(static_cast<uint32_t>(index)))
+      _tasks.emplace(tid, index, shared_descriptor, layout);
+  logger->info("Generated {} of {} pieces for T{}", missing,
+               layout->pieces_count(), tid);
+
+  // Peers are picked under the lock, which must be released first
+  lock.unlock();
+  if (missing > 0) _connections.add_torrent(tid, shared_descriptor);
+}
+
 /// Removes a torrent descriptor and all of his tasks
 void Furrent::remove_torrent(TorrentID tid) {
+  stop_torrent(tid);
+
+  // A check in progress stops now that the torrent isn't loading anymore
+  join_checkers(tid);
+
+  // Save the progress once the pieces already downloaded are on disk, the
+  // lock is not held while waiting for the writer
+  _writer.flush(tid);
+
+  std::shared_lock<std::shared_mutex> lock(_mtx);
+  save_resume(_torrents[tid]);
+}
+
+/// Remove all tasks of a torrent and mark it as stopped
+void Furrent::stop_torrent(TorrentID tid) {
+  _connections.remove_torrent(tid);
+
   // Remove all tasks refering to the removed torrent
   _tasks.mutate([&](PieceTask& task) -> bool { return task.tid == tid; });
+  _verifications.mutate(
+      [&](PieceTask& task) -> bool { return task.tid == tid; });
 
   // Lock against writes to _torrents map
   std::shared_lock<std::shared_mutex> lock(_mtx);
@@ -376,15 +721,93 @@ void Furrent::remove_torrent(TorrentID tid) {
                                   std::memory_order_relaxed);
 }
 
+/// Called by the write-behind layer for every piece written to disk
+void Furrent::piece_written(TorrentID tid, size_t index, bool success) {
+  if (success) {
+    // Lock against writes to _torrents map
+    std::shared_lock<std::shared_mutex> lock(_mtx);
+    Torrent& torrent = _torrents[tid];
+    if (torrent.mark_completed(index) % config::RESUME_SAVE_INTERVAL == 0)
+      save_resume(torrent);
+    return;
+  }
+
+  auto logger = spdlog::get("custom");
+  logger->error("Error while saving piece [{:4}] of T{}", index, tid);
+  torrent_error(tid);
+}
+
+/// Pick the next peer of a torrent to connect to
+std::optional<download::connection_manager::Candidate>
+Furrent::pick_connection(TorrentID tid) {
+  // Random generator for each thread
+  thread_local std::random_device rng;
+  thread_local std::mt19937 gen(rng());
+
+  // Lock against writes to _torrents map
+  std::shared_lock<std::shared_mutex> lock(_mtx);
+  auto it = _torrents.find(tid);
+  if (it == _torrents.end() ||
+      it->second.state.load(std::memory_order_relaxed) !=
+          TorrentState::Downloading)
+    return std::nullopt;
+
+  auto peer_index = it->second.pick_peer(gen);
+  if (!peer_index) return std::nullopt;
+  return download::connection_manager::Candidate{
+      *peer_index, it->second.peer_at(*peer_index)};
+}
+
+/// Called by the connection manager for every failed connection attempt, and
+/// every peer keeping us choked for too long
+void Furrent::connection_failed(TorrentID tid, size_t peer_index) {
+  // Lock against writes to _torrents map
+  std::shared_lock<std::shared_mutex> lock(_mtx);
+  auto it = _torrents.find(tid);
+  if (it != _torrents.end())
+    it->second.atomic_record_peer_failure(peer_index, true);
+}
+
 /// Set torrent state to error and remove torrent
 void Furrent::torrent_error(TorrentID tid) {
-  remove_torrent(tid);
+  // Called by the writer thread too, so it must not wait for it
+  stop_torrent(tid);
 
   // Lock against writes to _torrents map
   std::shared_lock<std::shared_mutex> lock(_mtx);
   _torrents[tid].state.exchange(TorrentState::Error);
 }
 
+/// Save the resume data of a torrent
+void Furrent::save_resume(const Torrent& torrent) {
+  auto logger = spdlog::get("custom");
+
+  const TorrentFile& descriptor = torrent.descriptor();
+  if (descriptor.folder_name.empty()) return;
+
+  // Saves of the same torrent happen from several threads
+  std::lock_guard<std::mutex> lock(torrent.resume_mtx);
+
+  // The file stamps are taken after the completed pieces, so a piece written
+  // in between makes the data stale instead of missing from the bitfield
+  // A torrent still being checked has no progress to save
+  auto completed = torrent.completed();
+  if (!completed.has_value()) return;
+  auto stamps = disk::stamp_files(descriptor.folder_name, descriptor);
+  if (!stamps.has_value()) {
+    logger->warn("Unable to stat files of T{}, resume data not saved",
+                 torrent.tid());
+    return;
+  }
+
+  disk::ResumeData data{descriptor.info_hash, std::move(*completed),
+                        std::move(*stamps)};
+  auto saving =
+      disk::save_resume(disk::resume_path(descriptor.folder_name), data);
+  if (!saving.valid())
+    logger->warn("Unable to save resume data of T{}", torrent.tid());
+}
+
 // Extract torrents stats
 std::optional<TorrentGuiData> Furrent::get_gui_data(TorrentID tid) const {
   // Lock against writes to _torrents map
@@ -394,10 +817,16 @@ std::optional<TorrentGuiData> Furrent::get_gui_data(TorrentID tid) const {
       const TorrentFile& descritor = item.second.descriptor();
       return std::make_optional<TorrentGuiData>(
           {item.first, item.second.state.load(), descritor.name,
-           item.second.pieces_processed.load(), descritor.pieces_count});
+           item.second.pieces_processed.load(),
+           item.second.pieces_checked.load(), descritor.pieces_count});
     }
 
   return std::nullopt;
 }
 
+PipelineStats Furrent::pipeline_stats() const {
+  return {_tasks.size(), _verifications.size(),
+          _writer.stats().pending_bytes};
+}
+
 }  // namespace fur
@@ -1,14 +1,25 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <config.hpp>
+#include <disk/write_behind.hpp>
+#include <download/bitfield.hpp>
+#include <download/connection_manager.hpp>
 #include <download/downloader.hpp>
 #include <download/lender_pool.hpp>
+#include <download/piece_pool.hpp>
 #include <mt/group.hpp>
 #include <mt/sharing_queue.hpp>
+#include <mutex>
+#include <platform/io.hpp>
 #include <shared_mutex>
+#include <thread>
 #include <torrent.hpp>
 #include <types.hpp>
 #include <unordered_map>
 #include <util/singleton.hpp>
+#include <vector>
 
 namespace fur {
 
@@ -18,6 +29,7 @@ struct TorrentGuiData {
   std::string filename;
 
   size_t pieces_processed;
+  size_t pieces_checked;
   size_t pieces_count;
 };
 
@@ -28,6 +40,30 @@ struct PieceTaskStats {
   bool completed;
   /// Index of the used peer
   size_t used_peer;
+  /// Why the download failed, if it did
+  std::optional<download::downloader::DownloaderError> error;
+};
+
+/// Measures taken while downloading a piece, scoring the peer it came from
+/// once the piece is verified
+struct PieceTransfer {
+  /// Length of the piece
+  size_t bytes = 0;
+  /// Time between the first request and the arrival of the first block
+  std::chrono::steady_clock::duration rtt{};
+  /// Time between the first request and the arrival of the last block
+  std::chrono::steady_clock::duration transfer{};
+};
+
+/// Number of pieces waiting in each stage of the download pipeline, useful to
+/// balance the network and the hashing threads
+struct PipelineStats {
+  /// Pieces waiting to be downloaded
+  size_t download_queue;
+  /// Downloaded pieces waiting to be verified
+  size_t hash_queue;
+  /// Bytes of verified pieces waiting to be written
+  size_t write_pending_bytes;
 };
 
 /// Class responsible for processing a piece
@@ -38,26 +74,39 @@ class PieceTask {
  public:
   /// Identifier of the owner torrent
   TorrentID tid;
-  /// Piece to process
-  Piece piece;
-  /// .torrent descriptor
-  TorrentFile descriptor;
+  /// Global index of the piece to process
+  size_t index;
+  /// .torrent descriptor, shared by all tasks of the torrent
+  std::shared_ptr<const TorrentFile> descriptor;
+  /// Mapping of the pieces on the files, shared by all tasks of the torrent
+  std::shared_ptr<const PieceLayout> layout;
+  /// Index of the peer the piece has been downloaded from
+  size_t used_peer;
+  /// How the download from `used_peer` went
+  PieceTransfer transfer;
 
  public:
   /// Constructs an empty temporary piece task
   explicit PieceTask();
   /// Constructs a new piece task
-  PieceTask(TorrentID tid, Piece piece, const TorrentFile& descriptor);
+  PieceTask(TorrentID tid, size_t index,
+            std::shared_ptr<const TorrentFile> descriptor,
+            std::shared_ptr<const PieceLayout> layout);
+
+  /// Download the piece, which is left to be verified and saved by the
+  /// hashing stage
+  /// @param downloader connection to the peer to use for the download
+  PieceTaskStats process(download::downloader::Downloader& downloader);
 
-  /// Process piece from downloading to saving
-  /// @param peer peer to use for the download
-  PieceTaskStats process(const peer::Peer& peer);
+  /// Check the downloaded piece against its hash
+  bool verify();
+  /// Hand the downloaded piece to the write-behind layer
+  bool save(disk::WriteBehind& writer);
 
  private:
   /// Download from a peer
-  bool download(const peer::Peer& peer);
-  /// Save to file
-  [[nodiscard]] bool save() const;
+  util::Outcome<download::downloader::DownloaderError> download(
+      download::downloader::Downloader& downloader);
 };
 
 /// Main state of the program
@@ -69,11 +118,23 @@ class Furrent : public Singleton<Furrent> {
     size_t piece_processed = 0;
   };
 
+  /// State of the hashing threads
+  struct HasherState {
+    /// Total number of pieces verified
+    size_t pieces_verified = 0;
+  };
+
   /// Pool managing worker threads
   mt::ThreadGroup<WorkerState> _workers;
   /// All pieces to process
   mt::SharedQueue<PieceTask> _tasks;
 
+  /// Threads verifying the downloaded pieces and handing them to the writer,
+  /// so that the network workers never wait for hashing or for the disk
+  mt::ThreadGroup<HasherState> _hashers;
+  /// Downloaded pieces waiting to be verified
+  mt::SharedQueue<PieceTask> _verifications;
+
   /// Mutex protecting furrent state
   mutable std::shared_mutex _mtx;
   /// All torrent to manage, even those that have been stopped or have errors
@@ -84,6 +145,29 @@ class Furrent : public Singleton<Furrent> {
   /// Filepath of the folder containing all downloaded content
   std::string _download_folder; 
 
+  /// Threads checking the data found on disk of the torrents being loaded,
+  /// joined once done or when their torrent is removed
+  std::unordered_map<TorrentID, std::thread> _checkers;
+  /// Torrents whose checker is done and is still to be joined
+  std::vector<TorrentID> _checkers_done;
+  /// Protects `_checkers` and `_checkers_done`
+  std::mutex _checkers_mtx;
+  /// Set on destruction, stops the checks in progress
+  std::atomic_bool _closing;
+
+  /// Memory of the pieces being downloaded or waiting to be written, shared
+  /// by all torrents
+  download::piece_pool::PiecePool _buffers;
+
+  /// Connections to the peers of all torrents, established ahead of the
+  /// downloads. Destroyed before the torrents and the pieces memory it uses
+  download::connection_manager::ConnectionManager _connections;
+
+  /// Coalesces verified pieces into large writes. Declared last so that it is
+  /// destroyed first, while the state touched by its callback and the pieces
+  /// memory are still alive
+  disk::WriteBehind _writer;
+
  public:
   /// All possible Furrent errors
   enum class Error {
@@ -103,18 +187,27 @@ class Furrent : public Singleton<Furrent> {
   /// Set the download folder
   Result<Empty> set_download_folder(const std::string& folder);
 
-  /// Begin download of a torrent
+  /// Begin download of a torrent. If the torrent folder already exists only
+  /// the missing pieces are downloaded. When the resume data is missing or
+  /// stale the torrent is returned loading, the data on disk being verified
+  /// in the background first
   /// @param filename filename of the .torrent file
+  /// @param preallocation how the space for the torrent files is reserved
   /// @return the id of the new torrent
-  Result<TorrentID> add_torrent(const std::string& filename);
+  Result<TorrentID> add_torrent(const std::string& filename,
+                                platform::io::Preallocation preallocation =
+                                    config::PREALLOCATION);
 
-  /// Removes a torrent descriptor and all of his tasks
+  /// Removes a torrent descriptor and all of his tasks, saving its resume data
   /// @param uid uid of the torrent to remove
   void remove_torrent(TorrentID tid);
 
   /// Extract torrents stats
   std::optional<TorrentGuiData> get_gui_data(TorrentID tid) const;
 
+  /// @return number of pieces waiting in each stage of the pipeline
+  PipelineStats pipeline_stats() const;
+
   /*
   /// Pause the download of a torrent
   /// @param uid uid of the torrent to pause
@@ -138,12 +231,53 @@ class Furrent : public Singleton<Furrent> {
   /// Main function of all workers
   void thread_main(mt::Runner runner, WorkerState& state, size_t index);
 
+  /// Main function of the hashing threads
+  void hashing_main(mt::Runner runner, HasherState& state, size_t index);
+
+  /// Update the torrent of a piece handed to the writer, marking it
+  /// completed after its last piece
+  void piece_verified(const PieceTask& task);
+
+  /// Pick the next peer of a torrent to connect to
+  std::optional<download::connection_manager::Candidate> pick_connection(
+      TorrentID tid);
+
+  /// Called by the connection manager for every failed connection attempt,
+  /// and every peer keeping us choked for too long or hanging up meanwhile
+  void connection_failed(TorrentID tid, size_t peer_index);
+
   /// Set torrent state to error and remove torrent
   void torrent_error(TorrentID tid);
 
-  /// Prepare all folders and files for a torrent
-  /// @return True if the operation was a success, false otherwise
-  bool prepare_torrent_files(TorrentFile& descriptor);
+  /// Remove all tasks of a torrent and mark it as stopped
+  void stop_torrent(TorrentID tid);
+
+  /// Save the resume data of a torrent, must be called with `_mtx` locked.
+  /// Only pieces that have reached the disk are included. Saves of the same
+  /// torrent from several threads are done one after the other
+  void save_resume(const Torrent& torrent);
+
+  /// Called by the write-behind layer for every piece written to disk
+  void piece_written(TorrentID tid, size_t index, bool success);
+
+  /// Prepare all folders and files for a torrent, reusing the files of a
+  /// previous download when possible
+  /// @param preallocation how the space for the files is reserved
+  /// @return pieces already on disk, nothing if the data on disk must be
+  /// checked first
+  Result<std::optional<download::bitfield::Bitfield>> prepare_torrent_files(
+      TorrentFile& descriptor, platform::io::Preallocation preallocation);
+
+  /// Verify the data on disk of a loading torrent against its piece hashes,
+  /// then start it. Runs on its own thread
+  void check_torrent(TorrentID tid);
+
+  /// Take the checker of a torrent out of `_checkers`, or those that are
+  /// done if `tid` is nothing, and join them
+  void join_checkers(std::optional<TorrentID> tid);
+
+  /// Create the tasks of a loaded torrent for the pieces not on disk yet
+  void start_torrent(TorrentID tid);
 };
 
 }  // namespace fur
@@ -195,6 +195,17 @@ void Window::render_torrent_item(const TorrentGuiData& torrent, float pos) {
       100);
 
   switch (torrent.state) {
+    case TorrentState::Loading: {
+      // The data already on disk is being checked
+      int checked = static_cast<int>(
+          (static_cast<float>(torrent.pieces_checked) / torrent.pieces_count) *
+          100);
+      GuiSetStyle(PROGRESSBAR, BASE_COLOR_PRESSED, DOWNLOADING_COLOR_HEX);
+      Rectangle rect = create_rect(275, static_cast<int>(110 + pos), 300, 20);
+      GuiProgressBar(rect, (std::to_string(checked) + "% ").c_str(),
+                     "Checking", checked, 0, 100);
+
+    } break;
     case TorrentState::Downloading: {
       GuiSetStyle(PROGRESSBAR, BASE_COLOR_PRESSED, DOWNLOADING_COLOR_HEX);
       Rectangle rect = create_rect(275, static_cast<int>(110 + pos), 300, 20);
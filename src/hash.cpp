@@ -1,11 +1,12 @@
 #include "hash.hpp"
 
+#include <algorithm>
 #include <array>
-#include <cassert>
-#include <limits>
+#include <cstring>
 #include <string>
 #include <vector>
 
+#include "sha1/sha1.hpp"
 #include "smallsha1/sha1.hpp"
 #include "spdlog/spdlog.h"
 
@@ -26,19 +27,17 @@ std::string hash_to_str(const hash_t& hash) {
 
 std::string hash_to_hex(const hash_t& hash) {
   char result[41];
-  sha1::toHexString(hash.begin(), result);
+  ::sha1::toHexString(hash.begin(), result);
   return std::string{result, 40};
 }
 
-hash_t compute_info_hash(const std::string& bencoded_info_dict) {
-  int len = static_cast<int>(bencoded_info_dict.length());
-
-  hash_t buffer;
-  sha1::calc(bencoded_info_dict.data(), len, buffer.begin());
-  return buffer;
+hash_t compute_info_hash(std::string_view bencoded_info_dict) {
+  return sha1::digest(
+      reinterpret_cast<const uint8_t*>(bencoded_info_dict.data()),
+      bencoded_info_dict.size());
 }
 
-auto split_piece_hashes(const std::string& piece_hashes_str) -> HashResult {
+auto split_piece_hashes(std::string_view piece_hashes_str) -> HashResult {
   if (piece_hashes_str.length() % 20 > 0) {
     return HashResult::ERROR(HashError::MalformedPieceHashesString);
   }
@@ -65,10 +64,71 @@ auto split_piece_hashes(const std::string& piece_hashes_str) -> HashResult {
 }
 
 bool verify_piece(const std::vector<uint8_t>& piece, hash_t hash) {
-  assert(piece.size() < std::numeric_limits<size_t>::max());
-  hash_t buffer;
-  sha1::calc(piece.data(), static_cast<int>(piece.size()), buffer.begin());
-  return buffer == hash;
+  return verify_piece(piece.data(), piece.size(), hash);
+}
+
+bool verify_piece(const uint8_t* data, size_t len, hash_t hash) {
+  return sha1::digest(data, len) == hash;
+}
+
+std::vector<bool> verify_pieces(const std::vector<PieceView>& pieces,
+                                const std::vector<hash_t>& hashes) {
+  std::vector<const uint8_t*> data;
+  std::vector<size_t> lens;
+  data.reserve(pieces.size());
+  lens.reserve(pieces.size());
+  for (const auto& piece : pieces) {
+    data.push_back(piece.data);
+    lens.push_back(piece.len);
+  }
+
+  std::vector<sha1::Digest> digests(pieces.size());
+  sha1::digest_many(data.data(), lens.data(), pieces.size(), digests.data());
+
+  std::vector<bool> valid(pieces.size());
+  for (size_t i = 0; i < pieces.size(); i++) valid[i] = digests[i] == hashes[i];
+  return valid;
+}
+
+Hasher::Hasher() : _compress{sha1::compress_fn(sha1::best_backend())} {
+  reset();
+}
+
+void Hasher::reset() {
+  _state = sha1::initial_state();
+  _partial_len = 0;
+  _total_len = 0;
+}
+
+void Hasher::update(const uint8_t* data, size_t len) {
+  _total_len += len;
+
+  // Complete the partial block first
+  if (_partial_len > 0) {
+    size_t taken = std::min(len, sha1::BLOCK_SIZE - _partial_len);
+    std::memcpy(_partial.data() + _partial_len, data, taken);
+    _partial_len += taken;
+    data += taken;
+    len -= taken;
+
+    if (_partial_len < sha1::BLOCK_SIZE) return;
+    _compress(_state, _partial.data(), 1);
+    _partial_len = 0;
+  }
+
+  // Whole blocks are compressed directly from the caller memory
+  size_t blocks = len / sha1::BLOCK_SIZE;
+  _compress(_state, data, blocks);
+  data += blocks * sha1::BLOCK_SIZE;
+  len -= blocks * sha1::BLOCK_SIZE;
+
+  if (len > 0) std::memcpy(_partial.data(), data, len);
+  _partial_len = len;
+}
+
+hash_t Hasher::finalize() const {
+  return sha1::finalize(_state, _partial.data(), _partial_len, _total_len,
+                        _compress);
 }
 
 }  // namespace fur::hash
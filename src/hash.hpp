@@ -3,8 +3,10 @@
 #include <array>
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "sha1/sha1.hpp"
 #include "util/result.hpp"
 
 namespace fur::hash {
@@ -31,12 +33,61 @@ std::string hash_to_str(const hash_t& hash);
 std::string hash_to_hex(const hash_t& hash);
 
 /// Computes the info hash given a bencoded string for the .torrent info dict
-hash_t compute_info_hash(const std::string& bencoded_info_dict);
+hash_t compute_info_hash(std::string_view bencoded_info_dict);
 
 /// Takes a string with the hashes of pieces from a torrent file and parses
 /// them into a vector of "hash_t". Each hash is 20 bytes long
-HashResult split_piece_hashes(const std::string& pieces);
+HashResult split_piece_hashes(std::string_view pieces);
 
 /// Checks that a downloaded piece matches the provided hash
 bool verify_piece(const std::vector<uint8_t>& piece, hash_t hash);
+
+/// Checks that `len` bytes beginning at `data` match the provided hash
+bool verify_piece(const uint8_t* data, size_t len, hash_t hash);
+
+/// A piece held in memory, to be checked in a batch
+struct PieceView {
+  const uint8_t* data;
+  size_t len;
+};
+
+/// Checks many pieces against their hashes at once. When the CPU allows it,
+/// groups of pieces are hashed in parallel on a single core by the
+/// multi-buffer SHA1 backends, which is fastest when the pieces have the
+/// same length
+/// @param pieces pieces to check
+/// @param hashes expected hash of each piece, as many as the pieces
+/// @return for each piece, true if it matches its hash
+std::vector<bool> verify_pieces(const std::vector<PieceView>& pieces,
+                                const std::vector<hash_t>& hashes);
+
+/// Computes a SHA1 hash incrementally, for data received in parts. Whole
+/// blocks are compressed as soon as they are available, so little work is
+/// left when the last part arrives
+class Hasher {
+  sha1::CompressFn _compress;
+  sha1::State _state;
+  /// Bytes not yet compressed because they don't fill a block
+  std::array<uint8_t, sha1::BLOCK_SIZE> _partial;
+  size_t _partial_len;
+  /// Total number of bytes consumed
+  size_t _total_len;
+
+ public:
+  /// Begin a new hash
+  Hasher();
+
+  /// Begin a new hash, discarding everything consumed so far
+  void reset();
+
+  /// Consume the next `len` bytes of the data
+  void update(const uint8_t* data, size_t len);
+
+  /// @return hash of all the data consumed, the hasher must be reset before
+  /// being used again
+  [[nodiscard]] hash_t finalize() const;
+
+  /// @return number of bytes consumed so far
+  [[nodiscard]] size_t consumed() const { return _total_len; }
+};
 }  // namespace fur::hash
@@ -24,7 +24,7 @@ int main(int, char* argv[]) {
   fur::gui::Window window("Furrent", 800, 600);
   
   window.set_torrent_insert_fn([&](const std::string& filepath, const std::string&) -> std::optional<TorrentGuiData> {
-    auto tid = furrent.add_torrent(filepath);
+    auto tid = furrent.add_torrent(filepath, fur::config::PREALLOCATION);
     if (tid.valid())
       return furrent.get_gui_data(*tid);
     return std::nullopt;
@@ -0,0 +1,40 @@
+#include <algorithm>
+#include <merkle/merkle.hpp>
+
+namespace fur::merkle {
+
+node_t leaf(const uint8_t* data, size_t len) {
+  return sha256::digest(data, len);
+}
+
+node_t zero_subtree(size_t width) { return root({}, width); }
+
+size_t next_pow2(size_t n) {
+  size_t pow = 1;
+  while (pow < n) pow *= 2;
+  return pow;
+}
+
+node_t root(std::vector<node_t> nodes, size_t width, const node_t& padding) {
+  // Only the nodes on the left are computed, everything on their right is
+  // padding which is the same at every layer
+  node_t pad = padding;
+  for (; width > 1; width /= 2) {
+    if (nodes.size() % 2 != 0) nodes.push_back(pad);
+    for (size_t i = 0; i < nodes.size() / 2; i++)
+      nodes[i] = sha256::digest_pair(nodes[2 * i], nodes[2 * i + 1]);
+    nodes.resize(nodes.size() / 2);
+    pad = sha256::digest_pair(pad, pad);
+  }
+  return nodes.empty() ? pad : nodes[0];
+}
+
+node_t data_root(const uint8_t* data, size_t len, size_t width) {
+  std::vector<node_t> leaves;
+  leaves.reserve((len + BLOCK_SIZE - 1) / BLOCK_SIZE);
+  for (size_t offset = 0; offset < len; offset += BLOCK_SIZE)
+    leaves.push_back(leaf(data + offset, std::min(BLOCK_SIZE, len - offset)));
+  return root(std::move(leaves), width);
+}
+
+}  // namespace fur::merkle
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <sha256/sha256.hpp>
+#include <vector>
+
+/// Merkle trees of BitTorrent v2 (BEP 52). Every file has its own tree whose
+/// leaves are the SHA-256 hashes of its 16 KiB blocks, the last one possibly
+/// shorter. The leaves are padded with zero hashes up to a power of two
+namespace fur::merkle {
+
+/// Size in bytes of the blocks hashed as leaves
+constexpr size_t BLOCK_SIZE = 16384;
+
+/// Hash of a node of a tree
+using node_t = sha256::Digest;
+
+/// @return hash of a leaf, a block of at most `BLOCK_SIZE` bytes
+node_t leaf(const uint8_t* data, size_t len);
+
+/// @return root of a subtree of `width` zero leaves, `width` is a power of two
+node_t zero_subtree(size_t width);
+
+/// @return smallest power of two not less than `n`
+size_t next_pow2(size_t n);
+
+/// Root of a tree given one of its layers
+/// @param nodes nodes of the layer from the left, at most `width`
+/// @param width number of nodes of the complete layer, a power of two
+/// @param padding hash of the nodes beyond `nodes`, zero for the leaves
+node_t root(std::vector<node_t> nodes, size_t width,
+            const node_t& padding = {});
+
+/// Root of the subtree covering `len` bytes of data
+/// @param width number of leaves of the subtree, a power of two
+node_t data_root(const uint8_t* data, size_t len, size_t width);
+
+}  // namespace fur::merkle
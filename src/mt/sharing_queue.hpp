@@ -67,6 +67,9 @@ class SharedQueue {
   /// Wake up all waiting threads
   void force_wakeup();
 
+  /// Number of elements in the queue
+  [[nodiscard]] size_t size() const;
+
   /// Wait for a new item in the queue
   void wait_work() const;
 
@@ -44,6 +44,12 @@ void SharedQueue<T>::force_wakeup() {
   _new_work_available.notify_all();
 }
 
+template <typename T>
+size_t SharedQueue<T>::size() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _work.size();
+}
+
 template <typename T>
 void SharedQueue<T>::wait_work() const {
   std::unique_lock<std::mutex> lock(_mutex);
@@ -1,11 +1,13 @@
 #include "peer.hpp"
 
+#include <limits>
 #include <memory>
+#include <optional>
 #include <regex>
 #include <stdexcept>
+#include <string_view>
 
-#include "bencode/bencode_parser.hpp"
-#include "bencode/bencode_value.hpp"
+#include "bencode/bencode_reader.hpp"
 #include "cpr/cpr.h"
 #include "fmt/core.h"
 #include "hash.hpp"
@@ -39,10 +41,114 @@ Peer::Peer(const std::string& ip_s, uint16_t port) : ip{0}, port{port} {
   }
 }
 
-// Forward declare
-PeerResult parse_tracker_response(const std::string& text);
+/// Picks the fields of a tracker response out of the events of a
+/// `BencodeReader`, every other value is skipped without being copied. Only
+/// a failed announce has a failure reason
+class TrackerResponse : public bencode::BencodeVisitor {
+  /// Keys of the outermost dict that are kept
+  enum class Field { None, FailureReason, Interval, Peers };
+
+  /// How many containers are open
+  size_t _depth = 0;
+  /// Which field the next value of the outermost dict is
+  Field _field = Field::None;
+
+ public:
+  std::optional<std::string> failure_reason;
+  std::optional<long> interval;
+  std::optional<std::string> peers;
+
+  void key(std::string_view key) override {
+    if (_depth != 1) return;
+    if (key == "failure reason")
+      _field = Field::FailureReason;
+    else if (key == "interval")
+      _field = Field::Interval;
+    else if (key == "peers")
+      _field = Field::Peers;
+    else
+      _field = Field::None;
+  }
+  void integer(long value) override {
+    if (_field == Field::Interval) interval = value;
+    _field = Field::None;
+  }
+  void string(std::string_view value) override {
+    if (_field == Field::FailureReason) failure_reason = value;
+    if (_field == Field::Peers) peers = value;
+    _field = Field::None;
+  }
+  void begin_list() override { begin(); }
+  void begin_dict() override { begin(); }
+  void end() override { _depth -= 1; }
+
+ private:
+  void begin() {
+    _depth += 1;
+    _field = Field::None;
+  }
+};
+
+/// Turn the fields picked out of a tracker response into the announce
+static PeerResult to_announce(const TrackerResponse& response) {
+  auto logger = spdlog::get("custom");
+  Announce result;
+
+  if (response.failure_reason) {
+    logger->error("Tracker failure: {}", *response.failure_reason);
+    return PeerResult::ERROR(PeerError::AnnounceError);
+  }
+  if (!response.interval || !response.peers) {
+    logger->error("Tracker response without interval or peers");
+    return PeerResult::ERROR(PeerError::ParserError);
+  }
+  if (*response.interval < 0 ||
+      *response.interval > std::numeric_limits<int>::max()) {
+    logger->error("Tracker interval out of range");
+    return PeerResult::ERROR(PeerError::ParserError);
+  }
+
+  result.interval = static_cast<int>(*response.interval);
+
+  // Compact format, 4 bytes of address and 2 of port for each peer
+  const auto& peers = *response.peers;
+  for (size_t i = 0; i + 6 <= peers.size(); i += 6) {
+    auto byte = [&](size_t offset) {
+      return static_cast<uint32_t>(static_cast<uint8_t>(peers[i + offset]));
+    };
+
+    // Each byte is an octet
+    uint32_t ip = byte(0) << 24 | byte(1) << 16 | byte(2) << 8 | byte(3);
+    // Big endian
+    auto port = static_cast<uint16_t>(byte(4) << 8 | byte(5));
+
+    result.peers.emplace_back(ip, port);
+  }
+
+  return PeerResult::OK(std::move(result));
+}
 
 PeerResult announce(const TorrentFile& torrent_f) {
+  auto logger = spdlog::get("custom");
+
+  // The response is read as it arrives, only a value cut by the end of a
+  // chunk is kept until the next one
+  TrackerResponse response;
+  bencode::BencodeReader reader;
+  std::string pending;
+  std::optional<bencode::BencodeParserError> error;
+  // Newer versions of cpr also pass the user data, which is not needed
+  auto on_chunk = [&](const std::string& chunk, auto&&...) {
+    pending += chunk;
+    auto consumed = reader.feed(pending, response);
+    if (!consumed.valid()) {
+      error = consumed.error();
+      return false;
+    }
+    pending.erase(0, *consumed);
+    return true;
+  };
+
   auto res = cpr::Get(cpr::Url{torrent_f.announce_url},
                       cpr::Parameters{
                           {"info_hash", hash::hash_to_str(torrent_f.info_hash)},
@@ -52,49 +158,35 @@ PeerResult announce(const TorrentFile& torrent_f) {
                           {"downloaded", "0"},
                           {"compact", "0"},
                           {"left", std::to_string(torrent_f.length)},
-                      });
+                      },
+                      cpr::WriteCallback{on_chunk});
 
-  if (res.status_code == 0 || res.status_code >= 400) {
-    auto logger = spdlog::get("custom");
+  // A transfer stopped on a malformed response has no status
+  if (res.status_code >= 400 || (res.status_code == 0 && !error)) {
     logger->error("Could not announce to tracker");
     return PeerResult::ERROR(PeerError::AnnounceError);
   }
-  return parse_tracker_response(res.text);
+  if (error) {
+    logger->error("Bencode parser error: {}",
+                  fur::bencode::error_to_string(*error));
+    return PeerResult::ERROR(PeerError::ParserError);
+  }
+  if (!reader.done() || !pending.empty()) {
+    logger->error("Tracker response cut short or followed by garbage");
+    return PeerResult::ERROR(PeerError::ParserError);
+  }
+  return to_announce(response);
 }
 
 PeerResult parse_tracker_response(const std::string& text) {
-  Announce result;
-
-  bencode::BencodeParser parser;
-  auto tree = parser.decode(text);
-  if (!tree.valid()) {
+  TrackerResponse response;
+  auto reading = bencode::BencodeReader::read(text, response);
+  if (!reading.valid()) {
     auto logger = spdlog::get("custom");
     logger->error("Bencode parser error: {}",
-                  fur::bencode::error_to_string(tree.error()));
+                  fur::bencode::error_to_string(reading.error()));
     return PeerResult::ERROR(PeerError::ParserError);
   }
-  auto& dict = dynamic_cast<bencode::BencodeDict&>(*(*tree)).value();
-
-  auto& interval = dynamic_cast<bencode::BencodeInt&>(*dict.at("interval"));
-  result.interval = static_cast<int>(interval.value());
-
-  auto& peers = dynamic_cast<bencode::BencodeString&>(*dict.at("peers"));
-  for (auto it = peers.value().begin(); it < peers.value().end(); it += 6) {
-    // Each byte is an octet
-    uint32_t ip = 0;
-    ip |= *(it++) << 24;
-    ip |= *(it++) << 16;
-    ip |= *(it++) << 8;
-    ip |= *(it++);
-
-    // Big endian
-    uint16_t port = 0;
-    port |= *(it++) << 8;
-    port |= *(it++);
-
-    result.peers.emplace_back(ip, port);
-  }
-
-  return PeerResult::OK(std::move(result));
+  return to_announce(response);
 }
 }  // namespace fur::peer
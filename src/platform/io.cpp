@@ -1,33 +1,123 @@
 #include <platform/io.hpp>
 
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
 #include <fstream>
+#include <mutex>
 #include <sstream>
+#include <thread>
 
 namespace fur::platform::io {
     
-IOResult<Empty> touch(const std::string& filename, size_t size) {
+/// Translate the errno of a failed allocation
+static IOError allocation_error(int error) {
+    if (error == ENOSPC || error == EFBIG)
+        return IOError::NoSpaceLeft;
+    return IOError::GenericError;
+}
 
-    // Check if the file already exists
-    auto existence = exists(filename);
-    if (!existence.valid())
-        return IOResult<Empty>::ERROR(IOError::GenericError);
+/// Reserve all blocks of an open file
+static int allocate(int fd, size_t size) {
+#ifdef __linux__
+    // Native fallocate is a single metadata operation on filesystems that
+    // support it, posix_fallocate is only used as a fallback because glibc
+    // emulates it by writing a byte in every block
+    if (fallocate(fd, 0, 0, static_cast<off_t>(size)) == 0)
+        return 0;
+    if (errno != EOPNOTSUPP)
+        return errno;
+#endif
+    return posix_fallocate(fd, 0, static_cast<off_t>(size));
+}
 
-    // If file already exists then something is wrong
-    if (*existence)
-        return IOResult<Empty>::ERROR(IOError::FileAlreadyExists);
+IOResult<Empty> touch(const std::string& filename, size_t size, Preallocation mode) {
 
-    std::ofstream stream;
-    stream.open(filename, std::ios::binary | std::ios::out);
-    if (stream.good() && stream.is_open()) {
+    // O_EXCL makes the existence check and the creation a single atomic
+    // operation, if file already exists then something is wrong
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        if (errno == EEXIST)
+            return IOResult<Empty>::ERROR(IOError::FileAlreadyExists);
+        return IOResult<Empty>::ERROR(IOError::CannotOpenFile);
+    }
 
-        // Go to the end of the file and add a 1
-        stream.seekp(size - 1);
-        stream << static_cast<unsigned char>(1);
-        if (stream.good())
-            return IOResult<Empty>::OK({});
+    int error = 0;
+    if (size > 0) {
+        switch (mode) {
+            case Preallocation::None:
+                break;
+            case Preallocation::Sparse:
+                if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+                    error = errno;
+                break;
+            case Preallocation::Full:
+                error = allocate(fd, size);
+                break;
+        }
     }
 
-    return IOResult<Empty>::ERROR(IOError::GenericError);
+    if (close(fd) != 0 && error == 0)
+        error = errno;
+
+    if (error != 0) {
+        // Don't leave a partially allocated file behind
+        unlink(filename.c_str());
+        return IOResult<Empty>::ERROR(allocation_error(error));
+    }
+
+    return IOResult<Empty>::OK({});
+}
+
+IOResult<Empty> touch_all(const std::vector<FileSpec>& files, Preallocation mode, size_t threads) {
+
+    // Creating a file is mostly waiting on the filesystem, it is not worth
+    // spawning a thread for a handful of them
+    const size_t FILES_PER_THREAD = 16;
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, (files.size() + FILES_PER_THREAD - 1) / FILES_PER_THREAD);
+
+    // Next file to create and first error encountered
+    std::atomic_size_t next{0};
+    std::atomic_bool failed{false};
+    IOError first_error = IOError::GenericError;
+    std::mutex error_mutex;
+
+    auto worker = [&]() {
+        while (!failed.load(std::memory_order_relaxed)) {
+            size_t index = next.fetch_add(1, std::memory_order_relaxed);
+            if (index >= files.size())
+                return;
+
+            auto creation = touch(files[index].filename, files[index].size, mode);
+            if (!creation.valid()) {
+                std::scoped_lock<std::mutex> lock(error_mutex);
+                if (!failed.exchange(true))
+                    first_error = creation.error();
+                return;
+            }
+        }
+    };
+
+    // The calling thread works too
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < threads; i++)
+        pool.emplace_back(worker);
+    worker();
+    for (auto& thread : pool)
+        thread.join();
+
+    if (failed)
+        return IOResult<Empty>::ERROR(std::move(first_error));
+    return IOResult<Empty>::OK({});
 }
 
 IOResult<bool> exists(const std::string& filename) {
@@ -62,6 +152,70 @@ IOResult<Empty> write_bytes(const std::string& filename, const std::vector<uint8
     return IOResult<Empty>::ERROR(IOError::GenericError);
 }
 
+/// Write all chunks to an open file with vectored writes
+static bool write_chunks_fd(int fd, const std::vector<Chunk>& chunks, size_t offset) {
+    std::vector<iovec> iovecs;
+    iovecs.reserve(std::min<size_t>(chunks.size(), IOV_MAX));
+
+    size_t chunk = 0;
+    // Bytes of the current chunk already written by a partial write
+    size_t chunk_written = 0;
+    while (chunk < chunks.size()) {
+
+        // The kernel accepts at most IOV_MAX chunks per call
+        iovecs.clear();
+        for (size_t i = chunk; i < chunks.size() && iovecs.size() < IOV_MAX; i++) {
+            size_t skip = (i == chunk) ? chunk_written : 0;
+            iovecs.push_back({const_cast<uint8_t*>(chunks[i].data) + skip, chunks[i].len - skip});
+        }
+
+        ssize_t written = pwritev(fd, iovecs.data(), static_cast<int>(iovecs.size()), static_cast<off_t>(offset));
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (written == 0 && chunks[chunk].len > chunk_written)
+            return false;
+        offset += static_cast<size_t>(written);
+
+        // Advance over all fully written chunks
+        size_t remaining = static_cast<size_t>(written);
+        while (chunk < chunks.size() && remaining >= chunks[chunk].len - chunk_written) {
+            remaining -= chunks[chunk].len - chunk_written;
+            chunk_written = 0;
+            chunk += 1;
+        }
+        chunk_written += remaining;
+    }
+    return true;
+}
+
+IOResult<Empty> write_chunks(const std::string& filename, const std::vector<Chunk>& chunks, size_t offset) {
+    int fd = open(filename.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return IOResult<Empty>::ERROR(IOError::CannotOpenFile);
+
+    bool written = write_chunks_fd(fd, chunks, offset);
+    if (close(fd) != 0 || !written)
+        return IOResult<Empty>::ERROR(IOError::GenericError);
+    return IOResult<Empty>::OK({});
+}
+
+IOResult<Empty> write_chunks_direct(const std::string& filename, const std::vector<Chunk>& chunks, size_t offset) {
+    int fd = open(filename.c_str(), O_WRONLY | O_CLOEXEC | O_DIRECT);
+    if (fd < 0) {
+        if (errno == EINVAL)
+            return IOResult<Empty>::ERROR(IOError::DirectIOUnsupported);
+        return IOResult<Empty>::ERROR(IOError::CannotOpenFile);
+    }
+
+    bool written = write_chunks_fd(fd, chunks, offset);
+    if (close(fd) != 0 || !written)
+        return IOResult<Empty>::ERROR(IOError::GenericError);
+    return IOResult<Empty>::OK({});
+}
+
 IOResult<std::string> create_directories(const std::string& path, bool skip_last) {
     
     std::string real_path;
@@ -101,4 +255,19 @@ IOResult<std::string> load_file_text(const std::string& filepath) {
     return IOResult<std::string>::ERROR(IOError::CannotOpenFile);
 }
 
+IOResult<Empty> save_file_text(const std::string& filepath, const std::string& text) {
+    const std::string temp_path = filepath + ".tmp";
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return IOResult<Empty>::ERROR(IOError::CannotOpenFile);
+
+    Chunk chunk{reinterpret_cast<const uint8_t*>(text.data()), text.size()};
+    bool written = write_chunks_fd(fd, {chunk}, 0) && fsync(fd) == 0;
+    if (close(fd) != 0 || !written || rename(temp_path.c_str(), filepath.c_str()) != 0) {
+        unlink(temp_path.c_str());
+        return IOResult<Empty>::ERROR(IOError::GenericError);
+    }
+    return IOResult<Empty>::OK({});
+}
+
 } // namespace fur::platform::io
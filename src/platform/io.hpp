@@ -14,6 +14,21 @@ enum class IOError {
     PathDoesNotExists,
     FileAlreadyExists,
     DirectoryAlreadyExists,
+    NoSpaceLeft,
+    DirectIOUnsupported,
+};
+
+/// Alignment of offsets, sizes and memory required by direct I/O
+constexpr size_t DIRECT_IO_ALIGNMENT = 4096;
+
+/// How the space of a newly created file is reserved on disk
+enum class Preallocation {
+    /// Create an empty file, it grows as pieces are written
+    None,
+    /// Set the final size without reserving any block (ftruncate)
+    Sparse,
+    /// Reserve all blocks upfront (fallocate), fails early if the disk is full
+    Full,
 };
 
 /// Empty result for handling IO errors
@@ -21,10 +36,29 @@ template<typename T>
 using IOResult = util::Result<T, IOError>;
 using util::Empty;
 
+/// Describes a file to be created by `touch_all`
+struct FileSpec {
+    /// Filename of the new file
+    std::string filename;
+    /// Size of the new file
+    size_t size;
+};
+
 /// Create a new file on the disk
 /// @param filename filename of the new file
 /// @param size size of the new file
-IOResult<Empty> touch(const std::string& filename, size_t size);
+/// @param mode how the space of the file is reserved
+IOResult<Empty> touch(const std::string& filename, size_t size,
+                      Preallocation mode = Preallocation::Sparse);
+
+/// Create many files on the disk, spreading the work across multiple threads.
+/// Stops at the first error, files already created are not removed
+/// @param files all files to create, their folders must already exist
+/// @param mode how the space of the files is reserved
+/// @param threads maximum number of threads to use, 0 to use all cores
+IOResult<Empty> touch_all(const std::vector<FileSpec>& files,
+                          Preallocation mode = Preallocation::Sparse,
+                          size_t threads = 0);
 
 /// Check if a directory or file exists
 /// @param filename path to check
@@ -41,6 +75,31 @@ IOResult<Empty> remove(const std::string& filename);
 IOResult<Empty> write_bytes(const std::string& filename,
                      const std::vector<uint8_t>& bytes, size_t offset);
 
+/// A contiguous sequence of bytes, part of a larger write
+struct Chunk {
+    const uint8_t* data;
+    size_t len;
+};
+
+/// Write chunks of bytes to file one after the other, with as few vectored
+/// writes as possible
+/// @param filename filename of the target file
+/// @param chunks chunks to write, in order
+/// @param offset where to write the first chunk in the file
+IOResult<Empty> write_chunks(const std::string& filename,
+                             const std::vector<Chunk>& chunks, size_t offset);
+
+/// Write chunks of bytes to file one after the other bypassing the page cache.
+/// The offset and every chunk address and size must be multiples of
+/// `DIRECT_IO_ALIGNMENT`
+/// @param filename filename of the target file
+/// @param chunks chunks to write, in order
+/// @param offset where to write the first chunk in the file
+/// @return `DirectIOUnsupported` if the filesystem doesn't allow direct I/O
+IOResult<Empty> write_chunks_direct(const std::string& filename,
+                                    const std::vector<Chunk>& chunks,
+                                    size_t offset);
+
 /// Create a nested folders structure
 /// @param path path including all directories to create
 /// @param skip_last skip last section of the path, used for files
@@ -52,4 +111,11 @@ IOResult<std::string> create_directories(const std::string& path, bool skip_last
 /// @return loaded text or an error
 IOResult<std::string> load_file_text(const std::string& filepath);
 
+/// Save the content of a file, atomically replacing the previous one. The
+/// content is written to a temporary file that is synced and then renamed, so
+/// a crash leaves either the old or the new content
+/// @param filepath filepath of the target file
+/// @param text content of the file
+IOResult<Empty> save_file_text(const std::string& filepath, const std::string& text);
+
 }  // namespace fur::platform::io
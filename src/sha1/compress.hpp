@@ -0,0 +1,74 @@
+#pragma once
+
+#include <sha1/sha1.hpp>
+
+/// Compression functions of all backends, use `compress_fn` to get the one
+/// supported by the CPU
+namespace fur::sha1::detail {
+
+/// Round constants, one every 20 rounds
+constexpr uint32_t K[4] = {0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6};
+
+inline uint32_t rol(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+/// The 80 rounds of a block
+/// @param wk message schedule, each word already added to its round constant
+__attribute__((always_inline)) inline void rounds(State& state,
+                                                  const uint32_t* wk) {
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3],
+           e = state[4];
+
+  // Instead of moving every variable at each round, five rounds are unrolled
+  // with the variables renamed
+#define SHA1_ROUND(f, a, b, c, d, e, i) \
+  e += rol(a, 5) + (f) + wk[i];         \
+  b = rol(b, 30);
+#define SHA1_ROUNDS5(F, i)                       \
+  SHA1_ROUND(F(b, c, d), a, b, c, d, e, (i));     \
+  SHA1_ROUND(F(a, b, c), e, a, b, c, d, (i) + 1); \
+  SHA1_ROUND(F(e, a, b), d, e, a, b, c, (i) + 2); \
+  SHA1_ROUND(F(d, e, a), c, d, e, a, b, (i) + 3); \
+  SHA1_ROUND(F(c, d, e), b, c, d, e, a, (i) + 4);
+#define SHA1_CH(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define SHA1_PARITY(x, y, z) ((x) ^ (y) ^ (z))
+#define SHA1_MAJ(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+
+  for (int i = 0; i < 20; i += 5) {
+    SHA1_ROUNDS5(SHA1_CH, i);
+  }
+  for (int i = 20; i < 40; i += 5) {
+    SHA1_ROUNDS5(SHA1_PARITY, i);
+  }
+  for (int i = 40; i < 60; i += 5) {
+    SHA1_ROUNDS5(SHA1_MAJ, i);
+  }
+  for (int i = 60; i < 80; i += 5) {
+    SHA1_ROUNDS5(SHA1_PARITY, i);
+  }
+
+#undef SHA1_ROUND
+#undef SHA1_ROUNDS5
+#undef SHA1_CH
+#undef SHA1_PARITY
+#undef SHA1_MAJ
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+void compress_scalar(State& state, const uint8_t* data, size_t blocks);
+
+#if defined(__x86_64__) || defined(__i386__)
+void compress_ssse3(State& state, const uint8_t* data, size_t blocks);
+void compress_avx2(State& state, const uint8_t* data, size_t blocks);
+void compress_shani(State& state, const uint8_t* data, size_t blocks);
+
+void compress_avx2x8(State* states, const uint8_t* const* data, size_t blocks);
+void compress_avx512x16(State* states, const uint8_t* const* data,
+                        size_t blocks);
+#endif
+
+}  // namespace fur::sha1::detail
@@ -0,0 +1,90 @@
+#include <sha1/compress.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+namespace fur::sha1::detail {
+
+/// Rotate every word of a vector left by `n` bits
+#define ROL_EPI32(x, n)                        \
+  _mm256_or_si256(_mm256_slli_epi32((x), (n)), \
+                  _mm256_srli_epi32((x), 32 - (n)))
+
+/// Compute the message schedules of two blocks at once, already added to the
+/// round constants. Each vector holds four words of the first block in its
+/// low half and the same four words of the second block in its high half,
+/// all shifts and shuffles below work on each half separately
+__attribute__((target("avx2"), always_inline)) static inline void schedule2(
+    const uint8_t* data0, const uint8_t* data1, uint32_t* wk0, uint32_t* wk1) {
+  // Words i to i + 3 of both blocks are in w[i / 4]
+  __m256i w[20];
+  const __m256i BSWAP = _mm256_set_epi8(
+      12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,  //
+      12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+  for (int i = 0; i < 4; i++) {
+    __m256i x = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(data0 + 16 * i))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data1 + 16 * i)), 1);
+    w[i] = _mm256_shuffle_epi8(x, BSWAP);
+  }
+
+  // w[i + 3] depends on w[i], which is computed in the same vector: the lane
+  // is first computed without it and then fixed. Words starting at i - 14
+  // are taken across two vectors
+  for (int i = 4; i < 8; i++) {
+    __m256i x = _mm256_bsrli_epi128(w[i - 1], 4);
+    x = _mm256_xor_si256(x, w[i - 2]);
+    x = _mm256_xor_si256(x, _mm256_alignr_epi8(w[i - 3], w[i - 4], 8));
+    x = _mm256_xor_si256(x, w[i - 4]);
+    x = ROL_EPI32(x, 1);
+
+    __m256i fix = _mm256_bslli_epi128(x, 12);
+    w[i] = _mm256_xor_si256(x, ROL_EPI32(fix, 1));
+  }
+
+  // Equivalent recurrence without dependencies inside a vector:
+  // w[i] = rol(w[i-6] ^ w[i-16] ^ w[i-28] ^ w[i-32], 2)
+  for (int i = 8; i < 20; i++) {
+    __m256i x = _mm256_alignr_epi8(w[i - 1], w[i - 2], 8);
+    x = _mm256_xor_si256(x, w[i - 4]);
+    x = _mm256_xor_si256(x, w[i - 7]);
+    x = _mm256_xor_si256(x, w[i - 8]);
+    w[i] = ROL_EPI32(x, 2);
+  }
+
+  for (int i = 0; i < 20; i++) {
+    __m256i x = _mm256_add_epi32(
+        w[i], _mm256_set1_epi32(static_cast<int>(K[i / 5])));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(wk0 + 4 * i),
+                     _mm256_castsi256_si128(x));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(wk1 + 4 * i),
+                     _mm256_extracti128_si256(x, 1));
+  }
+}
+
+#undef ROL_EPI32
+
+__attribute__((target("avx2"))) void compress_avx2(State& state,
+                                                   const uint8_t* data,
+                                                   size_t blocks) {
+  alignas(32) uint32_t wk0[80];
+  alignas(32) uint32_t wk1[80];
+  for (; blocks >= 2; blocks -= 2, data += 2 * BLOCK_SIZE) {
+    schedule2(data, data + BLOCK_SIZE, wk0, wk1);
+    rounds(state, wk0);
+    rounds(state, wk1);
+  }
+
+  // An odd block fills both halves, only the first schedule is used
+  if (blocks == 1) {
+    schedule2(data, data, wk0, wk1);
+    rounds(state, wk0);
+  }
+}
+
+}  // namespace fur::sha1::detail
+
+#endif
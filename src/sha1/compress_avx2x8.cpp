@@ -0,0 +1,62 @@
+#include <cstring>
+#include <sha1/compress.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+// Everything below, including the generic kernel, is compiled for AVX2
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+#include <sha1/compress_lanes.hpp>
+
+namespace fur::sha1::detail {
+
+namespace {
+
+/// Eight lanes in a 256 bit register
+struct Avx2x8 {
+  using Vec = __m256i;
+  static constexpr size_t LANES = 8;
+
+  static Vec load(const uint32_t* p) {
+    return _mm256_load_si256(reinterpret_cast<const __m256i*>(p));
+  }
+  static void store(uint32_t* p, Vec x) {
+    _mm256_store_si256(reinterpret_cast<__m256i*>(p), x);
+  }
+  static Vec set1(uint32_t x) {
+    return _mm256_set1_epi32(static_cast<int>(x));
+  }
+  static Vec add(Vec x, Vec y) { return _mm256_add_epi32(x, y); }
+  static Vec bxor(Vec x, Vec y) { return _mm256_xor_si256(x, y); }
+  template <int N>
+  static Vec rol(Vec x) {
+    return _mm256_or_si256(_mm256_slli_epi32(x, N),
+                           _mm256_srli_epi32(x, 32 - N));
+  }
+  static Vec ch(Vec x, Vec y, Vec z) {
+    return _mm256_xor_si256(z, _mm256_and_si256(x, _mm256_xor_si256(y, z)));
+  }
+  static Vec parity(Vec x, Vec y, Vec z) {
+    return _mm256_xor_si256(_mm256_xor_si256(x, y), z);
+  }
+  static Vec maj(Vec x, Vec y, Vec z) {
+    return _mm256_or_si256(_mm256_and_si256(x, y),
+                           _mm256_and_si256(z, _mm256_or_si256(x, y)));
+  }
+};
+
+}  // namespace
+
+void compress_avx2x8(State* states, const uint8_t* const* data,
+                     size_t blocks) {
+  compress_lanes<Avx2x8>(states, data, blocks);
+}
+
+}  // namespace fur::sha1::detail
+
+#pragma GCC pop_options
+
+#endif
@@ -0,0 +1,60 @@
+#include <cstring>
+#include <sha1/compress.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+// Everything below, including the generic kernel, is compiled for AVX-512
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+
+#include <sha1/compress_lanes.hpp>
+
+namespace fur::sha1::detail {
+
+namespace {
+
+/// Sixteen lanes in a 512 bit register. Rotations and the round functions
+/// map on single instructions
+struct Avx512x16 {
+  using Vec = __m512i;
+  static constexpr size_t LANES = 16;
+
+  static Vec load(const uint32_t* p) { return _mm512_load_si512(p); }
+  static void store(uint32_t* p, Vec x) { _mm512_store_si512(p, x); }
+  static Vec set1(uint32_t x) {
+    return _mm512_set1_epi32(static_cast<int>(x));
+  }
+  static Vec add(Vec x, Vec y) { return _mm512_add_epi32(x, y); }
+  static Vec bxor(Vec x, Vec y) { return _mm512_xor_si512(x, y); }
+  // The zero-masking form avoids a spurious uninitialized warning of GCC
+  // about the unmasked one
+  template <int N>
+  static Vec rol(Vec x) {
+    return _mm512_maskz_rol_epi32(0xFFFF, x, N);
+  }
+  // Truth tables of the round functions for `_mm512_ternarylogic_epi32`
+  static Vec ch(Vec x, Vec y, Vec z) {
+    return _mm512_ternarylogic_epi32(x, y, z, 0xCA);
+  }
+  static Vec parity(Vec x, Vec y, Vec z) {
+    return _mm512_ternarylogic_epi32(x, y, z, 0x96);
+  }
+  static Vec maj(Vec x, Vec y, Vec z) {
+    return _mm512_ternarylogic_epi32(x, y, z, 0xE8);
+  }
+};
+
+}  // namespace
+
+void compress_avx512x16(State* states, const uint8_t* const* data,
+                        size_t blocks) {
+  compress_lanes<Avx512x16>(states, data, blocks);
+}
+
+}  // namespace fur::sha1::detail
+
+#pragma GCC pop_options
+
+#endif
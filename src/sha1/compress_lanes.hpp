@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstring>
+#include <sha1/compress.hpp>
+
+/// Generic multi-buffer compression function, instantiated by every
+/// multi-buffer backend with its own vector operations. Each 32 bit lane of
+/// the vectors holds a different message, so all lanes go through the 80
+/// rounds together. This header contains no intrinsics and must be included
+/// after selecting the target instruction set, so that the instantiations
+/// are compiled for it
+namespace fur::sha1::detail {
+
+/// Compress `blocks` blocks of `V::LANES` messages
+/// @tparam V vector operations, with `LANES` lanes of 32 bits
+template <typename V>
+inline void compress_lanes(State* states, const uint8_t* const* data,
+                           size_t blocks) {
+  using Vec = typename V::Vec;
+  constexpr size_t LANES = V::LANES;
+
+  // States and messages are transposed so that each vector holds the same
+  // word of every lane
+  alignas(64) uint32_t words[16][LANES];
+  for (size_t i = 0; i < 5; i++)
+    for (size_t lane = 0; lane < LANES; lane++)
+      words[i][lane] = states[lane][i];
+  Vec a = V::load(words[0]), b = V::load(words[1]), c = V::load(words[2]),
+      d = V::load(words[3]), e = V::load(words[4]);
+
+  for (size_t block = 0; block < blocks; block++) {
+    for (size_t lane = 0; lane < LANES; lane++) {
+      const uint8_t* src = data[lane] + block * BLOCK_SIZE;
+      for (size_t i = 0; i < 16; i++) {
+        uint32_t word;
+        std::memcpy(&word, src + 4 * i, 4);
+        words[i][lane] = __builtin_bswap32(word);
+      }
+    }
+
+    Vec w[16];
+    for (size_t i = 0; i < 16; i++) w[i] = V::load(words[i]);
+    const Vec a0 = a, b0 = b, c0 = c, d0 = d, e0 = e;
+
+    // Same renaming scheme as the scalar rounds, the message schedule is
+    // computed in a ring of 16 words as the rounds go
+#define SHA1_W(i)                                                  \
+  ((i) < 16 ? w[(i)]                                               \
+            : (w[(i)&15] = V::template rol<1>(V::bxor(              \
+                   V::bxor(w[((i)-3) & 15], w[((i)-8) & 15]),        \
+                   V::bxor(w[((i)-14) & 15], w[(i)&15])))))
+#define SHA1_ROUND(F, a, b, c, d, e, i, k)                         \
+  e = V::add(V::add(e, V::template rol<5>(a)),                     \
+             V::add(V::F(b, c, d), V::add(k, SHA1_W(i))));         \
+  b = V::template rol<30>(b);
+#define SHA1_ROUNDS5(F, i, k)              \
+  SHA1_ROUND(F, a, b, c, d, e, (i), k)     \
+  SHA1_ROUND(F, e, a, b, c, d, (i) + 1, k) \
+  SHA1_ROUND(F, d, e, a, b, c, (i) + 2, k) \
+  SHA1_ROUND(F, c, d, e, a, b, (i) + 3, k) \
+  SHA1_ROUND(F, b, c, d, e, a, (i) + 4, k)
+
+    const Vec k0 = V::set1(K[0]), k1 = V::set1(K[1]), k2 = V::set1(K[2]),
+              k3 = V::set1(K[3]);
+    for (int i = 0; i < 20; i += 5) {
+      SHA1_ROUNDS5(ch, i, k0);
+    }
+    for (int i = 20; i < 40; i += 5) {
+      SHA1_ROUNDS5(parity, i, k1);
+    }
+    for (int i = 40; i < 60; i += 5) {
+      SHA1_ROUNDS5(maj, i, k2);
+    }
+    for (int i = 60; i < 80; i += 5) {
+      SHA1_ROUNDS5(parity, i, k3);
+    }
+
+#undef SHA1_W
+#undef SHA1_ROUND
+#undef SHA1_ROUNDS5
+
+    a = V::add(a, a0);
+    b = V::add(b, b0);
+    c = V::add(c, c0);
+    d = V::add(d, d0);
+    e = V::add(e, e0);
+  }
+
+  V::store(words[0], a);
+  V::store(words[1], b);
+  V::store(words[2], c);
+  V::store(words[3], d);
+  V::store(words[4], e);
+  for (size_t i = 0; i < 5; i++)
+    for (size_t lane = 0; lane < LANES; lane++)
+      states[lane][i] = words[i][lane];
+}
+
+}  // namespace fur::sha1::detail
@@ -0,0 +1,28 @@
+#include <sha1/compress.hpp>
+
+namespace fur::sha1::detail {
+
+void compress_scalar(State& state, const uint8_t* data, size_t blocks) {
+  uint32_t wk[80];
+  for (; blocks > 0; blocks--, data += BLOCK_SIZE) {
+    // Only the last 16 words of the message schedule are needed to compute
+    // the next one
+    uint32_t w[16];
+    for (int i = 0; i < 16; i++) {
+      w[i] = uint32_t(data[4 * i]) << 24 | uint32_t(data[4 * i + 1]) << 16 |
+             uint32_t(data[4 * i + 2]) << 8 | uint32_t(data[4 * i + 3]);
+      wk[i] = w[i] + K[0];
+    }
+    for (int i = 16; i < 80; i++) {
+      uint32_t next = rol(w[(i + 13) & 15] ^ w[(i + 8) & 15] ^
+                              w[(i + 2) & 15] ^ w[i & 15],
+                          1);
+      w[i & 15] = next;
+      wk[i] = next + K[i / 20];
+    }
+
+    rounds(state, wk);
+  }
+}
+
+}  // namespace fur::sha1::detail
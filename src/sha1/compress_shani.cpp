@@ -0,0 +1,75 @@
+#include <sha1/compress.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+namespace fur::sha1::detail {
+
+/// Four rounds with the SHA instructions, the round function must be a
+/// compile time constant
+#define SHA1_ROUNDS4(abcd, e, f)                              \
+  switch (f) {                                                \
+    case 0: abcd = _mm_sha1rnds4_epu32(abcd, e, 0); break;    \
+    case 1: abcd = _mm_sha1rnds4_epu32(abcd, e, 1); break;    \
+    case 2: abcd = _mm_sha1rnds4_epu32(abcd, e, 2); break;    \
+    default: abcd = _mm_sha1rnds4_epu32(abcd, e, 3); break;   \
+  }
+
+__attribute__((target("sha,sse4.1"))) void compress_shani(State& state,
+                                                          const uint8_t* data,
+                                                          size_t blocks) {
+  // Words are processed in reverse order by the SHA instructions
+  const __m128i REVERSE =
+      _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+  __m128i abcd = _mm_shuffle_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(state.data())), 0x1B);
+  __m128i e0 = _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0);
+  __m128i e1 = _mm_setzero_si128();
+
+  for (; blocks > 0; blocks--, data += BLOCK_SIZE) {
+    const __m128i abcd_save = abcd;
+    const __m128i e0_save = e0;
+
+    // Four words of the message schedule for each group of four rounds, only
+    // the last four groups are kept
+    __m128i msg[4];
+    for (int j = 0; j < 4; j++)
+      msg[j] = _mm_shuffle_epi8(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * j)),
+          REVERSE);
+
+    for (int g = 0; g < 20; g++) {
+      if (g >= 4) {
+        // w[4g..4g+3] from the previous four groups
+        __m128i w = _mm_sha1msg1_epu32(msg[g % 4], msg[(g + 1) % 4]);
+        w = _mm_xor_si128(w, msg[(g + 2) % 4]);
+        msg[g % 4] = _mm_sha1msg2_epu32(w, msg[(g + 3) % 4]);
+      }
+
+      // The two E registers alternate between the next E and the saved ABCD
+      __m128i& cur = (g % 2 == 0) ? e0 : e1;
+      __m128i& next = (g % 2 == 0) ? e1 : e0;
+      if (g == 0)
+        cur = _mm_add_epi32(cur, msg[0]);
+      else
+        cur = _mm_sha1nexte_epu32(cur, msg[g % 4]);
+      next = abcd;
+      SHA1_ROUNDS4(abcd, cur, g / 5);
+    }
+
+    e0 = _mm_sha1nexte_epu32(e0, e0_save);
+    abcd = _mm_add_epi32(abcd, abcd_save);
+  }
+
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state.data()),
+                   _mm_shuffle_epi32(abcd, 0x1B));
+  state[4] = static_cast<uint32_t>(_mm_extract_epi32(e0, 3));
+}
+
+#undef SHA1_ROUNDS4
+
+}  // namespace fur::sha1::detail
+
+#endif
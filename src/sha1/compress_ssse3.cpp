@@ -0,0 +1,79 @@
+#include <sha1/compress.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+namespace fur::sha1::detail {
+
+/// Rotate every word of a vector left by `n` bits
+#define ROL_EPI32(x, n) \
+  _mm_or_si128(_mm_slli_epi32((x), (n)), _mm_srli_epi32((x), 32 - (n)))
+
+/// Compute the 80 words of the message schedule, already added to the round
+/// constants, four at a time. Only the rounds remain scalar
+__attribute__((target("ssse3"), always_inline)) static inline void schedule(
+    const uint8_t* data, uint32_t* wk) {
+  alignas(16) uint32_t w[80];
+  const __m128i BSWAP = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7,
+                                     0, 1, 2, 3);
+
+  for (int i = 0; i < 16; i += 4) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 4 * i));
+    _mm_store_si128(reinterpret_cast<__m128i*>(w + i),
+                    _mm_shuffle_epi8(x, BSWAP));
+  }
+
+  // w[i + 3] depends on w[i], which is computed in the same vector: the lane
+  // is first computed without it and then fixed
+  for (int i = 16; i < 32; i += 4) {
+    __m128i x = _mm_srli_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + i - 4)), 4);
+    x = _mm_xor_si128(
+        x, _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + i - 8)));
+    x = _mm_xor_si128(
+        x, _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + i - 14)));
+    x = _mm_xor_si128(
+        x, _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + i - 16)));
+    x = ROL_EPI32(x, 1);
+
+    __m128i fix = _mm_slli_si128(x, 12);
+    x = _mm_xor_si128(x, ROL_EPI32(fix, 1));
+    _mm_store_si128(reinterpret_cast<__m128i*>(w + i), x);
+  }
+
+  // Equivalent recurrence without dependencies inside a vector:
+  // w[i] = rol(w[i-6] ^ w[i-16] ^ w[i-28] ^ w[i-32], 2)
+  for (int i = 32; i < 80; i += 4) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + i - 6));
+    x = _mm_xor_si128(
+        x, _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + i - 16)));
+    x = _mm_xor_si128(
+        x, _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + i - 28)));
+    x = _mm_xor_si128(
+        x, _mm_load_si128(reinterpret_cast<const __m128i*>(w + i - 32)));
+    _mm_store_si128(reinterpret_cast<__m128i*>(w + i), ROL_EPI32(x, 2));
+  }
+
+  for (int i = 0; i < 80; i += 4) {
+    __m128i k = _mm_set1_epi32(static_cast<int>(K[i / 20]));
+    __m128i x = _mm_load_si128(reinterpret_cast<const __m128i*>(w + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(wk + i), _mm_add_epi32(x, k));
+  }
+}
+
+#undef ROL_EPI32
+
+__attribute__((target("ssse3"))) void compress_ssse3(State& state,
+                                                     const uint8_t* data,
+                                                     size_t blocks) {
+  alignas(16) uint32_t wk[80];
+  for (; blocks > 0; blocks--, data += BLOCK_SIZE) {
+    schedule(data, wk);
+    rounds(state, wk);
+  }
+}
+
+}  // namespace fur::sha1::detail
+
+#endif
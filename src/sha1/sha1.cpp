@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <cstring>
+#include <sha1/compress.hpp>
+#include <sha1/sha1.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+namespace fur::sha1 {
+
+/// Instruction set extensions used by the backends
+struct CpuFeatures {
+  bool ssse3 = false;
+  bool sse41 = false;
+  bool avx2 = false;
+  bool avx512f = false;
+  bool sha = false;
+};
+
+/// Query the CPU about its features
+static CpuFeatures detect_features() {
+  CpuFeatures features;
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return features;
+  features.ssse3 = ecx & bit_SSSE3;
+  features.sse41 = ecx & bit_SSE4_1;
+
+  // AVX registers are usable only if the OS saves them on context switches
+  bool os_avx = false;
+  bool os_avx512 = false;
+  if (ecx & bit_OSXSAVE) {
+    unsigned int xcr0_lo, xcr0_hi;
+    __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    os_avx = (xcr0_lo & 0x6) == 0x6;
+    // AVX-512 also needs the mask registers and the upper halves of the
+    // 32 vector registers
+    os_avx512 = (xcr0_lo & 0xE6) == 0xE6;
+  }
+
+  if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    features.avx2 = os_avx && (ebx & bit_AVX2);
+    features.avx512f = os_avx512 && (ebx & bit_AVX512F);
+    features.sha = ebx & bit_SHA;
+  }
+#endif
+  return features;
+}
+
+/// Features of the CPU, detected on first use
+static const CpuFeatures& cpu_features() {
+  static const CpuFeatures features = detect_features();
+  return features;
+}
+
+const char* backend_name(Backend backend) {
+  switch (backend) {
+    case Backend::Scalar:
+      return "scalar";
+    case Backend::SSSE3:
+      return "ssse3";
+    case Backend::AVX2:
+      return "avx2";
+    case Backend::SHANI:
+      return "sha-ni";
+  }
+  return "unknown";
+}
+
+bool supported(Backend backend) {
+  const auto& features = cpu_features();
+  switch (backend) {
+    case Backend::Scalar:
+      return true;
+    case Backend::SSSE3:
+      return features.ssse3;
+    case Backend::AVX2:
+      return features.avx2;
+    case Backend::SHANI:
+      return features.sha && features.sse41 && features.ssse3;
+  }
+  return false;
+}
+
+Backend best_backend() {
+  static const Backend best = [] {
+    for (auto it = BACKENDS.rbegin(); it != BACKENDS.rend(); ++it)
+      if (supported(*it)) return *it;
+    return Backend::Scalar;
+  }();
+  return best;
+}
+
+CompressFn compress_fn(Backend backend) {
+  switch (backend) {
+#if defined(__x86_64__) || defined(__i386__)
+    case Backend::SSSE3:
+      return detail::compress_ssse3;
+    case Backend::AVX2:
+      return detail::compress_avx2;
+    case Backend::SHANI:
+      return detail::compress_shani;
+#endif
+    default:
+      return detail::compress_scalar;
+  }
+}
+
+const char* backend_name(MultiBackend backend) {
+  switch (backend) {
+    case MultiBackend::AVX2x8:
+      return "avx2x8";
+    case MultiBackend::AVX512x16:
+      return "avx512x16";
+  }
+  return "unknown";
+}
+
+bool supported(MultiBackend backend) {
+  const auto& features = cpu_features();
+  switch (backend) {
+    case MultiBackend::AVX2x8:
+      return features.avx2;
+    case MultiBackend::AVX512x16:
+      return features.avx512f;
+  }
+  return false;
+}
+
+size_t lanes(MultiBackend backend) {
+  switch (backend) {
+    case MultiBackend::AVX2x8:
+      return 8;
+    case MultiBackend::AVX512x16:
+      return 16;
+  }
+  return 1;
+}
+
+std::optional<MultiBackend> best_multi_backend() {
+  static const std::optional<MultiBackend> best =
+      []() -> std::optional<MultiBackend> {
+    if (supported(MultiBackend::AVX512x16)) return MultiBackend::AVX512x16;
+    // Eight lanes don't beat the SHA instructions
+    if (supported(Backend::SHANI)) return std::nullopt;
+    if (supported(MultiBackend::AVX2x8)) return MultiBackend::AVX2x8;
+    return std::nullopt;
+  }();
+  return best;
+}
+
+MultiCompressFn compress_fn(MultiBackend backend) {
+  switch (backend) {
+#if defined(__x86_64__) || defined(__i386__)
+    case MultiBackend::AVX2x8:
+      return detail::compress_avx2x8;
+    case MultiBackend::AVX512x16:
+      return detail::compress_avx512x16;
+#endif
+    default:
+      return nullptr;
+  }
+}
+
+State initial_state() {
+  return {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+}
+
+/// Copy the last partial block to `last`, followed by the padding
+/// @param last buffer of two blocks, filled with zeros
+/// @return number of blocks to compress in `last`, one or two
+static size_t pad(uint8_t* last, const uint8_t* tail, size_t tail_len,
+                  size_t total_len) {
+  // The message is followed by a single 1 bit, zeros and its length in bits,
+  // which might not fit in the last block
+  std::memcpy(last, tail, tail_len);
+  last[tail_len] = 0x80;
+
+  size_t last_len =
+      tail_len + 1 + 8 <= BLOCK_SIZE ? BLOCK_SIZE : 2 * BLOCK_SIZE;
+  uint64_t bits = static_cast<uint64_t>(total_len) * 8;
+  for (int i = 0; i < 8; i++)
+    last[last_len - 1 - i] = static_cast<uint8_t>(bits >> (8 * i));
+  return last_len / BLOCK_SIZE;
+}
+
+/// @return digest of the final state
+static Digest to_digest(const State& state) {
+  Digest digest;
+  for (size_t i = 0; i < state.size(); i++)
+    for (size_t j = 0; j < 4; j++)
+      digest[4 * i + j] = static_cast<uint8_t>(state[i] >> (24 - 8 * j));
+  return digest;
+}
+
+Digest finalize(State state, const uint8_t* tail, size_t tail_len,
+                size_t total_len, CompressFn compress) {
+  uint8_t last[2 * BLOCK_SIZE] = {};
+  compress(state, last, pad(last, tail, tail_len, total_len));
+  return to_digest(state);
+}
+
+Digest digest(const uint8_t* data, size_t len, Backend backend) {
+  CompressFn compress = compress_fn(backend);
+
+  State state = initial_state();
+  size_t blocks = len / BLOCK_SIZE;
+  compress(state, data, blocks);
+  return finalize(state, data + blocks * BLOCK_SIZE, len % BLOCK_SIZE, len,
+                  compress);
+}
+
+Digest digest(const uint8_t* data, size_t len) {
+  return digest(data, len, best_backend());
+}
+
+/// Lanes of the widest multi-buffer backend
+constexpr size_t MAX_LANES = 16;
+
+void digest_many(const uint8_t* const* data, const size_t* lens, size_t count,
+                 Digest* digests, MultiBackend backend) {
+  const size_t LANES = lanes(backend);
+  MultiCompressFn compress_many = compress_fn(backend);
+  CompressFn compress = compress_fn(best_backend());
+
+  for (size_t first = 0; first < count; first += LANES) {
+    const size_t group = std::min(LANES, count - first);
+
+    // The missing lanes of the last group hash the first message again,
+    // their digests are discarded
+    State states[MAX_LANES];
+    const uint8_t* lane_data[MAX_LANES];
+    size_t lane_lens[MAX_LANES];
+    for (size_t lane = 0; lane < LANES; lane++) {
+      size_t message = first + (lane < group ? lane : 0);
+      states[lane] = initial_state();
+      lane_data[lane] = data[message];
+      lane_lens[lane] = lens[message];
+    }
+
+    // Whole blocks shared by all lanes are compressed together
+    const size_t shortest = *std::min_element(lane_lens, lane_lens + LANES);
+    const size_t common = shortest / BLOCK_SIZE;
+    compress_many(states, lane_data, common);
+    for (size_t lane = 0; lane < LANES; lane++)
+      lane_data[lane] += common * BLOCK_SIZE;
+
+    const bool same_len =
+        std::all_of(lane_lens, lane_lens + LANES,
+                    [&](size_t len) { return len == shortest; });
+    if (same_len) {
+      // So is the padding, which has the same number of blocks everywhere
+      uint8_t last[MAX_LANES][2 * BLOCK_SIZE] = {};
+      size_t blocks = 0;
+      for (size_t lane = 0; lane < LANES; lane++) {
+        blocks = pad(last[lane], lane_data[lane], shortest % BLOCK_SIZE,
+                     shortest);
+        lane_data[lane] = last[lane];
+      }
+      compress_many(states, lane_data, blocks);
+      for (size_t lane = 0; lane < group; lane++)
+        digests[first + lane] = to_digest(states[lane]);
+      continue;
+    }
+
+    for (size_t lane = 0; lane < group; lane++) {
+      size_t blocks = lane_lens[lane] / BLOCK_SIZE - common;
+      compress(states[lane], lane_data[lane], blocks);
+      digests[first + lane] = finalize(
+          states[lane], lane_data[lane] + blocks * BLOCK_SIZE,
+          lane_lens[lane] % BLOCK_SIZE, lane_lens[lane], compress);
+    }
+  }
+}
+
+void digest_many(const uint8_t* const* data, const size_t* lens, size_t count,
+                 Digest* digests) {
+  auto multi = best_multi_backend();
+  if (multi) {
+    digest_many(data, lens, count, digests, *multi);
+    return;
+  }
+  for (size_t i = 0; i < count; i++) digests[i] = digest(data[i], lens[i]);
+}
+
+}  // namespace fur::sha1
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+/// SHA-1 with multiple implementations of the compression function, the
+/// fastest one supported by the CPU is selected at runtime
+namespace fur::sha1 {
+
+/// Size in bytes of the blocks processed by the compression function
+constexpr size_t BLOCK_SIZE = 64;
+
+/// A SHA-1 digest
+using Digest = std::array<uint8_t, 20>;
+
+/// Intermediate state of a SHA-1 computation
+using State = std::array<uint32_t, 5>;
+
+/// Compress `blocks` consecutive blocks of `BLOCK_SIZE` bytes into `state`
+using CompressFn = void (*)(State& state, const uint8_t* data, size_t blocks);
+
+/// Available implementations of the compression function
+enum class Backend {
+  /// Portable code, the reference for all others
+  Scalar,
+  /// Message schedule computed four words at a time with SSSE3
+  SSSE3,
+  /// Message schedules of two consecutive blocks computed at once in AVX2
+  /// registers, one block in each half
+  AVX2,
+  /// Dedicated SHA instructions (SHA-NI)
+  SHANI,
+};
+
+/// All backends, from the slowest to the fastest
+constexpr std::array<Backend, 4> BACKENDS = {Backend::Scalar, Backend::SSSE3,
+                                             Backend::AVX2, Backend::SHANI};
+
+/// @return a readable name for the backend
+const char* backend_name(Backend backend);
+
+/// @return true if the CPU can run the backend
+bool supported(Backend backend);
+
+/// @return the fastest backend supported by the CPU, detected once
+Backend best_backend();
+
+/// @return compression function of a backend, which must be supported
+CompressFn compress_fn(Backend backend);
+
+/// @return state before compressing the first block
+State initial_state();
+
+/// Compress the last partial block with the padding and produce the digest
+/// @param state state after compressing all whole blocks
+/// @param tail bytes after the last whole block, less than `BLOCK_SIZE`
+/// @param tail_len number of bytes in `tail`
+/// @param total_len number of bytes of the whole message
+Digest finalize(State state, const uint8_t* tail, size_t tail_len,
+                size_t total_len, CompressFn compress);
+
+/// Compress `blocks` blocks of many independent messages at once, one for
+/// each lane
+/// @param states one state for each lane
+/// @param data beginning of the next block of each lane
+using MultiCompressFn = void (*)(State* states, const uint8_t* const* data,
+                                 size_t blocks);
+
+/// Multi-buffer implementations, hashing many messages in parallel on a
+/// single core by keeping a different message in each lane of the vectors
+enum class MultiBackend {
+  /// Eight messages in AVX2 registers
+  AVX2x8,
+  /// Sixteen messages in AVX-512 registers
+  AVX512x16,
+};
+
+/// All multi-buffer backends, from the slowest to the fastest
+constexpr std::array<MultiBackend, 2> MULTI_BACKENDS = {
+    MultiBackend::AVX2x8, MultiBackend::AVX512x16};
+
+/// @return a readable name for the backend
+const char* backend_name(MultiBackend backend);
+
+/// @return true if the CPU can run the backend
+bool supported(MultiBackend backend);
+
+/// @return number of messages hashed together by the backend
+size_t lanes(MultiBackend backend);
+
+/// @return the multi-buffer backend to use when hashing many messages,
+/// nothing if hashing them one at a time is faster on this CPU
+std::optional<MultiBackend> best_multi_backend();
+
+/// @return compression function of a backend, which must be supported
+MultiCompressFn compress_fn(MultiBackend backend);
+
+/// @return digest of `len` bytes with the given backend
+Digest digest(const uint8_t* data, size_t len, Backend backend);
+
+/// @return digest of `len` bytes with the fastest backend
+Digest digest(const uint8_t* data, size_t len);
+
+/// Digests of `count` independent messages. Groups of messages are hashed
+/// together by the multi-buffer backend, which is fast only when they have
+/// the same length: blocks beyond the shortest message of a group are
+/// compressed one message at a time
+/// @param data beginning of each message
+/// @param lens length of each message
+/// @param digests receives the digest of each message
+void digest_many(const uint8_t* const* data, const size_t* lens, size_t count,
+                 Digest* digests, MultiBackend backend);
+
+/// Digests of `count` independent messages, with the multi-buffer backend if
+/// it is faster on this CPU and one message at a time otherwise
+void digest_many(const uint8_t* const* data, const size_t* lens, size_t count,
+                 Digest* digests);
+
+}  // namespace fur::sha1
@@ -0,0 +1,103 @@
+#include <cstring>
+#include <sha256/sha256.hpp>
+
+namespace fur::sha256 {
+
+/// Intermediate state of a SHA-256 computation
+using State = std::array<uint32_t, 8>;
+
+/// Round constants
+static constexpr uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static inline uint32_t ror(uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+/// Compress `blocks` consecutive blocks of `BLOCK_SIZE` bytes into `state`
+static void compress(State& state, const uint8_t* data, size_t blocks) {
+  for (; blocks > 0; blocks--, data += BLOCK_SIZE) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+      w[i] = uint32_t(data[4 * i]) << 24 | uint32_t(data[4 * i + 1]) << 16 |
+             uint32_t(data[4 * i + 2]) << 8 | uint32_t(data[4 * i + 3]);
+    for (int i = 16; i < 64; i++) {
+      uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3],
+             e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+      uint32_t s1 = ror(e, 6) ^ ror(e, 11) ^ ror(e, 25);
+      uint32_t ch = (e & f) ^ (~e & g);
+      uint32_t t1 = h + s1 + ch + K[i] + w[i];
+      uint32_t s0 = ror(a, 2) ^ ror(a, 13) ^ ror(a, 22);
+      uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+      uint32_t t2 = s0 + maj;
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+Digest digest(const uint8_t* data, size_t len) {
+  State state = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  size_t blocks = len / BLOCK_SIZE;
+  compress(state, data, blocks);
+
+  // Same padding as SHA-1: a single 1 bit, zeros and the length in bits
+  const size_t tail_len = len % BLOCK_SIZE;
+  uint8_t last[2 * BLOCK_SIZE] = {};
+  std::memcpy(last, data + blocks * BLOCK_SIZE, tail_len);
+  last[tail_len] = 0x80;
+
+  size_t last_len =
+      tail_len + 1 + 8 <= BLOCK_SIZE ? BLOCK_SIZE : 2 * BLOCK_SIZE;
+  uint64_t bits = static_cast<uint64_t>(len) * 8;
+  for (int i = 0; i < 8; i++)
+    last[last_len - 1 - i] = static_cast<uint8_t>(bits >> (8 * i));
+  compress(state, last, last_len / BLOCK_SIZE);
+
+  Digest result;
+  for (size_t i = 0; i < state.size(); i++)
+    for (size_t j = 0; j < 4; j++)
+      result[4 * i + j] = static_cast<uint8_t>(state[i] >> (24 - 8 * j));
+  return result;
+}
+
+Digest digest_pair(const Digest& left, const Digest& right) {
+  uint8_t pair[2 * sizeof(Digest)];
+  std::memcpy(pair, left.data(), left.size());
+  std::memcpy(pair + left.size(), right.data(), right.size());
+  return digest(pair, sizeof(pair));
+}
+
+}  // namespace fur::sha256
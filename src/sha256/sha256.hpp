@@ -0,0 +1,23 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/// SHA-256, used by BitTorrent v2 (BEP 52) for the merkle trees of files
+namespace fur::sha256 {
+
+/// Size in bytes of the blocks processed by the compression function
+constexpr size_t BLOCK_SIZE = 64;
+
+/// A SHA-256 digest
+using Digest = std::array<uint8_t, 32>;
+
+/// @return digest of `len` bytes
+Digest digest(const uint8_t* data, size_t len);
+
+/// @return digest of the concatenation of two digests, the hash of an
+/// internal node of a merkle tree
+Digest digest_pair(const Digest& left, const Digest& right);
+
+}  // namespace fur::sha256
@@ -1,9 +1,13 @@
 #include "torrent.hpp"
 
-#include <sstream>
+#include <algorithm>
+#include <optional>
+#include <stdexcept>
 
-#include "bencode/bencode_parser.hpp"
+#include "bencode/bencode_schema.hpp"
+#include "bencode/bencode_tape.hpp"
 #include "bencode/bencode_value.hpp"
+#include "config.hpp"
 #include "hash.hpp"
 #include "spdlog/spdlog.h"
 
@@ -12,88 +16,274 @@ using namespace fur::bencode;
 namespace fur {
 
 std::string File::filename() const {
-  std::stringstream sstream;
-
-  size_t i = 0;
+  std::string result;
   for (const auto& section : filepath) {
-    sstream << section;
-    if (!filepath.empty() && i != filepath.size() - 1) sstream << "/";
-    i += 1;
+    if (!result.empty()) result += '/';
+    result += section;
   }
-  return sstream.str();
+  return result;
 }
 
-TorrentFile::TorrentFile(const BencodeValue& tree) {
-  // This function receives a const reference and rightfully so: we don't need
-  // to mutate the bencode tree but `BencodeValue::value()` (which we need to
-  // use) returns a non-const reference. I hereby solemnly promise not to mutate
-  // the argument!
-  auto& tree_pinky_promise = const_cast<BencodeValue&>(tree);
+/// Collect the files of a v2 file tree, in the order of their paths
+/// @param path path of the directory `tree`
+/// @return false if the tree is malformed
+static bool collect_files_v2(TapeRef tree, std::vector<std::string>& path,
+                             std::vector<FileV2>& files) {
+  if (!tree.is_dict()) return false;
+
+  for (auto it = tree.begin(); it != tree.end(); ++it) {
+    std::string name((*it).string());
+    auto node = *(++it);
+
+    // A file is a directory with a single entry named with the empty string
+    auto properties = node.find("");
+    if (!properties) {
+      path.push_back(name);
+      bool valid = collect_files_v2(node, path, files);
+      path.pop_back();
+      if (!valid) return false;
+      continue;
+    }
 
-  // We know the torrent starts with a dict
-  auto& dict = dynamic_cast<BencodeDict&>(tree_pinky_promise).value();
+    FileV2 file{path, 0, {}, {}};
+    file.filepath.push_back(name);
 
-  this->announce_url =
-      dynamic_cast<BencodeString&>(*dict.at("announce")).value();
+    auto length = properties->find("length");
+    if (!length || !length->is_int() || length->integer() < 0) return false;
+    file.length = static_cast<size_t>(length->integer());
 
-  auto& bencode_info_dict = dynamic_cast<BencodeDict&>(*dict.at("info"));
+    auto root = properties->find("pieces root");
+    if (root) {
+      auto bytes = root->string();
+      if (!root->is_string() || bytes.size() != file.pieces_root.size())
+        return false;
+      std::copy(bytes.begin(), bytes.end(), file.pieces_root.begin());
+    }
+    files.push_back(std::move(file));
+  }
+  return true;
+}
 
-  std::string encoded_info_dict = BencodeParser::encode(bencode_info_dict);
-  this->info_hash = hash::compute_info_hash(encoded_info_dict);
+/// Parse the v2 metadata of a hybrid torrent and check that the piece layers
+/// match the roots of the files
+/// @param file_tree the "file tree" dict of the info dict
+/// @param piece_layers the "piece layers" dict of the torrent, if any
+/// @return nothing if the torrent has no valid v2 metadata
+static std::shared_ptr<const TorrentV2> parse_v2(
+    std::string_view file_tree, std::optional<std::string_view> piece_layers,
+    size_t piece_length, size_t pieces) {
+  auto logger = spdlog::get("custom");
 
-  auto& info_dict = bencode_info_dict.value();
+  // Pieces must be made of whole blocks, a power of two of them
+  const size_t piece_width = piece_length / merkle::BLOCK_SIZE;
+  if (piece_length % merkle::BLOCK_SIZE != 0 ||
+      merkle::next_pow2(piece_width) != piece_width) {
+    logger->warn("Invalid v2 piece length {}, using v1 hashes", piece_length);
+    return nullptr;
+  }
 
-  this->name = dynamic_cast<BencodeString&>(*info_dict.at("name")).value();
+  // Both dicts are keyed by paths and hashes, so they are read as tapes
+  auto tree = Tape::parse(file_tree);
+  auto v2 = std::make_shared<TorrentV2>();
+  std::vector<std::string> path;
+  if (!tree.valid() || !collect_files_v2(tree->root(), path, v2->files)) {
+    logger->warn("Malformed v2 metadata, using v1 hashes");
+    return nullptr;
+  }
 
-  auto it = info_dict.find("files");
-  if (it != info_dict.end()) {
-    // This is a multifile torrent
+  auto layers = Tape::parse(piece_layers.value_or("de"));
+  if (!layers.valid() || !layers->root().is_dict()) {
+    logger->warn("Malformed v2 metadata, using v1 hashes");
+    return nullptr;
+  }
 
-    auto& files_list =
-        dynamic_cast<BencodeList&>(*info_dict.at("files")).value();
-    for (auto& file_node : files_list) {
-      auto& file_dict = dynamic_cast<BencodeDict&>(*file_node).value();
+  // Every file begins on a piece boundary, the v1 files have padding files
+  // between them to keep this alignment
+  const merkle::node_t piece_padding = merkle::zero_subtree(piece_width);
+  for (auto& file : v2->files) {
+    if (file.length == 0) continue;
+
+    const size_t file_pieces = (file.length + piece_length - 1) / piece_length;
+    if (file.length <= piece_length) {
+      // A single piece covering the whole tree of the file
+      size_t blocks =
+          (file.length + merkle::BLOCK_SIZE - 1) / merkle::BLOCK_SIZE;
+      v2->piece_roots.push_back(
+          PieceRoot{file.pieces_root, file.length, merkle::next_pow2(blocks)});
+    } else {
+      std::string_view key(
+          reinterpret_cast<const char*>(file.pieces_root.data()),
+          file.pieces_root.size());
+      auto layer = layers->root().find(key);
+      if (!layer) {
+        logger->warn("Missing piece layer for a v2 file, using v1 hashes");
+        return nullptr;
+      }
 
-      File file;
-      file.length = dynamic_cast<BencodeInt&>(*file_dict.at("length")).value();
-      this->length += file.length;
-
-      auto& filepath =
-          dynamic_cast<BencodeList&>(*file_dict.at("path")).value();
-      for (auto& path_node : filepath) {
-        auto& segment = dynamic_cast<BencodeString&>(*path_node).value();
-        file.filepath.push_back(segment);
+      auto bytes = layer->string();
+      if (!layer->is_string() ||
+          bytes.size() != file_pieces * sizeof(merkle::node_t)) {
+        logger->warn("Malformed piece layer for a v2 file, using v1 hashes");
+        return nullptr;
+      }
+      file.piece_layer.resize(file_pieces);
+      for (size_t i = 0; i < file_pieces; i++)
+        std::copy(bytes.begin() + i * sizeof(merkle::node_t),
+                  bytes.begin() + (i + 1) * sizeof(merkle::node_t),
+                  file.piece_layer[i].begin());
+
+      // The layer is trusted only if it leads to the root of the file, which
+      // is covered by the info hash
+      if (merkle::root(file.piece_layer, merkle::next_pow2(file_pieces),
+                       piece_padding) != file.pieces_root) {
+        logger->warn("Piece layer doesn't match its v2 file, using v1 hashes");
+        return nullptr;
       }
 
-      this->files.push_back(file);
+      for (size_t i = 0; i < file_pieces; i++)
+        v2->piece_roots.push_back(PieceRoot{
+            file.piece_layer[i],
+            std::min(piece_length, file.length - i * piece_length),
+            piece_width});
     }
+  }
 
-  } else {
-    // This is a single file torrent
-    this->length = dynamic_cast<BencodeInt&>(*info_dict.at("length")).value();
+  if (v2->piece_roots.size() != pieces) {
+    logger->warn("v2 files don't match the v1 pieces, using v1 hashes");
+    return nullptr;
+  }
+  return v2;
+}
 
-    File file;
-    file.length = this->length;
-    file.filepath.push_back(name);
-    this->files.push_back(file);
+namespace {
+/// An entry of the "files" list of a multi-file torrent
+struct FileFields {
+  size_t length;
+  std::vector<std::string> path;
+};
+
+/// The "info" dict
+struct InfoFields {
+  std::optional<RawValue> file_tree;
+  std::optional<std::vector<FileFields>> files;
+  std::optional<size_t> length;
+  std::string name;
+  size_t piece_length;
+  std::string_view pieces;
+};
+
+/// The outermost dict of a .torrent file
+struct MetainfoFields {
+  std::string announce;
+  RawValue info;
+  std::optional<RawValue> piece_layers;
+};
+}  // namespace
+
+}  // namespace fur
+
+namespace fur::bencode {
+template <>
+struct Schema<FileFields> {
+  static constexpr auto fields =
+      std::make_tuple(field("length", &FileFields::length),
+                      field("path", &FileFields::path));
+};
+
+template <>
+struct Schema<InfoFields> {
+  static constexpr auto fields =
+      std::make_tuple(field("file tree", &InfoFields::file_tree),
+                      field("files", &InfoFields::files),
+                      field("length", &InfoFields::length),
+                      field("name", &InfoFields::name),
+                      field("piece length", &InfoFields::piece_length),
+                      field("pieces", &InfoFields::pieces));
+};
+
+template <>
+struct Schema<MetainfoFields> {
+  static constexpr auto fields =
+      std::make_tuple(field("announce", &MetainfoFields::announce),
+                      field("info", &MetainfoFields::info),
+                      field("piece layers", &MetainfoFields::piece_layers));
+};
+}  // namespace fur::bencode
+
+namespace fur {
+
+TorrentFile::TorrentFile(const BencodeValue& tree) {
+  // Trees built in memory are encoded canonically, so the info hash is the
+  // one of the original file
+  auto parsing = parse(tree.to_string());
+  if (!parsing.valid())
+    throw std::invalid_argument("Malformed torrent: " +
+                                error_to_string(parsing.error()));
+  *this = std::move(*parsing);
+}
+
+auto TorrentFile::parse(std::string_view content) -> TorrentFileResult {
+  auto metainfo = decode<MetainfoFields>(content);
+  if (!metainfo.valid()) {
+    auto error = metainfo.error();
+    return TorrentFileResult::ERROR(std::move(error));
+  }
+  auto info = decode<InfoFields>(metainfo->info.bytes);
+  if (!info.valid()) {
+    auto error = info.error();
+    return TorrentFileResult::ERROR(std::move(error));
   }
 
-  this->piece_length = static_cast<int>(
-      dynamic_cast<BencodeInt&>(*info_dict.at("piece length")).value());
+  TorrentFile torrent;
+  torrent.announce_url = std::move(metainfo->announce);
+  torrent.info_hash = hash::compute_info_hash(metainfo->info.bytes);
+  torrent.name = std::move(info->name);
+
+  if (info->files) {
+    // This is a multifile torrent
+    for (auto& fields : *info->files) {
+      File file;
+      file.length = fields.length;
+      file.filepath = std::move(fields.path);
+      torrent.length += file.length;
+      torrent.files.push_back(std::move(file));
+    }
+  } else if (info->length) {
+    // This is a single file torrent
+    torrent.length = *info->length;
 
-  auto pieces = dynamic_cast<BencodeString&>(*info_dict.at("pieces")).value();
+    File file;
+    file.length = torrent.length;
+    file.filepath.push_back(torrent.name);
+    torrent.files.push_back(file);
+  } else {
+    return TorrentFileResult::ERROR(SchemaError::MissingKey);
+  }
 
-  auto r_hashes = hash::split_piece_hashes(pieces);
+  torrent.piece_length = info->piece_length;
+  if (torrent.piece_length == 0)
+    return TorrentFileResult::ERROR(SchemaError::OutOfRange);
 
+  auto r_hashes = hash::split_piece_hashes(info->pieces);
   if (!r_hashes.valid()) {
     auto logger = spdlog::get("custom");
     logger->error("Could not split piece hashes: {}",
                   hash::error_to_string(r_hashes.error()));
-    throw std::invalid_argument("Malformed piece hashes string");
+    return TorrentFileResult::ERROR(SchemaError::WrongType);
   }
 
-  this->piece_hashes = *r_hashes;
-  this->pieces_count = this->length / this->piece_length;
+  torrent.piece_hashes = std::move(*r_hashes);
+  torrent.pieces_count = torrent.length / torrent.piece_length;
+
+  // Hybrid torrents can be verified block by block with their merkle trees
+  if (info->file_tree) {
+    std::optional<std::string_view> layers;
+    if (metainfo->piece_layers) layers = metainfo->piece_layers->bytes;
+    torrent.v2 = parse_v2(info->file_tree->bytes, layers, torrent.piece_length,
+                          torrent.piece_hashes.size());
+  }
+
+  return TorrentFileResult::OK(std::move(torrent));
 }
 
 // =================================================================================================
@@ -101,30 +291,43 @@ TorrentFile::TorrentFile(const BencodeValue& tree) {
 
 Torrent::Torrent()
     : _tid{0},
+      _descriptor{std::make_shared<const TorrentFile>()},
+      _layout{std::make_shared<const PieceLayout>(*_descriptor)},
       _update_interval{0},
+      _completed{0},
+      _completed_count{0},
+      _completed_known{true},
       state{TorrentState::Error},
-      pieces_processed{0} {}
+      pieces_processed{0},
+      pieces_checked{0} {}
 
 Torrent::Torrent(TorrentID tid, const TorrentFile& descriptor)
+    : Torrent(tid, descriptor,
+              download::bitfield::Bitfield(
+                  static_cast<uint32_t>(descriptor.piece_hashes.size()))) {}
+
+Torrent::Torrent(TorrentID tid, const TorrentFile& descriptor,
+                 std::optional<download::bitfield::Bitfield> completed)
     : _tid{tid},
-      _descriptor{descriptor},
+      _descriptor{std::make_shared<const TorrentFile>(descriptor)},
+      _layout{std::make_shared<const PieceLayout>(descriptor)},
       _update_interval{0},
+      _completed{completed.value_or(download::bitfield::Bitfield(
+          static_cast<uint32_t>(descriptor.piece_hashes.size())))},
+      _completed_count{_completed.count()},
+      _completed_known{completed.has_value()},
       state{TorrentState::Loading},
-      pieces_processed{0} {
+      pieces_processed{0},
+      pieces_checked{0} {
   announce();
 }
 
 std::vector<peer::Peer> Torrent::announce() {
   std::vector<peer::Peer> result;
-  auto response = peer::announce(_descriptor);
+  auto response = peer::announce(*_descriptor);
   if (response.valid()) {
     _update_interval = response->interval;
-    _peers = response->peers;
-
-    // Initial score is 1 for every peer
-    _peers_score.clear();
-    for (size_t i = 0; i < _peers.size(); i++) _peers_score.emplace_back(1u);
-
+    reset_peers(response->peers);
     return _peers;
   }
 
@@ -135,87 +338,149 @@ std::vector<peer::Peer> Torrent::announce() {
   return result;
 }
 
-void Torrent::atomic_add_peer_score(size_t peer_index) {
-  if (peer_index < _peers_score.size())
-    _peers_score[peer_index].fetch_add(1, std::memory_order_relaxed);
+void Torrent::atomic_record_peer_piece(
+    size_t peer_index, size_t bytes, std::chrono::steady_clock::duration rtt,
+    std::chrono::steady_clock::duration transfer) {
+  _peers_table.record_piece(peer_index, bytes, rtt, transfer,
+                            std::chrono::steady_clock::now());
 }
 
-std::discrete_distribution<size_t> Torrent::distribution() const {
-  std::vector<size_t> scores;
-  for (auto& atomic_score : _peers_score) {
-    size_t score = atomic_score.load(std::memory_order_relaxed);
-    scores.push_back(score);
+void Torrent::atomic_record_peer_failure(size_t peer_index, bool connection) {
+  _peers_table.record_failure(peer_index, connection,
+                              std::chrono::steady_clock::now());
+}
+
+void Torrent::refresh_peer_scores() {
+  _peers_table.refresh(std::chrono::steady_clock::now());
+}
+
+bool Torrent::atomic_add_peer_strike(size_t peer_index) {
+  if (peer_index >= _peers_strikes.size()) return false;
+  uint32_t strikes =
+      _peers_strikes[peer_index].fetch_add(1, std::memory_order_relaxed) + 1;
+  if (strikes != config::PEER_MAX_STRIKES) return false;
+
+  _peers_table.remove(peer_index);
+  return true;
+}
+
+bool Torrent::banned(size_t peer_index) const {
+  return peer_index < _peers_strikes.size() &&
+         _peers_strikes[peer_index].load(std::memory_order_relaxed) >=
+             config::PEER_MAX_STRIKES;
+}
+
+size_t Torrent::usable_peers() const { return _peers_table.usable(); }
+
+void Torrent::reset_peers(std::vector<peer::Peer> peers) {
+  _peers = std::move(peers);
+
+  // Every peer starts unknown, with no strikes
+  _peers_table.reset(_peers.size(), _descriptor->piece_length,
+                     std::chrono::steady_clock::now());
+  _peers_strikes.clear();
+  for (size_t i = 0; i < _peers.size(); i++) _peers_strikes.emplace_back(0u);
+}
+
+size_t Torrent::mark_completed(size_t index) {
+  std::lock_guard<std::mutex> lock(_completed_mtx);
+  const auto bit = static_cast<uint32_t>(index);
+  if (index < _completed.len && !_completed.get(bit)) {
+    _completed.set(bit);
+    _completed_count += 1;
   }
+  return _completed_count;
+}
 
-  return {scores.begin(), scores.end()};
+void Torrent::set_completed(download::bitfield::Bitfield completed) {
+  std::lock_guard<std::mutex> lock(_completed_mtx);
+  // Bitfields can't be resized, both have a bit for each piece
+  for (uint32_t i = 0; i < _completed.len && i < completed.len; i++)
+    _completed.set(i, completed.get(i));
+  _completed_count = _completed.count();
+  _completed_known = true;
+}
+
+std::optional<download::bitfield::Bitfield> Torrent::completed() const {
+  std::lock_guard<std::mutex> lock(_completed_mtx);
+  if (!_completed_known) return std::nullopt;
+  return _completed;
+}
+
+peer::Peer Torrent::peer_at(size_t peer_index) const {
+  return _peers[peer_index];
+}
+
+std::optional<size_t> Torrent::pick_peer(std::mt19937& gen) {
+  return _peers_table.pick(gen, std::chrono::steady_clock::now());
+}
+
+std::vector<uint64_t> Torrent::peer_scores() const {
+  return _peers_table.weights();
+}
+
+std::vector<download::peer_table::PeerStats> Torrent::peer_stats() const {
+  return _peers_table.stats(std::chrono::steady_clock::now());
 }
 
 TorrentID Torrent::tid() const { return _tid; }
 
-const TorrentFile& Torrent::descriptor() const { return _descriptor; }
+const TorrentFile& Torrent::descriptor() const { return *_descriptor; }
 
-std::vector<peer::Peer> Torrent::peers() const { return _peers; }
+std::shared_ptr<const TorrentFile> Torrent::shared_descriptor() const {
+  return _descriptor;
+}
 
-/// Generate all pieces of this torrent
-std::vector<Piece> Torrent::pieces() const {
-  const size_t PIECES_COUNT = _descriptor.pieces_count;
-  const size_t PIECE_LENGTH = _descriptor.piece_length;
-
-  std::vector<Piece> pieces;
-  pieces.reserve(PIECES_COUNT);
-
-  size_t cur_file = 0;
-  size_t cur_file_tot_size = _descriptor.files[cur_file].length;
-  size_t cur_file_rem_size = cur_file_tot_size;
-
-  // Iterate all pieces
-  for (size_t index = 0; index < PIECES_COUNT; index++) {
-    std::vector<Subpiece> subpieces;
-
-    // Must create multiple subpieces
-    if (cur_file_rem_size < PIECE_LENGTH) {
-      // Keep incrementing file index until there is no
-      // more space available in the piece
-      size_t piece_rem_len = PIECE_LENGTH;
-      while (piece_rem_len > 0) {
-        // Can fill entire file in the piece
-        if (cur_file_rem_size <= piece_rem_len) {
-          size_t offset = cur_file_tot_size - cur_file_rem_size;
-          std::string piece_filename = _descriptor.files[cur_file].filename();
-
-          subpieces.push_back({piece_filename, offset, cur_file_rem_size});
-          piece_rem_len -= cur_file_rem_size;
-
-          // Next file
-          cur_file += 1;
-          cur_file_tot_size = _descriptor.files[cur_file].length;
-          cur_file_rem_size = cur_file_tot_size;
-
-        }
-        // Cannot fill entire file in the piece
-        else {
-          size_t offset = cur_file_tot_size - cur_file_rem_size;
-          std::string piece_filename = _descriptor.files[cur_file].filename();
-          subpieces.push_back({piece_filename, offset, piece_rem_len});
-
-          cur_file_rem_size -= piece_rem_len;
-          piece_rem_len = 0;
-        }
-      }
-    }
-    // Single "piece/file" mapping
-    else {
-      size_t offset = cur_file_tot_size - cur_file_rem_size;
-      std::string piece_filename = _descriptor.files[cur_file].filename();
+std::vector<peer::Peer> Torrent::peers() const { return _peers; }
 
-      subpieces.push_back(Subpiece{piece_filename, offset, PIECE_LENGTH});
-      cur_file_rem_size -= PIECE_LENGTH;
-    }
+PieceLayout::PieceLayout(const TorrentFile& descriptor)
+    : PieceLayout(descriptor.files, descriptor.piece_length,
+                  descriptor.pieces_count) {}
+
+PieceLayout::PieceLayout(const std::vector<File>& files, size_t piece_length,
+                         size_t pieces_count)
+    : _piece_length{piece_length}, _pieces_count{pieces_count} {
+  _paths.reserve(files.size());
+  _offsets.reserve(files.size() + 1);
+
+  size_t offset = 0;
+  for (const auto& file : files) {
+    _paths.push_back(file.filename());
+    _offsets.push_back(offset);
+    offset += file.length;
+  }
+  _offsets.push_back(offset);
+}
 
-    pieces.push_back(Piece{index, subpieces});
+Piece PieceLayout::piece(size_t index) const {
+  Piece piece{index, {}};
+  const size_t total = _offsets.back();
+  size_t begin = std::min(index * _piece_length, total);
+  const size_t end = std::min(begin + _piece_length, total);
+  if (begin == end) return piece;
+
+  // Last file beginning at or before the piece, empty files sharing its
+  // offset come before it
+  auto after = std::upper_bound(_offsets.begin(), _offsets.end(), begin);
+  auto file = static_cast<uint32_t>(after - _offsets.begin() - 1);
+
+  for (; begin < end; file++) {
+    const size_t file_end = _offsets[file + 1];
+    if (file_end == _offsets[file]) continue;
+
+    const size_t len = std::min(end, file_end) - begin;
+    piece.subpieces.push_back(Subpiece{file, begin - _offsets[file], len});
+    begin += len;
   }
+  return piece;
+}
 
-  return pieces;
+const std::string& PieceLayout::path(uint32_t file) const {
+  return _paths[file];
 }
 
+size_t PieceLayout::pieces_count() const { return _pieces_count; }
+
+std::shared_ptr<const PieceLayout> Torrent::layout() const { return _layout; }
+
 }  // namespace fur
@@ -1,16 +1,26 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <deque>
+#include <download/bitfield.hpp>
+#include <download/peer_table.hpp>
+#include <memory>
+#include <merkle/merkle.hpp>
+#include <mutex>
+#include <optional>
 #include <peer.hpp>
 #include <random>
 #include <string>
+#include <string_view>
 #include <types.hpp>
 #include <vector>
 
+#include "bencode/bencode_schema.hpp"
 #include "bencode/bencode_value.hpp"
 #include "hash.hpp"
+#include "tfriend_fw.hpp"
 
 namespace fur {
 
@@ -28,6 +38,39 @@ struct File {
   [[nodiscard]] std::string filename() const;
 };
 
+/// Describes a file of a BitTorrent v2 torrent (BEP 52)
+struct FileV2 {
+  /// Path of the file relative to the download folder
+  std::vector<std::string> filepath;
+  /// Number of bytes in the file
+  size_t length;
+  /// Root of the merkle tree of the file, zero for empty files
+  merkle::node_t pieces_root;
+  /// Root of the subtree of each piece of the file, only for files longer
+  /// than a piece
+  std::vector<merkle::node_t> piece_layer;
+};
+
+/// Merkle subtree that a piece of a v2 torrent must match
+struct PieceRoot {
+  /// Root of the subtree
+  merkle::node_t root;
+  /// Bytes of the piece belonging to the file, the rest is padding
+  size_t data_len;
+  /// Number of leaves of the subtree, a power of two
+  size_t width;
+};
+
+/// BitTorrent v2 metadata of a hybrid torrent, which has both the v1 piece
+/// hashes and the v2 merkle trees
+struct TorrentV2 {
+  /// Files in the same order as the v1 files, without padding files
+  std::vector<FileV2> files;
+  /// Subtree of each v1 piece, padding files are shorter than a piece so
+  /// every piece has one
+  std::vector<PieceRoot> piece_roots;
+};
+
 /// Represents a parsed .torrent file
 struct TorrentFile {
   /// The URL used to announce ourselves to the tracker and fetch a list of
@@ -51,19 +94,33 @@ struct TorrentFile {
   std::string folder_name;
   /// Describe the structure of the file
   std::vector<File> files;
+  /// BitTorrent v2 metadata of hybrid torrents, empty otherwise. Shared since
+  /// descriptors are copied in every task
+  std::shared_ptr<const TorrentV2> v2;
 
   /// Construct an empty TorrentFile instance
   explicit TorrentFile() = default;
 
   /// Construct an instance of TorrentFile given a bencode::BencodeValue which
-  /// is assumed to be the parsed .torrent file
+  /// is assumed to be the parsed .torrent file, throws if it is malformed.
+  /// The tree is encoded again, so the info hash matches the original file
+  /// only if it was encoded canonically
   explicit TorrentFile(const bencode::BencodeValue& tree);
+
+  /// Parse the content of a .torrent file, the info hash is computed over the
+  /// original bytes of the "info" dict
+  static util::Result<TorrentFile, bencode::SchemaError> parse(
+      std::string_view content);
 };
 
+/// Result of parsing a .torrent file
+using TorrentFileResult = util::Result<TorrentFile, bencode::SchemaError>;
+
 /// Describes a subsection of a Piece, it is mapped to a single file
 struct Subpiece {
-  /// Path to the file this subpiece belongs to
-  std::string filepath;
+  /// Index of the file this subpiece belongs to, its path is given by
+  /// `PieceLayout::path`
+  uint32_t file;
   /// Offset from the beginning of the file
   size_t file_offset;
   /// Size in bytes
@@ -79,6 +136,41 @@ struct Piece {
   std::vector<Subpiece> subpieces;
 };
 
+/// Maps the pieces of a torrent on its files on demand, without generating
+/// all of them up front. The file holding a byte is found with a binary
+/// search over the offsets of the files, and each path is stored only once
+class PieceLayout {
+  /// Path of each file relative to the download folder
+  std::vector<std::string> _paths;
+  /// Offset of each file in the torrent, followed by the total length
+  std::vector<size_t> _offsets;
+  /// The length, in bytes, of each piece
+  size_t _piece_length;
+  /// Total number of pieces
+  size_t _pieces_count;
+
+ public:
+  /// Construct the layout of a torrent
+  explicit PieceLayout(const TorrentFile& descriptor);
+
+  /// Construct the layout of pieces over a list of files
+  /// @param files files in the order they appear in the torrent
+  /// @param piece_length length in bytes of each piece
+  /// @param pieces_count total number of pieces
+  PieceLayout(const std::vector<File>& files, size_t piece_length,
+              size_t pieces_count);
+
+  /// Map a piece on the files, empty files are skipped and the last piece
+  /// stops at the end of the torrent
+  [[nodiscard]] Piece piece(size_t index) const;
+
+  /// @return path of a file relative to the download folder
+  [[nodiscard]] const std::string& path(uint32_t file) const;
+
+  /// @return total number of pieces
+  [[nodiscard]] size_t pieces_count() const;
+};
+
 enum class TorrentState {
   Loading,
   Downloading,
@@ -92,16 +184,30 @@ enum class TorrentState {
 class Torrent {
   // Unique identifier for each torrent
   TorrentID _tid;
-  /// Parsed .torrent file descriptor
-  TorrentFile _descriptor;
+  /// Parsed .torrent file descriptor, shared with the tasks of the torrent
+  std::shared_ptr<const TorrentFile> _descriptor;
+  /// Mapping of the pieces on the files, shared with the tasks of the torrent
+  std::shared_ptr<const PieceLayout> _layout;
 
   /// Peers where to ask for the pieces and interval time
   std::vector<peer::Peer> _peers;
-  /// Hold the number of pieces successfully downloaded from each peer
-  std::deque<std::atomic_uint32_t> _peers_score;
+  /// Quality of each peer, picks them weighted by the rate at which they are
+  /// expected to deliver pieces. Banned peers have no weight
+  download::peer_table::PeerTable _peers_table;
+  /// Hold the number of corrupt pieces received from each peer
+  std::deque<std::atomic_uint32_t> _peers_strikes;
   /// Next peers update interval time
   size_t _update_interval;
 
+  /// Pieces already written to disk
+  download::bitfield::Bitfield _completed;
+  /// Number of bits set in `_completed`
+  size_t _completed_count;
+  /// False while the pieces already on disk are being checked
+  bool _completed_known;
+  /// Protects `_completed`, which is updated by the write-behind layer
+  mutable std::mutex _completed_mtx;
+
  public:
   /// Current state of the torrent,
   /// this value can be changed concurrently
@@ -111,6 +217,14 @@ class Torrent {
   /// this value can be changed concurrently
   std::atomic_uint32_t pieces_processed;
 
+  /// Number of pieces on disk verified while the torrent is loading,
+  /// this value can be changed concurrently
+  std::atomic_uint32_t pieces_checked;
+
+  /// Serializes the saves of the resume data, which go through the same
+  /// temporary file and must be written in the order they are taken
+  mutable std::mutex resume_mtx;
+
  public:
   /// Construct empty temporary torrent
   explicit Torrent();
@@ -120,13 +234,60 @@ class Torrent {
   /// @param descriptor parsed .torrent file descriptor
   Torrent(TorrentID tid, const TorrentFile& descriptor);
 
+  /// Construct a Torrent resuming a previous download
+  /// @param tid unique id of the torrent
+  /// @param descriptor parsed .torrent file descriptor
+  /// @param completed pieces already written to disk, nothing if the data on
+  /// disk is still to be checked
+  Torrent(TorrentID tid, const TorrentFile& descriptor,
+          std::optional<download::bitfield::Bitfield> completed);
+
   /// Generate a new list of available peers from the tracker
   /// and returns a copy
   std::vector<peer::Peer> announce();
 
-  /// Atomically increment score of a peer
-  /// @param peer_index index of the peer to increment
-  void atomic_add_peer_score(size_t peer_index);
+  /// Atomically record a piece received from a peer, raising its score if
+  /// it was faster than expected
+  /// @param peer_index index of the peer that sent the piece
+  /// @param bytes length of the piece
+  /// @param rtt time between the first request and the first block
+  /// @param transfer time between the first request and the last block
+  void atomic_record_peer_piece(size_t peer_index, size_t bytes,
+                                std::chrono::steady_clock::duration rtt,
+                                std::chrono::steady_clock::duration transfer);
+
+  /// Atomically record a failed attempt to get a piece from a peer
+  /// @param peer_index index of the peer that failed
+  /// @param connection true if the connection failed or broke, the peer is
+  /// then left alone for a while
+  void atomic_record_peer_failure(size_t peer_index, bool connection);
+
+  /// Score all peers again, so that those not heard of for a while drift
+  /// back towards the score of unknown peers
+  void refresh_peer_scores();
+
+  /// Atomically record a corrupt piece received from a peer, which is banned
+  /// after `config::PEER_MAX_STRIKES` of them
+  /// @param peer_index index of the peer that sent the piece
+  /// @return true if the peer has just been banned
+  bool atomic_add_peer_strike(size_t peer_index);
+
+  /// @return true if the peer sent too many corrupt pieces
+  [[nodiscard]] bool banned(size_t peer_index) const;
+
+  /// @return number of peers that are not banned
+  [[nodiscard]] size_t usable_peers() const;
+
+  /// Mark a piece as written to disk
+  /// @return number of pieces written to disk so far
+  size_t mark_completed(size_t index);
+
+  /// Set the pieces found on disk once they have been checked
+  void set_completed(download::bitfield::Bitfield completed);
+
+  /// Returns a copy of the pieces written to disk, nothing while the data on
+  /// disk is being checked
+  [[nodiscard]] std::optional<download::bitfield::Bitfield> completed() const;
 
   /// Returns unique id
   [[nodiscard]] TorrentID tid() const;
@@ -134,14 +295,36 @@ class Torrent {
   /// Returns the .torrent descriptor
   [[nodiscard]] const TorrentFile& descriptor() const;
 
+  /// Returns the .torrent descriptor, to be kept by tasks outliving a lock
+  [[nodiscard]] std::shared_ptr<const TorrentFile> shared_descriptor() const;
+
   /// Returns the loaded peers
   [[nodiscard]] std::vector<peer::Peer> peers() const;
 
-  /// Returns a peer distribution
-  [[nodiscard]] std::discrete_distribution<size_t> distribution() const;
+  /// Returns a copy of a single peer
+  [[nodiscard]] peer::Peer peer_at(size_t peer_index) const;
+
+  /// Pick a peer at random with probability proportional to its score, banned
+  /// peers and peers backing off after connection failures are never picked
+  /// @return index of the peer, nothing if no peer can be picked right now
+  [[nodiscard]] std::optional<size_t> pick_peer(std::mt19937& gen);
+
+  /// Returns the score of each peer, zero for banned peers
+  [[nodiscard]] std::vector<uint64_t> peer_scores() const;
+
+  /// Returns what is currently known about each peer
+  [[nodiscard]] std::vector<download::peer_table::PeerStats> peer_stats()
+      const;
+
+  /// Returns the mapping of the pieces on the files
+  [[nodiscard]] std::shared_ptr<const PieceLayout> layout() const;
+
+ private:
+  /// Replace the peers, resetting their scores and strikes
+  void reset_peers(std::vector<peer::Peer> peers);
 
-  /// Generate all pieces of this torrent
-  [[nodiscard]] std::vector<Piece> pieces() const;
+  // Befriend this class so the unit tests are able to access private members.
+  friend TestingFriend;
 };
 
 }  // namespace fur
@@ -0,0 +1,46 @@
+#include "bencode/bencode_lexer.hpp"
+
+#include <string_view>
+
+#include "catch2/catch.hpp"
+
+using namespace fur::bencode;
+
+TEST_CASE("[BencodeLexer] Integers") {
+  long value = 0;
+  auto lexing = lexer::integer("li-42ee", 1, value);
+  REQUIRE(lexing.valid());
+  REQUIRE(*lexing == 6);
+  REQUIRE(value == -42);
+
+  REQUIRE(lexer::integer("i42", 0, value).error() ==
+          BencodeParserError::IntFormat);
+  for (std::string_view input :
+       {"ie", "i-0e", "i4x2e", "i99999999999999999999e"})
+    REQUIRE(lexer::integer(input, 0, value).error() ==
+            BencodeParserError::IntValue);
+}
+
+TEST_CASE("[BencodeLexer] Strings") {
+  std::string_view value;
+  auto lexing = lexer::string("l4:spam0:e", 1, value);
+  REQUIRE(lexing.valid());
+  REQUIRE(*lexing == 7);
+  REQUIRE(value == "spam");
+
+  lexing = lexer::string("l4:spam0:e", 7, value);
+  REQUIRE(lexing.valid());
+  REQUIRE(*lexing == 9);
+  REQUIRE(value.empty());
+
+  // The length alone is read even if the content is missing
+  size_t len = 0;
+  lexing = lexer::string_length("4:spa", 0, len);
+  REQUIRE(lexing.valid());
+  REQUIRE(*lexing == 2);
+  REQUIRE(len == 4);
+
+  for (std::string_view input : {"4:spa", "4spam", "4", "-1:a"})
+    REQUIRE(lexer::string(input, 0, value).error() ==
+            BencodeParserError::InvalidString);
+}
@@ -0,0 +1,77 @@
+#include "bencode/bencode_reader.hpp"
+
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+
+using namespace fur::bencode;
+
+/// Records every event as a short string
+class Recorder : public BencodeVisitor {
+ public:
+  std::vector<std::string> events;
+
+  void integer(long value) override {
+    events.push_back("i" + std::to_string(value));
+  }
+  void string(std::string_view value) override {
+    events.push_back("s" + std::string(value));
+  }
+  void key(std::string_view key) override {
+    events.push_back("k" + std::string(key));
+  }
+  void begin_list() override { events.emplace_back("l"); }
+  void begin_dict() override { events.emplace_back("d"); }
+  void end() override { events.emplace_back("e"); }
+};
+
+TEST_CASE("[BencodeReader] Events of nested values") {
+  Recorder recorder;
+  REQUIRE(BencodeReader::read("d4:listli-1e2:abe3:numi7ee", recorder).valid());
+  REQUIRE(recorder.events == std::vector<std::string>{"d", "klist", "l", "i-1",
+                                                      "sab", "e", "knum", "i7",
+                                                      "e"});
+}
+
+TEST_CASE("[BencodeReader] Feed data in pieces") {
+  const std::string input = "d5:peers12:abcdefghijkl8:intervali1800ee";
+
+  Recorder whole;
+  REQUIRE(BencodeReader::read(input, whole).valid());
+
+  // Feed one more byte at a time, keeping what was not consumed as a network
+  // receive buffer would
+  Recorder split;
+  BencodeReader reader;
+  std::string buffer;
+  for (char byte : input) {
+    buffer += byte;
+    auto consumed = reader.feed(buffer, split);
+    REQUIRE(consumed.valid());
+    buffer.erase(0, *consumed);
+  }
+  REQUIRE(reader.done());
+  REQUIRE(buffer.empty());
+  REQUIRE(reader.position() == input.size());
+  REQUIRE(split.events == whole.events);
+}
+
+TEST_CASE("[BencodeReader] Reject malformed input") {
+  auto error = [](const std::string& input) {
+    Recorder recorder;
+    auto reading = BencodeReader::read(input, recorder);
+    REQUIRE(!reading.valid());
+    return reading.error();
+  };
+
+  REQUIRE(error("") == BencodeParserError::InvalidString);
+  REQUIRE(error("i42") == BencodeParserError::IntFormat);
+  REQUIRE(error("iXe") == BencodeParserError::IntValue);
+  REQUIRE(error("10:spam") == BencodeParserError::InvalidString);
+  REQUIRE(error("4:spami1e") == BencodeParserError::InvalidString);
+  REQUIRE(error("li1e") == BencodeParserError::ListFormat);
+  REQUIRE(error("d1:ai1e") == BencodeParserError::DictFormat);
+  REQUIRE(error("d1:ae") == BencodeParserError::DictFormat);
+  REQUIRE(error("dli1eei1ee") == BencodeParserError::DictKey);
+}
@@ -0,0 +1,72 @@
+#include "bencode/bencode_schema.hpp"
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+
+using namespace fur::bencode;
+
+namespace {
+struct Point {
+  int x;
+  uint8_t y;
+};
+
+struct Shape {
+  std::optional<std::string> label;
+  std::vector<Point> points;
+  RawValue style;
+};
+}  // namespace
+
+namespace fur::bencode {
+template <>
+struct Schema<Point> {
+  static constexpr auto fields =
+      std::make_tuple(field("x", &Point::x), field("y", &Point::y));
+};
+
+template <>
+struct Schema<Shape> {
+  static constexpr auto fields =
+      std::make_tuple(field("label", &Shape::label),
+                      field("points", &Shape::points),
+                      field("style", &Shape::style));
+};
+}  // namespace fur::bencode
+
+TEST_CASE("[BencodeSchema] Decode into structs") {
+  const std::string input =
+      "d5:extrali1ed1:ai2eee6:pointsld1:xi-3e1:yi4eed1:xi5e1:yi255eee"
+      "5:styled5:colori1eee";
+  auto shape = decode<Shape>(input);
+  REQUIRE(shape.valid());
+
+  // Optional fields may be missing, unknown keys are skipped
+  REQUIRE(!shape->label.has_value());
+  REQUIRE(shape->points.size() == 2);
+  REQUIRE(shape->points[0].x == -3);
+  REQUIRE(shape->points[1].y == 255);
+  REQUIRE(shape->style.bytes == "d5:colori1ee");
+  REQUIRE(shape->style.bytes.data() == input.data() + input.find("d5:color"));
+}
+
+TEST_CASE("[BencodeSchema] Report typed errors") {
+  auto error = [](const std::string& input) {
+    auto point = decode<Point>(input);
+    REQUIRE(!point.valid());
+    return point.error();
+  };
+
+  REQUIRE(error("d1:xi1ee") == SchemaError::MissingKey);
+  REQUIRE(error("d1:x1:a1:yi1ee") == SchemaError::WrongType);
+  REQUIRE(error("li1ee") == SchemaError::WrongType);
+  REQUIRE(error("d1:xi1e1:yi256ee") == SchemaError::OutOfRange);
+  REQUIRE(error("d1:xi1e1:yi-1ee") == SchemaError::OutOfRange);
+  REQUIRE(error("d1:yi1e1:xi1ee") == SchemaError::InvalidBencode);
+  REQUIRE(error("d1:xi1e1:yi1e") == SchemaError::InvalidBencode);
+  REQUIRE(error("d1:xi1e1:yi1eei1e") == SchemaError::InvalidBencode);
+  REQUIRE(error("d1:xi1e1:yi1e1:zl") == SchemaError::InvalidBencode);
+}
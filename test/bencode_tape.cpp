@@ -0,0 +1,55 @@
+#include "bencode/bencode_tape.hpp"
+
+#include <string>
+
+#include "catch2/catch.hpp"
+
+using namespace fur::bencode;
+
+TEST_CASE("[BencodeTape] Navigate nested values") {
+  const std::string input = "d4:infod6:lengthi-42e6:piecesl2:ab0:ee3:keyi7ee";
+  auto tape = Tape::parse(input);
+  REQUIRE(tape.valid());
+  REQUIRE(tape->size() == 11);
+
+  auto root = tape->root();
+  REQUIRE(root.is_dict());
+  REQUIRE(root.size() == 4);
+
+  auto info = root.find("info");
+  REQUIRE(info.has_value());
+  REQUIRE(info->find("length")->integer() == -42);
+  REQUIRE(root.find("key")->integer() == 7);
+  REQUIRE(!root.find("missing").has_value());
+  REQUIRE(!info->find("length")->find("length").has_value());
+
+  auto pieces = info->find("pieces");
+  REQUIRE(pieces->is_list());
+  std::vector<std::string_view> strings;
+  for (auto element : *pieces) strings.push_back(element.string());
+  REQUIRE(strings == std::vector<std::string_view>{"ab", ""});
+
+  // Strings are views into the input, not copies
+  REQUIRE(strings[0].data() == input.data() + input.find("ab"));
+}
+
+TEST_CASE("[BencodeTape] Reject malformed input") {
+  auto error = [](const std::string& input) {
+    auto tape = Tape::parse(input);
+    REQUIRE(!tape.valid());
+    return tape.error();
+  };
+
+  REQUIRE(error("") == BencodeParserError::InvalidString);
+  REQUIRE(error("i42") == BencodeParserError::IntFormat);
+  REQUIRE(error("i-0e") == BencodeParserError::IntValue);
+  REQUIRE(error("i99999999999999999999e") == BencodeParserError::IntValue);
+  REQUIRE(error("5:spam") == BencodeParserError::InvalidString);
+  REQUIRE(error("i1ei2e") == BencodeParserError::InvalidString);
+  REQUIRE(error("lli1ee") == BencodeParserError::ListFormat);
+  REQUIRE(error("d1:ai1e") == BencodeParserError::DictFormat);
+  REQUIRE(error("d1:ae") == BencodeParserError::DictFormat);
+  REQUIRE(error("di1ei1ee") == BencodeParserError::DictKey);
+  REQUIRE(error("d1:bi1e1:ai1ee") == BencodeParserError::DictKeyOrder);
+  REQUIRE(error("d1:ai1e1:ai1ee") == BencodeParserError::DictKeyOrder);
+}
@@ -0,0 +1,38 @@
+#include "bencode/bencode_writer.hpp"
+
+#include <string>
+
+#include "bencode/bencode_parser.hpp"
+#include "catch2/catch.hpp"
+
+using namespace fur::bencode;
+
+TEST_CASE("[BencodeWriter] Write nested values") {
+  BencodeWriter writer;
+  writer.begin_dict()
+      .string("bytes")
+      .string(std::string("\0\xff", 2))
+      .string("list")
+      .begin_list()
+      .integer(-42)
+      .integer(0)
+      .begin_dict()
+      .end()
+      .end()
+      .end();
+  REQUIRE(writer.buffer() == std::string("d5:bytes2:\0\xff", 12) +
+                                 "4:listli-42ei0edeee");
+
+  // The encoded values can be parsed back
+  BencodeParser parser;
+  auto tree = parser.decode(writer.buffer());
+  REQUIRE(tree.valid());
+  REQUIRE((*tree)->to_string() == writer.buffer());
+
+  // The buffer is reused for the next values
+  writer.clear();
+  writer.value(**tree);
+  writer.integer(7);
+  REQUIRE(writer.take() == (*tree)->to_string() + "i7e");
+  REQUIRE(writer.buffer().empty());
+}
@@ -96,3 +96,66 @@ TEST_CASE("[Bitfield] Get bytes") {
   std::vector<uint8_t> bytes{128, 3};
   REQUIRE(bytes == Bitfield(bytes, 16).get_bytes());
 }
+
+TEST_CASE("[Bitfield] Bits past the length are cleared") {
+  // 11111111 11111111, only 12 bits used
+  Bitfield bf{std::vector<uint8_t>{255, 255}, 12};
+  REQUIRE(bf.get_bytes() == std::vector<uint8_t>{255, 240});
+  REQUIRE(bf.count() == 12);
+
+  // Missing bytes are zeros
+  Bitfield short_bf{std::vector<uint8_t>{128}, 20};
+  REQUIRE(short_bf.get_bytes() == std::vector<uint8_t>{128, 0, 0});
+  REQUIRE(!short_bf.get(19));
+}
+
+TEST_CASE("[Bitfield] Set algebra") {
+  // Long enough to go through both whole words and single bytes
+  const uint32_t LEN = 150;
+  Bitfield peer(LEN);
+  Bitfield ours(LEN);
+  Bitfield in_flight(LEN);
+  for (uint32_t i = 0; i < LEN; i += 3) peer.set(i);
+  for (uint32_t i = 0; i < LEN; i += 2) ours.set(i);
+  in_flight.set(9);
+  in_flight.set(141);
+
+  // Pieces the peer has, we lack and nobody is downloading
+  Bitfield wanted = peer;
+  wanted.and_not(ours).and_not(in_flight);
+  for (uint32_t i = 0; i < LEN; i++)
+    REQUIRE(wanted.get(i) ==
+            (i % 3 == 0 && i % 2 != 0 && i != 9 && i != 141));
+  REQUIRE(wanted.count() == 23);
+
+  Bitfield both = peer;
+  both &= ours;
+  for (uint32_t i = 0; i < LEN; i++) REQUIRE(both.get(i) == (i % 6 == 0));
+
+  Bitfield any = peer;
+  any |= ours;
+  for (uint32_t i = 0; i < LEN; i++)
+    REQUIRE(any.get(i) == (i % 3 == 0 || i % 2 == 0));
+
+  REQUIRE_THROWS(any &= Bitfield(LEN + 1));
+}
+
+TEST_CASE("[Bitfield] Find set bits") {
+  Bitfield bf(200);
+  REQUIRE(bf.find_first() == 200);
+  REQUIRE(bf.count() == 0);
+
+  for (uint32_t i : {3, 7, 8, 64, 71, 130, 199}) bf.set(i);
+  REQUIRE(bf.find_first() == 3);
+  REQUIRE(bf.find_next(4) == 7);
+  REQUIRE(bf.find_next(8) == 8);
+  REQUIRE(bf.find_next(9) == 64);
+  REQUIRE(bf.find_next(72) == 130);
+  REQUIRE(bf.find_next(131) == 199);
+  REQUIRE(bf.find_next(200) == 200);
+
+  std::vector<uint32_t> found;
+  bf.for_each_set([&](uint32_t i) { found.push_back(i); });
+  REQUIRE(found == std::vector<uint32_t>{3, 7, 8, 64, 71, 130, 199});
+  REQUIRE(bf.count() == 7);
+}
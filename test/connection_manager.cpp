@@ -0,0 +1,183 @@
+#include "download/connection_manager.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "asio.hpp"
+#include "catch2/catch.hpp"
+#include "peer.hpp"
+#include "torrent.hpp"
+
+using namespace fur;
+using namespace fur::download::connection_manager;
+using namespace fur::download::piece_pool;
+using namespace std::chrono_literals;
+
+/// @return true if `condition` holds within a few seconds
+static bool eventually(const std::function<bool()>& condition) {
+  const auto deadline = std::chrono::steady_clock::now() + 5s;
+  while (!condition()) {
+    if (std::chrono::steady_clock::now() > deadline) return false;
+    std::this_thread::sleep_for(10ms);
+  }
+  return true;
+}
+
+TEST_CASE("[ConnectionManager] Connect ahead of time and reuse connections") {
+  // Three peers listening, the kernel accepting their connections, and one
+  // refusing them since nothing listens on its port anymore
+  asio::io_context ctx;
+  const auto localhost = asio::ip::make_address_v4("127.0.0.1");
+  std::vector<std::unique_ptr<asio::ip::tcp::acceptor>> acceptors;
+  std::vector<peer::Peer> peers;
+  for (int i = 0; i < 4; i++) {
+    acceptors.push_back(std::make_unique<asio::ip::tcp::acceptor>(
+        ctx, asio::ip::tcp::endpoint{localhost, 0}));
+    peers.emplace_back(localhost.to_uint(),
+                       acceptors.back()->local_endpoint().port());
+  }
+  acceptors.back()->close();
+
+  auto torrent = std::make_shared<TorrentFile>();
+  torrent->piece_hashes.resize(1);
+  PiecePool pool(1024 * 1024);
+
+  // The refused peer is picked first, then all peers in turn
+  std::mutex mutex;
+  size_t next = 3;
+  std::vector<size_t> failed;
+  ConnectionManager manager(
+      Limits{2, 10, 3, 1s, 1s}, pool,
+      [&](TorrentID) -> std::optional<Candidate> {
+        std::lock_guard<std::mutex> lock(mutex);
+        const size_t index = next;
+        next = (next + 1) % peers.size();
+        return Candidate{index, peers[index]};
+      },
+      [&](TorrentID, size_t index) {
+        std::lock_guard<std::mutex> lock(mutex);
+        failed.push_back(index);
+      });
+  manager.add_torrent(1, torrent);
+
+  // The failure is reported, the slot going to a listening peer instead
+  std::vector<Connection> lent;
+  std::set<size_t> indices;
+  for (int i = 0; i < 3; i++) {
+    auto connection = manager.acquire(1, 0, 5s);
+    REQUIRE(connection.has_value());
+    REQUIRE(connection->downloader->connected());
+    indices.insert(connection->index);
+    lent.push_back(std::move(*connection));
+  }
+  REQUIRE(indices == std::set<size_t>{0, 1, 2});
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    REQUIRE(!failed.empty());
+    for (size_t index : failed) REQUIRE(index == 3);
+  }
+
+  // No more than three connections for the torrent
+  REQUIRE(manager.connections() == 3);
+  REQUIRE(!manager.acquire(1, 0, 50ms).has_value());
+  REQUIRE(!manager.acquire(2, 0, 50ms).has_value());
+
+  // Connections given back are lent again, the last one first
+  const size_t reused = lent.back().index;
+  manager.release(std::move(lent.back()));
+  lent.pop_back();
+  auto connection = manager.acquire(1, 0, 50ms);
+  REQUIRE(connection.has_value());
+  REQUIRE(connection->index == reused);
+  lent.push_back(std::move(*connection));
+
+  // A discarded connection frees its slot for another attempt
+  manager.discard(std::move(lent.back()));
+  lent.pop_back();
+  connection = manager.acquire(1, 0, 5s);
+  REQUIRE(connection.has_value());
+  lent.push_back(std::move(*connection));
+  REQUIRE(manager.connections() == 3);
+
+  // Once the torrent is removed, connections lent are closed when given back
+  manager.remove_torrent(1);
+  REQUIRE(!manager.acquire(1, 0, 1s).has_value());
+  for (auto& open : lent) manager.release(std::move(open));
+  REQUIRE(eventually([&] { return manager.connections() == 0; }));
+}
+
+TEST_CASE("[ConnectionManager] Parked connections wait for their peer") {
+  asio::io_context ctx;
+  const auto localhost = asio::ip::make_address_v4("127.0.0.1");
+  asio::ip::tcp::acceptor acceptor(ctx, asio::ip::tcp::endpoint{localhost, 0});
+  const peer::Peer peer(localhost.to_uint(), acceptor.local_endpoint().port());
+
+  auto torrent = std::make_shared<TorrentFile>();
+  torrent->piece_hashes.resize(1);
+  PiecePool pool(1024 * 1024);
+
+  std::atomic<size_t> failures{0};
+  ConnectionManager manager(
+      Limits{1, 1, 1, 1s, 200ms}, pool,
+      [&](TorrentID) { return std::optional<Candidate>{Candidate{0, peer}}; },
+      [&](TorrentID, size_t) { failures++; });
+  manager.add_torrent(1, torrent);
+
+  auto connection = manager.acquire(1, 0, 5s);
+  REQUIRE(connection.has_value());
+  auto remote = acceptor.accept();
+
+  // No connection is lent while its peer is silent, it is once the peer
+  // sends something
+  manager.park(std::move(*connection));
+  REQUIRE(!manager.acquire(1, 0, 50ms).has_value());
+  const std::vector<uint8_t> unchoke{0, 0, 0, 1, 1};
+  asio::write(remote, asio::buffer(unchoke));
+  connection = manager.acquire(1, 0, 5s);
+  REQUIRE(connection.has_value());
+  REQUIRE(connection->downloader->connected());
+  REQUIRE(failures == 0);
+
+  // A peer silent for too long is given up on. The bytes sent above are still
+  // unread, a new connection takes the slot
+  manager.discard(std::move(*connection));
+  connection = manager.acquire(1, 0, 5s);
+  REQUIRE(connection.has_value());
+  manager.park(std::move(*connection));
+  REQUIRE(eventually([&] { return failures == 1; }));
+}
+
+TEST_CASE("[ConnectionManager] Parked connections closed by their peer") {
+  asio::io_context ctx;
+  const auto localhost = asio::ip::make_address_v4("127.0.0.1");
+  asio::ip::tcp::acceptor acceptor(ctx, asio::ip::tcp::endpoint{localhost, 0});
+  const peer::Peer peer(localhost.to_uint(), acceptor.local_endpoint().port());
+
+  auto torrent = std::make_shared<TorrentFile>();
+  torrent->piece_hashes.resize(1);
+  PiecePool pool(1024 * 1024);
+
+  // The peer hangs up long before the unchoke timeout
+  std::atomic<size_t> failures{0};
+  ConnectionManager manager(
+      Limits{1, 1, 1, 1s, 30s}, pool,
+      [&](TorrentID) { return std::optional<Candidate>{Candidate{0, peer}}; },
+      [&](TorrentID, size_t) { failures++; });
+  manager.add_torrent(1, torrent);
+
+  auto connection = manager.acquire(1, 0, 5s);
+  REQUIRE(connection.has_value());
+  auto remote = acceptor.accept();
+
+  // The connection is closed and reported right away, instead of waking up
+  // again and again until the timeout
+  manager.park(std::move(*connection));
+  remote.close();
+  REQUIRE(eventually([&] { return failures == 1; }));
+}
@@ -3,11 +3,16 @@
 #include <algorithm>
 #include <cstdint>
 #include <fstream>
+#include <future>
+#include <optional>
 #include <thread>
+#include <utility>
 #include <vector>
 
+#include "asio.hpp"
 #include "bencode/bencode_parser.hpp"
 #include "catch2/catch.hpp"
+#include "download/util.hpp"
 #include "torrent.hpp"
 #include "hash.hpp"
 #include "log/logger.hpp"
@@ -19,6 +24,41 @@ using namespace fur::peer;
 using namespace fur::bencode;
 using namespace fur::download::downloader;
 using namespace fur::hash;
+using namespace fur::download::piece_pool;
+
+/// Memory lent to the downloaders under test
+const size_t TEST_POOL_MEMORY = 16 * 1024 * 1024;
+
+/// Call `fetch` again while the peer is choking us, like the connection
+/// manager does once the peer sends something
+template <typename Fetch>
+static auto unchoked(Fetch fetch) {
+  auto result = fetch();
+  for (int i = 0; i < 500 && !result.valid() &&
+                  result.error() == DownloaderError::Choked;
+       i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    result = fetch();
+  }
+  return result;
+}
+
+/// Joins a thread when leaving the scope, so that a failed `REQUIRE` doesn't
+/// destroy it while it is still running
+class JoinGuard {
+  std::thread& _thread;
+
+ public:
+  explicit JoinGuard(std::thread& thread) : _thread{thread} {}
+  ~JoinGuard() {
+    if (_thread.joinable()) _thread.join();
+  }
+};
+
+/// @return true if `future` becomes ready before the peer gives up
+static bool arrives(std::future<void> future) {
+  return future.wait_for(std::chrono::seconds(5)) == std::future_status::ready;
+}
 
 TEST_CASE("[Downloader] Ensure connected") {
   // Faker on port 4004 will read a BitTorrent handshake message and reply with
@@ -37,7 +77,8 @@ TEST_CASE("[Downloader] Ensure connected") {
   // port 4004 will send a bitfield for 1 piece.
   torrent.piece_hashes.resize(1);
 
-  Downloader down(torrent, peer);
+  PiecePool pool(TEST_POOL_MEMORY);
+  Downloader down(torrent, peer, pool);
 
   // Assert that the socket is not yet present (lazily initialized)
   REQUIRE(!TestingFriend::Downloader_socket(down).has_value());
@@ -65,19 +106,236 @@ TEST_CASE("[Downloader] Download one piece, same size as a block") {
        134, 11,  97,  182, 97,  133, 20,  155, 111, 180},
   };
 
-  Downloader down(torrent, peer);
+  PiecePool pool(TEST_POOL_MEMORY);
+  Downloader down(torrent, peer, pool);
 
-  std::vector<Subpiece> subpieces = { Subpiece{ "Subpiece", 0, torrent.piece_length } };
-  auto maybe_downloaded = TestingFriend::Downloader_try_download(down, Piece{
-    0u, subpieces});
+  std::vector<Subpiece> subpieces = { Subpiece{ 0, 0, torrent.piece_length } };
+  auto maybe_downloaded = unchoked([&] {
+    return TestingFriend::Downloader_try_download(down, Piece{0u, subpieces});
+  });
 
   REQUIRE(maybe_downloaded.valid());
-  auto downloaded = *maybe_downloaded;
+  auto& downloaded = *maybe_downloaded;
 
   // 16384 is 16KB
   REQUIRE(downloaded.content.size() == 16384);
 }
 
+TEST_CASE("[Downloader] Fetch a piece and verify it later") {
+  // Same faker as above, the piece is verified outside of the `Downloader`
+  Peer peer("127.0.0.1", 4005);
+  TorrentFile torrent{};
+  torrent.length = 16384;
+  torrent.piece_length = 16384;
+  torrent.info_hash = {1,  2,  3,  4,  5,  6,  7,  8,  9,  10,
+                       11, 12, 13, 14, 15, 16, 17, 18, 19, 20};
+  const hash_t expected = {25,  229, 220, 52,  237, 167, 156, 163, 238, 115,
+                           134, 11,  97,  182, 97,  133, 20,  155, 111, 180};
+  // A wrong hash doesn't make the fetch fail
+  torrent.piece_hashes = std::vector<hash_t>{hash_t{}};
+
+  PiecePool pool(TEST_POOL_MEMORY);
+  Downloader down(torrent, peer, pool);
+
+  std::vector<Subpiece> subpieces = {
+      Subpiece{0, 0, torrent.piece_length}};
+  auto maybe_fetched =
+      unchoked([&] { return down.try_fetch(Piece{0u, subpieces}); });
+  REQUIRE(maybe_fetched.valid());
+
+  auto& fetched = *maybe_fetched;
+  REQUIRE(fetched.content.size() == 16384);
+  REQUIRE(!fur::download::verify(fetched, torrent));
+  torrent.piece_hashes[0] = expected;
+  REQUIRE(fur::download::verify(fetched, torrent));
+}
+
+TEST_CASE("[Downloader] Verify a partially hashed piece") {
+  PiecePool pool(TEST_POOL_MEMORY);
+  fur::download::Downloaded downloaded{0, pool.acquire(1000), {}, {}};
+  std::fill(downloaded.content.begin(), downloaded.content.end(), 7);
+
+  TorrentFile torrent{};
+  torrent.piece_hashes = {fur::sha1::digest(downloaded.content.data(), 1000)};
+
+  // Only the first bytes went through the hasher, the rest is hashed now
+  downloaded.hasher.update(downloaded.content.data(), 100);
+  REQUIRE(fur::download::verify(downloaded, torrent));
+}
+
+TEST_CASE("[Downloader] Resume a piece after being choked") {
+  // A peer of a piece of two blocks, all bytes equal to 1, that chokes us
+  // after the first block
+  asio::io_context ctx;
+  asio::ip::tcp::acceptor acceptor(
+      ctx, asio::ip::tcp::endpoint{asio::ip::make_address_v4("127.0.0.1"), 0});
+  Peer peer("127.0.0.1", acceptor.local_endpoint().port());
+
+  TorrentFile torrent{};
+  torrent.length = 32768;
+  torrent.piece_length = 32768;
+  std::vector<uint8_t> data(32768, 1);
+  torrent.piece_hashes = {fur::sha1::digest(data.data(), data.size())};
+
+  // The peer unchokes us once told to, the offsets of the blocks requested
+  // after each unchoke are reported
+  std::promise<void> first_unchoke, second_unchoke;
+  std::vector<uint32_t> offsets;
+  std::thread seeder([&] {
+    try {
+      auto conn = acceptor.accept();
+      std::vector<uint8_t> handshake(68);
+      asio::read(conn, asio::buffer(handshake));
+      asio::write(conn, asio::buffer(handshake));
+      const std::vector<uint8_t> bitfield{0, 0, 0, 2, 5, 0b10000000};
+      asio::write(conn, asio::buffer(bitfield));
+
+      // Our unchoke and interested
+      std::vector<uint8_t> buf(10);
+      asio::read(conn, asio::buffer(buf));
+
+      auto read_request = [&] {
+        std::vector<uint8_t> request(17);
+        asio::read(conn, asio::buffer(request));
+        offsets.push_back(decode_big_endian(
+            {request[9], request[10], request[11], request[12]}));
+      };
+      auto send_block = [&](uint32_t offset) {
+        std::vector<uint8_t> piece{0, 0, 0x40, 0x09, 7, 0, 0, 0, 0};
+        piece.push_back(static_cast<uint8_t>(offset >> 24));
+        piece.push_back(static_cast<uint8_t>(offset >> 16));
+        piece.push_back(static_cast<uint8_t>(offset >> 8));
+        piece.push_back(static_cast<uint8_t>(offset));
+        piece.insert(piece.end(), 16384, 1);
+        asio::write(conn, asio::buffer(piece));
+      };
+      const std::vector<uint8_t> choke{0, 0, 0, 1, 0};
+      const std::vector<uint8_t> unchoke{0, 0, 0, 1, 1};
+
+      // Both blocks are requested, the second request is dropped by the choke
+      if (!arrives(first_unchoke.get_future())) return;
+      asio::write(conn, asio::buffer(unchoke));
+      read_request();
+      read_request();
+      send_block(0);
+      asio::write(conn, asio::buffer(choke));
+
+      if (!arrives(second_unchoke.get_future())) return;
+      asio::write(conn, asio::buffer(unchoke));
+      read_request();
+      send_block(offsets.back());
+
+      // Wait for us to hang up
+      asio::error_code ec;
+      conn.read_some(asio::buffer(buf), ec);
+    } catch (const asio::system_error&) {
+      // We hung up early, the test has failed already
+    }
+  });
+  JoinGuard guard(seeder);
+
+  PiecePool pool(TEST_POOL_MEMORY);
+  {
+    Downloader down(torrent, peer, pool);
+    std::vector<Subpiece> subpieces = {Subpiece{0, 0, torrent.piece_length}};
+    auto download = [&] { return down.try_download(Piece{0u, subpieces}); };
+
+    // Nothing is waited for while choked, not even at the start
+    auto maybe_downloaded = download();
+    REQUIRE(!maybe_downloaded.valid());
+    REQUIRE(maybe_downloaded.error() == DownloaderError::Choked);
+    REQUIRE(!down.resumes(0));
+
+    // The first block is kept after the choke
+    first_unchoke.set_value();
+    for (int i = 0; i < 500 && !down.resumes(0); i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      maybe_downloaded = download();
+    }
+    REQUIRE(maybe_downloaded.error() == DownloaderError::Choked);
+    REQUIRE(down.resumes(0));
+
+    // Only the second block is requested again
+    second_unchoke.set_value();
+    maybe_downloaded = unchoked(download);
+    REQUIRE(maybe_downloaded.valid());
+    REQUIRE(!down.resumes(0));
+  }
+
+  seeder.join();
+  REQUIRE(offsets == std::vector<uint32_t>{0, 16384, 16384});
+}
+
+TEST_CASE("[Downloader] Reject blocks of the wrong size") {
+  // A peer of a piece of one block answering our request with an empty block
+  // past the end of the piece, then with a block shorter than requested
+  const std::vector<std::pair<uint32_t, size_t>> blocks{{16384, 0}, {0, 100}};
+  for (const auto& block : blocks) {
+    asio::io_context ctx;
+    asio::ip::tcp::acceptor acceptor(
+        ctx,
+        asio::ip::tcp::endpoint{asio::ip::make_address_v4("127.0.0.1"), 0});
+    Peer peer("127.0.0.1", acceptor.local_endpoint().port());
+
+    TorrentFile torrent{};
+    torrent.length = 16384;
+    torrent.piece_length = 16384;
+    std::vector<uint8_t> data(16384, 1);
+    torrent.piece_hashes = {fur::sha1::digest(data.data(), data.size())};
+
+    std::thread seeder([&] {
+      try {
+        auto conn = acceptor.accept();
+        std::vector<uint8_t> handshake(68);
+        asio::read(conn, asio::buffer(handshake));
+        asio::write(conn, asio::buffer(handshake));
+        const std::vector<uint8_t> bitfield{0, 0, 0, 2, 5, 0b10000000};
+        asio::write(conn, asio::buffer(bitfield));
+
+        // Our unchoke and interested, then our request once unchoked
+        std::vector<uint8_t> buf(17);
+        asio::read(conn, asio::buffer(buf, 10));
+        const std::vector<uint8_t> unchoke{0, 0, 0, 1, 1};
+        asio::write(conn, asio::buffer(unchoke));
+        asio::read(conn, asio::buffer(buf));
+
+        std::vector<uint8_t> piece;
+        auto push_u32 = [&](uint32_t value) {
+          for (int shift = 24; shift >= 0; shift -= 8)
+            piece.push_back(static_cast<uint8_t>(value >> shift));
+        };
+        push_u32(static_cast<uint32_t>(9 + block.second));
+        piece.push_back(7);
+        push_u32(0);
+        push_u32(block.first);
+        piece.insert(piece.end(), block.second, 1);
+        asio::write(conn, asio::buffer(piece));
+
+        // Wait for us to hang up
+        asio::error_code ec;
+        conn.read_some(asio::buffer(buf), ec);
+      } catch (const asio::system_error&) {
+        // We hung up early, the test has failed already
+      }
+    });
+
+    // The seeder is joined before checking the outcome
+    std::optional<DownloaderError> error;
+    {
+      PiecePool pool(TEST_POOL_MEMORY);
+      Downloader down(torrent, peer, pool);
+      std::vector<Subpiece> subpieces = {Subpiece{0, 0, torrent.piece_length}};
+      auto maybe_downloaded = unchoked(
+          [&] { return down.try_download(Piece{0u, subpieces}); });
+      if (!maybe_downloaded.valid()) error = maybe_downloaded.error();
+    }
+    seeder.join();
+
+    INFO("Block of " << block.second << " bytes at offset " << block.first);
+    REQUIRE(error == DownloaderError::InvalidMessage);
+  }
+}
+
 void test_alice(std::vector<DownloaderError>& errors) {
   // Faker on port 4006 seeds a whole alice.txt file contained in the fixtures/
   // directory
@@ -97,7 +355,8 @@ void test_alice(std::vector<DownloaderError>& errors) {
   // Parse TorrentFile
   TorrentFile torrent(*(*ben_tree));
 
-  Downloader down(torrent, peer);
+  PiecePool pool(TEST_POOL_MEMORY);
+  Downloader down(torrent, peer, pool);
 
   std::vector<int> pieces_left{0, 1, 2, 3, 4};
   auto original_pieces_left = pieces_left;
@@ -107,7 +366,7 @@ void test_alice(std::vector<DownloaderError>& errors) {
     auto pieces_left_copy = pieces_left;
     for (auto idx : pieces_left_copy) {
 
-      std::vector<Subpiece> subpieces = { Subpiece{ "Subpiece", 0, torrent.piece_length } };
+      std::vector<Subpiece> subpieces = { Subpiece{ 0, 0, torrent.piece_length } };
       auto maybe_downloaded =
           TestingFriend::Downloader_try_download(down, Piece{
             static_cast<size_t>(idx), subpieces});
@@ -67,3 +67,52 @@ TEST_CASE("[Hash] SHA1 dependency is correct") {
 
   REQUIRE(hash_to_hex(hash) == "3a773b8553a663941552a0df3b5968b4695cb212");
 }
+
+TEST_CASE("[Hash] Incremental hashing") {
+  std::vector<uint8_t> data(1000);
+  for (size_t i = 0; i < data.size(); i++) data[i] = static_cast<uint8_t>(i);
+
+  hash_t expected;
+  sha1::calc(data.data(), static_cast<int>(data.size()), expected.begin());
+
+  // Parts of every size, crossing the block boundaries in different ways
+  for (size_t part : {1, 7, 63, 64, 65, 128, 333, 1000}) {
+    Hasher hasher;
+    for (size_t offset = 0; offset < data.size(); offset += part)
+      hasher.update(data.data() + offset,
+                    std::min(part, data.size() - offset));
+
+    REQUIRE(hasher.consumed() == data.size());
+    REQUIRE(hasher.finalize() == expected);
+    REQUIRE(verify_piece(data, expected));
+  }
+
+  // A reset hasher starts from scratch
+  Hasher hasher;
+  hasher.update(data.data(), 10);
+  hasher.reset();
+  hasher.update(data.data(), data.size());
+  REQUIRE(hasher.finalize() == expected);
+}
+
+TEST_CASE("[Hash] Verify many pieces at once") {
+  std::vector<uint8_t> data(40 * 256);
+  for (size_t i = 0; i < data.size(); i++) data[i] = static_cast<uint8_t>(i);
+
+  // 40 pieces of 256 bytes, every third one with a wrong hash
+  std::vector<PieceView> pieces;
+  std::vector<hash_t> hashes;
+  for (size_t i = 0; i < 40; i++) {
+    pieces.push_back({data.data() + i * 256, 256});
+    hash_t hash;
+    sha1::calc(pieces.back().data, 256, hash.begin());
+    if (i % 3 == 0) hash[0] ^= 1;
+    hashes.push_back(hash);
+  }
+
+  auto valid = verify_pieces(pieces, hashes);
+  REQUIRE(valid.size() == 40);
+  for (size_t i = 0; i < 40; i++) REQUIRE(valid[i] == (i % 3 != 0));
+
+  REQUIRE(verify_pieces({}, {}).empty());
+}
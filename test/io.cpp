@@ -0,0 +1,65 @@
+#include "platform/io.hpp"
+
+#include <sys/stat.h>
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "tfolder.hpp"
+
+using namespace fur::platform::io;
+
+TEST_CASE("[IO] Touch with every preallocation mode") {
+  auto folder = make_test_folder("furrent_test_touch");
+
+  REQUIRE(touch(folder + "/none", 100000, Preallocation::None).valid());
+  REQUIRE(std::filesystem::file_size(folder + "/none") == 0);
+
+  REQUIRE(touch(folder + "/sparse", 100000, Preallocation::Sparse).valid());
+  REQUIRE(std::filesystem::file_size(folder + "/sparse") == 100000);
+
+  REQUIRE(touch(folder + "/full", 100000, Preallocation::Full).valid());
+  REQUIRE(std::filesystem::file_size(folder + "/full") == 100000);
+
+  // All blocks must be reserved
+  struct stat info {};
+  REQUIRE(stat((folder + "/full").c_str(), &info) == 0);
+  REQUIRE(static_cast<size_t>(info.st_blocks) * 512 >= 100000);
+
+  REQUIRE(touch(folder + "/empty", 0, Preallocation::Full).valid());
+  REQUIRE(std::filesystem::file_size(folder + "/empty") == 0);
+
+  std::filesystem::remove_all(folder);
+}
+
+TEST_CASE("[IO] Touch an existing file") {
+  auto folder = make_test_folder("furrent_test_touch_existing");
+
+  REQUIRE(touch(folder + "/file", 10).valid());
+  auto creation = touch(folder + "/file", 10);
+  REQUIRE(!creation.valid());
+  REQUIRE(creation.error() == IOError::FileAlreadyExists);
+
+  std::filesystem::remove_all(folder);
+}
+
+TEST_CASE("[IO] Touch many files in parallel") {
+  auto folder = make_test_folder("furrent_test_touch_all");
+
+  std::vector<FileSpec> files;
+  for (size_t i = 0; i < 1000; i++)
+    files.push_back({folder + "/" + std::to_string(i), i});
+
+  REQUIRE(touch_all(files, Preallocation::Sparse, 4).valid());
+  for (const auto& file : files)
+    REQUIRE(std::filesystem::file_size(file.filename) == file.size);
+
+  // Every file already exists now
+  auto creation = touch_all(files, Preallocation::Sparse, 4);
+  REQUIRE(!creation.valid());
+  REQUIRE(creation.error() == IOError::FileAlreadyExists);
+
+  std::filesystem::remove_all(folder);
+}
@@ -0,0 +1,40 @@
+#include "merkle/merkle.hpp"
+
+#include <vector>
+
+#include "catch2/catch.hpp"
+
+using namespace fur;
+using namespace fur::merkle;
+
+TEST_CASE("[Merkle] Roots of padded trees") {
+  std::vector<uint8_t> data(40000);
+  for (size_t i = 0; i < data.size(); i++) data[i] = static_cast<uint8_t>(i);
+
+  // Two whole blocks and a shorter one, padded with a zero leaf
+  node_t a = leaf(data.data(), BLOCK_SIZE);
+  node_t b = leaf(data.data() + BLOCK_SIZE, BLOCK_SIZE);
+  node_t c = leaf(data.data() + 2 * BLOCK_SIZE, data.size() - 2 * BLOCK_SIZE);
+  node_t zero{};
+
+  node_t expected = sha256::digest_pair(sha256::digest_pair(a, b),
+                                        sha256::digest_pair(c, zero));
+  REQUIRE(root({a, b, c}, 4) == expected);
+  REQUIRE(data_root(data.data(), data.size(), 4) == expected);
+
+  // A wider tree has a whole zero subtree on the right
+  REQUIRE(root({a, b, c}, 8) ==
+          sha256::digest_pair(expected, zero_subtree(4)));
+  REQUIRE(zero_subtree(1) == zero);
+  REQUIRE(zero_subtree(2) == sha256::digest_pair(zero, zero));
+
+  // Upper layers are padded with the roots of zero subtrees
+  node_t left = sha256::digest_pair(a, b);
+  REQUIRE(root({left}, 2, zero_subtree(2)) ==
+          sha256::digest_pair(left, zero_subtree(2)));
+
+  REQUIRE(root({a}, 1) == a);
+  REQUIRE(next_pow2(1) == 1);
+  REQUIRE(next_pow2(3) == 4);
+  REQUIRE(next_pow2(4) == 4);
+}
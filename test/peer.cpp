@@ -26,7 +26,7 @@ TEST_CASE("[Peer] Build from invalid IP string") {
 // Not publicly declared in "src/peer.hpp" because not really part of the public
 // API
 namespace fur::peer {
-Announce parse_tracker_response(const std::string& text);
+PeerResult parse_tracker_response(const std::string& text);
 }
 
 TEST_CASE("[Peer] Parse tracker response") {
@@ -34,11 +34,42 @@ TEST_CASE("[Peer] Parse tracker response") {
       "d8:intervali900e5:peers6:"
       "\xc0\x00\x02\x7b\x1a\xe1"
       "e";
-  Announce result =
-      parse_tracker_response(std::string{raw, sizeof(raw) - 1});
-  REQUIRE(result.interval == 900);
-  REQUIRE(result.peers.size() == 1);
+  auto result = parse_tracker_response(std::string{raw, sizeof(raw) - 1});
+  REQUIRE(result.valid());
+  REQUIRE(result->interval == 900);
+  REQUIRE(result->peers.size() == 1);
 
-  Peer peer = result.peers[0];
+  Peer peer = result->peers[0];
   REQUIRE(peer.address() == "192.0.2.123:6881");
 }
+
+TEST_CASE("[Peer] Parse tracker response with many peers") {
+  char raw[] =
+      "d8:completei3e8:intervali60e5:peers18:"
+      "\x7f\x00\x00\x01\x10\x00"
+      "\x7f\x00\x00\x02\x10\x01"
+      "\x7f\x00\x00\x03\x10\x02"
+      "e";
+  auto result = parse_tracker_response(std::string{raw, sizeof(raw) - 1});
+  REQUIRE(result.valid());
+  REQUIRE(result->interval == 60);
+  REQUIRE(result->peers.size() == 3);
+  REQUIRE(result->peers[2].address() == "127.0.0.3:4098");
+
+  // Missing peers
+  REQUIRE(!parse_tracker_response("d8:intervali60ee").valid());
+  REQUIRE(parse_tracker_response("d14:failure reason4:nopee").error() ==
+          PeerError::AnnounceError);
+}
+
+TEST_CASE("[Peer] Skip the other fields of a tracker response") {
+  // Keys of nested dicts are not mistaken for those of the response
+  auto result = parse_tracker_response(
+      "d5:extrad8:intervali1e5:peers6:abcdefe8:intervali30e5:peers0:e");
+  REQUIRE(result.valid());
+  REQUIRE(result->interval == 30);
+  REQUIRE(result->peers.empty());
+
+  REQUIRE(!parse_tracker_response("d8:intervali-1e5:peers0:e").valid());
+  REQUIRE(!parse_tracker_response("d8:intervali30e5:peers0:").valid());
+}
@@ -0,0 +1,73 @@
+#include "download/peer_selector.hpp"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "catch2/catch.hpp"
+
+using namespace fur::download::peer_selector;
+
+TEST_CASE("[PeerSelector] Picks are proportional to the weights") {
+  PeerSelector selector;
+  std::mt19937 gen(42);
+  REQUIRE(!selector.pick(gen).has_value());
+
+  // Peer 2 ends up with weight 5, peer 4 with weight 3, the others with 1
+  selector.reset(6, 1);
+  selector.set(2, 5);
+  selector.set(4, 3);
+  REQUIRE(selector.weights() == std::vector<uint64_t>{1, 1, 5, 1, 3, 1});
+
+  const int PICKS = 120000;
+  std::vector<int> picks(6);
+  for (int i = 0; i < PICKS; i++) picks[*selector.pick(gen)] += 1;
+
+  // Total weight is 12, allow a small deviation from the expected counts
+  const std::vector<uint64_t> weights = selector.weights();
+  for (size_t i = 0; i < picks.size(); i++) {
+    double expected = PICKS * static_cast<double>(weights[i]) / 12;
+    REQUIRE(picks[i] > expected * 0.95);
+    REQUIRE(picks[i] < expected * 1.05);
+  }
+}
+
+TEST_CASE("[PeerSelector] Removed peers are never picked") {
+  PeerSelector selector;
+  std::mt19937 gen(42);
+  selector.reset(100, 1);
+  REQUIRE(selector.usable() == 100);
+
+  // Only peers 0 and 77 are left
+  for (size_t i = 1; i < 100; i++)
+    if (i != 77) selector.remove(i);
+  selector.remove(5);
+  REQUIRE(selector.usable() == 2);
+
+  // Removed peers gain no weight, unknown peers are ignored
+  selector.set(5, 10);
+  selector.set(100, 10);
+  selector.remove(100);
+
+  // Reassigning every weight doesn't bring them back either
+  selector.assign(std::vector<uint64_t>(100, 3));
+  REQUIRE(selector.usable() == 2);
+  REQUIRE(selector.weights()[0] == 3);
+  REQUIRE(selector.weights()[5] == 0);
+
+  for (int i = 0; i < 1000; i++) {
+    size_t peer = *selector.pick(gen);
+    REQUIRE((peer == 0 || peer == 77));
+  }
+
+  // Peers without weight are not picked, but can gain it back
+  selector.set(0, 0);
+  REQUIRE(selector.usable() == 2);
+  for (int i = 0; i < 1000; i++) REQUIRE(*selector.pick(gen) == 77);
+  selector.set(0, 1);
+
+  selector.remove(0);
+  selector.remove(77);
+  REQUIRE(selector.usable() == 0);
+  REQUIRE(!selector.pick(gen).has_value());
+}
@@ -0,0 +1,147 @@
+#include "download/peer_table.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "catch2/catch.hpp"
+
+using namespace fur::download::peer_table;
+using namespace std::chrono_literals;
+
+/// Pieces of 256 KiB, the prior expects 256 KiB/s after a 200 ms round trip
+static QualityModel model() {
+  return QualityModel{256 * 1024, 200ms, 0.5, 60s};
+}
+
+TEST_CASE("[PeerTable] Faster peers are picked more often") {
+  PeerTable table(model());
+  const Clock::time_point now{};
+  table.reset(3, 256 * 1024, now);
+
+  // Unknown peers share the prior: 256 KiB in 1.2 s
+  REQUIRE(table.weights() == std::vector<uint64_t>{213, 213, 213});
+  auto stats = table.stats(now);
+  REQUIRE(stats[0].pieces == 0);
+  REQUIRE(!stats[0].idle.has_value());
+
+  // Peer 1 streams at 5 MiB/s after 20 ms, peer 2 at 64 KiB/s after 1 s
+  for (int i = 0; i < 10; i++) {
+    table.record_piece(1, 256 * 1024, 20ms, 70ms, now);
+    table.record_piece(2, 256 * 1024, 1s, 5s, now);
+  }
+  auto weights = table.weights();
+  REQUIRE(weights[1] > 10 * weights[0]);
+  REQUIRE(weights[2] < weights[0] / 2);
+
+  stats = table.stats(now);
+  REQUIRE(stats[1].pieces == 10);
+  REQUIRE(stats[1].throughput > 4.9 * 1024 * 1024);
+  REQUIRE(stats[1].rtt < 21ms);
+  REQUIRE(stats[2].rtt > 990ms);
+  REQUIRE(stats[2].idle == 0s);
+
+  std::mt19937 gen(42);
+  std::vector<int> picks(3);
+  for (int i = 0; i < 10000; i++) picks[*table.pick(gen, now)] += 1;
+  REQUIRE(picks[1] > 8 * picks[0]);
+  REQUIRE(picks[0] > picks[2]);
+
+  // Failures lower the weight, every peer keeps a chance
+  for (int i = 0; i < 20; i++) table.record_failure(0, false, now);
+  stats = table.stats(now);
+  REQUIRE(stats[0].failures == 20);
+  REQUIRE(stats[0].failure_rate > 0.99);
+  REQUIRE(stats[0].weight == 1);
+
+  // Removed peers are never picked again
+  table.remove(1);
+  table.record_piece(1, 256 * 1024, 20ms, 70ms, now);
+  REQUIRE(table.usable() == 2);
+  REQUIRE(table.stats(now)[1].weight == 0);
+  for (int i = 0; i < 1000; i++) REQUIRE(*table.pick(gen, now) != 1);
+}
+
+TEST_CASE("[PeerTable] Old measures fade towards the prior") {
+  PeerTable table(model());
+  const Clock::time_point start{};
+  table.reset(2, 256 * 1024, start);
+
+  for (int i = 0; i < 10; i++) table.record_failure(0, false, start);
+  table.record_piece(1, 256 * 1024, 20ms, 70ms, start);
+  const auto weights = table.weights();
+
+  // After one half life the failures count half, the piece too
+  auto stats = table.stats(start + 60s);
+  REQUIRE(stats[0].failure_rate == Approx(0.5).epsilon(0.01));
+  REQUIRE(stats[0].idle == 60s);
+  REQUIRE(stats[1].rtt > 100ms);
+
+  // Weights only change once refreshed, both peers getting closer to the
+  // prior after a long time
+  REQUIRE(table.weights() == weights);
+  table.refresh(start + 3600s);
+  REQUIRE(table.weights() == std::vector<uint64_t>{213, 213});
+
+  // A measure after a long pause replaces most of the old ones
+  table.record_failure(1, false, start + 3600s);
+  stats = table.stats(start + 3600s);
+  REQUIRE(stats[1].failure_rate == Approx(0.5));
+}
+
+TEST_CASE("[PeerTable] Unreachable peers back off") {
+  QualityModel quality = model();
+  quality.backoff_base = 10s;
+  quality.blacklist_failures = 3;
+  quality.blacklist_time = 1h;
+
+  PeerTable table(quality);
+  const Clock::time_point start{};
+  table.reset(2, 256 * 1024, start);
+  std::mt19937 gen(42);
+
+  // Missing pieces don't count, connection failures do
+  table.record_failure(0, false, start);
+  REQUIRE(!table.stats(start)[0].backoff.has_value());
+  table.record_failure(0, true, start);
+  REQUIRE(table.stats(start)[0].backoff == 10s);
+  REQUIRE(table.usable() == 2);
+  for (int i = 0; i < 100; i++) REQUIRE(*table.pick(gen, start) == 1);
+
+  // Only peer 0 is left, backing off
+  table.remove(1);
+  REQUIRE(!table.pick(gen, start + 9s).has_value());
+  auto stats = table.stats(start + 9s);
+  REQUIRE(stats[0].connection_failures == 1);
+  REQUIRE(stats[0].backoff == 1s);
+  REQUIRE(stats[0].since_failure == 9s);
+
+  // Each consecutive failure doubles the backoff, until the blacklist
+  REQUIRE(table.pick(gen, start + 10s) == 0u);
+  table.record_failure(0, true, start + 10s);
+  REQUIRE(table.stats(start + 10s)[0].backoff == 20s);
+  REQUIRE(!table.pick(gen, start + 29s).has_value());
+  REQUIRE(table.pick(gen, start + 30s) == 0u);
+  table.record_failure(0, true, start + 30s);
+  stats = table.stats(start + 30s);
+  REQUIRE(stats[0].blacklisted);
+  REQUIRE(stats[0].backoff == 1h);
+
+  // Rescoring doesn't bring peers back early, the blacklist is over after
+  // an hour
+  table.refresh(start + 40s);
+  REQUIRE(table.weights()[0] == 0);
+  REQUIRE(table.stats(start + 40s)[0].backoff == 1h - 10s);
+  REQUIRE(table.pick(gen, start + 30s + 1h) == 0u);
+
+  // A piece makes a peer available right away, even if its connection
+  // failed in the meantime
+  table.record_failure(0, true, start + 2h);
+  table.record_piece(0, 256 * 1024, 20ms, 70ms, start + 2h);
+  stats = table.stats(start + 2h);
+  REQUIRE(stats[0].connection_failures == 0);
+  REQUIRE(!stats[0].backoff.has_value());
+  REQUIRE(!stats[0].blacklisted);
+  REQUIRE(table.pick(gen, start + 2h) == 0u);
+}
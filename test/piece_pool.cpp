@@ -0,0 +1,72 @@
+#include "download/piece_pool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#include "catch2/catch.hpp"
+#include "platform/io.hpp"
+
+using namespace fur::download::piece_pool;
+
+TEST_CASE("[PiecePool] Buffers are recycled") {
+  PiecePool pool(1024 * 1024);
+
+  const uint8_t* first_data;
+  {
+    auto buffer = pool.acquire(100 * 1000);
+    REQUIRE(buffer.size() == 100 * 1000);
+    REQUIRE(reinterpret_cast<uintptr_t>(buffer.data()) %
+                fur::platform::io::DIRECT_IO_ALIGNMENT ==
+            0);
+    buffer.data()[buffer.size() - 1] = 42;
+    first_data = buffer.data();
+
+    auto stats = pool.stats();
+    REQUIRE(stats.buffers_in_use == 1);
+    // Rounded to the size class
+    REQUIRE(stats.allocated_bytes == 128 * 1024);
+    REQUIRE(stats.idle_bytes == 0);
+  }
+  REQUIRE(pool.stats().idle_bytes == 128 * 1024);
+
+  // Same size class, same memory
+  auto buffer = pool.acquire(128 * 1024);
+  REQUIRE(buffer.data() == first_data);
+  REQUIRE(pool.stats().allocated_bytes == 128 * 1024);
+
+  // Moving doesn't return the memory
+  PieceBuffer moved = std::move(buffer);
+  REQUIRE(buffer.empty());
+  REQUIRE(moved.data() == first_data);
+  REQUIRE(pool.stats().buffers_in_use == 1);
+
+  moved.reset();
+  REQUIRE(pool.stats().buffers_in_use == 0);
+}
+
+TEST_CASE("[PiecePool] Memory cap") {
+  PiecePool pool(256 * 1024);
+
+  // Idle buffers of another size are unmapped to make room
+  pool.acquire(128 * 1024);
+  REQUIRE(pool.stats().idle_bytes == 128 * 1024);
+  auto big = pool.acquire(256 * 1024);
+  REQUIRE(pool.stats().allocated_bytes == 256 * 1024);
+  REQUIRE(pool.stats().idle_bytes == 0);
+
+  // The pool is full, the borrower waits for the big buffer
+  std::atomic_bool acquired{false};
+  std::thread borrower([&] {
+    auto small = pool.acquire(16 * 1024);
+    acquired = true;
+  });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  REQUIRE(!acquired);
+  big.reset();
+  borrower.join();
+  REQUIRE(acquired);
+  REQUIRE(pool.stats().allocated_bytes <= 256 * 1024);
+}
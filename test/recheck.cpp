@@ -0,0 +1,93 @@
+#include "disk/recheck.hpp"
+
+#include <atomic>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "hash.hpp"
+#include "platform/io.hpp"
+#include "tfolder.hpp"
+
+using namespace fur;
+using namespace fur::disk;
+
+/// Write `content` to a new file
+static void write_file(const std::string& filepath,
+                       const std::vector<uint8_t>& content) {
+  REQUIRE(platform::io::touch(filepath, content.size()).valid());
+  REQUIRE(platform::io::write_bytes(filepath, content, 0).valid());
+}
+
+TEST_CASE("[Recheck] Verify pieces on disk") {
+  auto folder = make_test_folder("furrent_test_recheck");
+
+  // 8 pieces of 16 bytes on two files of 50 and 78 bytes
+  std::vector<uint8_t> content(128);
+  for (size_t i = 0; i < content.size(); i++)
+    content[i] = static_cast<uint8_t>(i * 7);
+
+  TorrentFile torrent;
+  torrent.piece_length = 16;
+  torrent.length = 128;
+  torrent.pieces_count = 8;
+  torrent.files = {File{{"a"}, 50}, File{{"b"}, 78}};
+  for (size_t i = 0; i < 8; i++) {
+    std::string piece(content.begin() + i * 16, content.begin() + i * 16 + 16);
+    torrent.piece_hashes.push_back(hash::compute_info_hash(piece));
+  }
+
+  write_file(folder + "/a", {content.begin(), content.begin() + 50});
+  write_file(folder + "/b", {content.begin() + 50, content.end()});
+
+  std::atomic_size_t calls{0};
+  std::atomic_size_t last_total{0};
+  auto progress = [&](size_t, size_t total) {
+    calls += 1;
+    last_total = total;
+    return true;
+  };
+
+  PieceLayout layout(torrent);
+  auto valid = recheck(folder, torrent, layout, progress, 3);
+  REQUIRE(valid.len == 8);
+  for (uint32_t i = 0; i < 8; i++) REQUIRE(valid.get(i));
+  REQUIRE(calls == 8);
+  REQUIRE(last_total == 8);
+
+  // Corrupt piece 3, which spans both files
+  REQUIRE(platform::io::write_bytes(folder + "/b", {0xFF}, 0).valid());
+  auto corrupted = recheck(folder, torrent, layout, {}, 2);
+  for (uint32_t i = 0; i < 8; i++) REQUIRE(corrupted.get(i) == (i != 3));
+
+  // Nothing is reported once the check is stopped
+  calls = 0;
+  auto stop = [&](size_t, size_t) {
+    calls += 1;
+    return false;
+  };
+  recheck(folder, torrent, layout, stop, 2);
+  REQUIRE(calls == 1);
+
+  std::filesystem::remove_all(folder);
+}
+
+TEST_CASE("[Recheck] Missing files fail their pieces") {
+  auto folder = make_test_folder("furrent_test_recheck_missing");
+
+  TorrentFile torrent;
+  torrent.piece_length = 4;
+  torrent.length = 8;
+  torrent.pieces_count = 2;
+  torrent.files = {File{{"a"}, 4}, File{{"b"}, 4}};
+  torrent.piece_hashes = {hash::compute_info_hash("aaaa"),
+                          hash::compute_info_hash("bbbb")};
+  write_file(folder + "/a", {'a', 'a', 'a', 'a'});
+
+  auto valid = recheck(folder, torrent, PieceLayout(torrent));
+  REQUIRE(valid.get(0));
+  REQUIRE(!valid.get(1));
+
+  std::filesystem::remove_all(folder);
+}
@@ -0,0 +1,118 @@
+#include "disk/resume.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "platform/io.hpp"
+#include "tfolder.hpp"
+
+using namespace fur;
+using namespace fur::disk;
+
+/// A torrent of 10 pieces spread on two files, created in `folder`
+static TorrentFile make_torrent(const std::string& folder) {
+  TorrentFile torrent;
+  torrent.info_hash.fill(0xAB);
+  torrent.piece_hashes.resize(10);
+  torrent.piece_length = 8;
+  torrent.length = 80;
+  torrent.pieces_count = 10;
+  torrent.name = "test";
+  torrent.files = {File{{"a"}, 30}, File{{"dir", "b"}, 50}};
+
+  std::filesystem::create_directories(folder + "/dir");
+  REQUIRE(platform::io::touch(folder + "/a", 30).valid());
+  REQUIRE(platform::io::touch(folder + "/dir/b", 50).valid());
+  return torrent;
+}
+
+TEST_CASE("[Resume] Save and load resume data") {
+  auto folder = make_test_folder("furrent_test_resume");
+  auto torrent = make_torrent(folder);
+
+  auto stamps = stamp_files(folder, torrent);
+  REQUIRE(stamps.has_value());
+  REQUIRE(stamps->size() == 2);
+  REQUIRE((*stamps)[0].length == 30);
+  REQUIRE((*stamps)[1].length == 50);
+
+  download::bitfield::Bitfield completed(10);
+  completed.set(0);
+  completed.set(3);
+  completed.set(9);
+  ResumeData data{torrent.info_hash, completed, *stamps};
+  REQUIRE(save_resume(resume_path(folder), data).valid());
+
+  auto loading = load_resume(resume_path(folder));
+  REQUIRE(loading.valid());
+  REQUIRE(loading->info_hash == torrent.info_hash);
+  REQUIRE(loading->completed.len == 10);
+  for (uint32_t i = 0; i < 10; i++)
+    REQUIRE(loading->completed.get(i) == (i == 0 || i == 3 || i == 9));
+  REQUIRE(loading->files == *stamps);
+  REQUIRE(resume_matches(*loading, torrent, *stamps));
+
+  std::filesystem::remove_all(folder);
+}
+
+TEST_CASE("[Resume] Stale resume data is rejected") {
+  auto folder = make_test_folder("furrent_test_resume_stale");
+  auto torrent = make_torrent(folder);
+
+  auto stamps = stamp_files(folder, torrent);
+  REQUIRE(stamps.has_value());
+  ResumeData data{torrent.info_hash, download::bitfield::Bitfield(10),
+                  *stamps};
+  REQUIRE(resume_matches(data, torrent, *stamps));
+
+  // Another torrent
+  auto other = torrent;
+  other.info_hash.fill(0xCD);
+  REQUIRE(!resume_matches(data, other, *stamps));
+
+  // A file modified while furrent was not running
+  auto mtime = std::filesystem::last_write_time(folder + "/dir/b");
+  std::filesystem::last_write_time(folder + "/dir/b",
+                                   mtime + std::chrono::seconds(5));
+  auto current = stamp_files(folder, torrent);
+  REQUIRE(current.has_value());
+  REQUIRE(!resume_matches(data, torrent, *current));
+
+  // An unfinished file that is not preallocated yet is shorter than in the
+  // torrent, which is fine as long as it has not changed
+  std::filesystem::resize_file(folder + "/a", 10);
+  auto unfinished = stamp_files(folder, torrent);
+  REQUIRE(unfinished.has_value());
+  REQUIRE((*unfinished)[0].length == 10);
+  data.files = *unfinished;
+  REQUIRE(resume_matches(data, torrent, *unfinished));
+
+  // A missing file
+  std::filesystem::remove(folder + "/a");
+  REQUIRE(!stamp_files(folder, torrent).has_value());
+
+  std::filesystem::remove_all(folder);
+}
+
+TEST_CASE("[Resume] Invalid resume files") {
+  auto folder = make_test_folder("furrent_test_resume_invalid");
+
+  auto missing = load_resume(resume_path(folder));
+  REQUIRE(!missing.valid());
+  REQUIRE(missing.error() == ResumeError::CannotRead);
+
+  // Bitfield shorter than the number of pieces
+  REQUIRE(platform::io::save_file_text(
+              resume_path(folder),
+              "d8:bitfield1:\x80" "5:filesle9:info hash20:"
+              "aaaaaaaaaaaaaaaaaaaa6:piecesi10ee")
+              .valid());
+  auto malformed = load_resume(resume_path(folder));
+  REQUIRE(!malformed.valid());
+  REQUIRE(malformed.error() == ResumeError::Malformed);
+
+  std::filesystem::remove_all(folder);
+}
@@ -0,0 +1,92 @@
+#include "sha1/sha1.hpp"
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "hash.hpp"
+#include "smallsha1/sha1.hpp"
+
+/// Digest of a string as hex
+static std::string hex_digest(const std::string& text,
+                              fur::sha1::Backend backend) {
+  auto digest = fur::sha1::digest(
+      reinterpret_cast<const uint8_t*>(text.data()), text.size(), backend);
+  return fur::hash::hash_to_hex(digest);
+}
+
+TEST_CASE("[SHA1] Known digests with every backend") {
+  for (auto backend : fur::sha1::BACKENDS) {
+    if (!fur::sha1::supported(backend)) continue;
+    INFO("Backend " << fur::sha1::backend_name(backend));
+
+    REQUIRE(hex_digest("", backend) ==
+            "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+    REQUIRE(hex_digest("abc", backend) ==
+            "a9993e364706816aba3e25717850c26c9cd0d89d");
+    REQUIRE(hex_digest(
+                "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+                backend) == "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+    REQUIRE(hex_digest(std::string(1000000, 'a'), backend) ==
+            "34aa973cd4c4daa4f61eeb2bdbad27316534016f");
+  }
+}
+
+TEST_CASE("[SHA1] Backends match smallsha1") {
+  std::mt19937 gen(42);
+  std::vector<uint8_t> data(64 * 1024);
+  for (auto& byte : data) byte = static_cast<uint8_t>(gen());
+
+  // Lengths around the block boundaries, where padding needs a second block
+  std::vector<size_t> lengths = {1, 55, 56, 63, 64, 65, 119, 120, 128, 1000,
+                                 16384, data.size()};
+  for (size_t len : lengths) {
+    fur::hash::hash_t expected;
+    ::sha1::calc(data.data(), static_cast<int>(len), expected.begin());
+
+    for (auto backend : fur::sha1::BACKENDS) {
+      if (!fur::sha1::supported(backend)) continue;
+      INFO("Backend " << fur::sha1::backend_name(backend) << ", length "
+                      << len);
+      REQUIRE(fur::sha1::digest(data.data(), len, backend) == expected);
+    }
+  }
+
+  REQUIRE(fur::sha1::supported(fur::sha1::best_backend()));
+}
+
+TEST_CASE("[SHA1] Multi-buffer backends match smallsha1") {
+  std::mt19937 gen(42);
+  std::vector<uint8_t> data(64 * 1024);
+  for (auto& byte : data) byte = static_cast<uint8_t>(gen());
+
+  // Equal lengths hashed entirely in parallel, including the padding, mixed
+  // lengths finished one at a time. Counts leave the last group incomplete
+  std::vector<std::vector<size_t>> cases = {
+      std::vector<size_t>(37, 1000), std::vector<size_t>(16, 55),
+      std::vector<size_t>(3, 0), {1, 64, 65, 119, 120, 1000, 16384, 5, 56}};
+  for (const auto& lens : cases) {
+    std::vector<const uint8_t*> pieces;
+    std::vector<fur::sha1::Digest> expected(lens.size());
+    for (size_t i = 0; i < lens.size(); i++) {
+      pieces.push_back(data.data() + 7 * i);
+      ::sha1::calc(pieces[i], static_cast<int>(lens[i]), expected[i].begin());
+    }
+
+    for (auto backend : fur::sha1::MULTI_BACKENDS) {
+      if (!fur::sha1::supported(backend)) continue;
+      INFO("Backend " << fur::sha1::backend_name(backend));
+
+      std::vector<fur::sha1::Digest> digests(lens.size());
+      fur::sha1::digest_many(pieces.data(), lens.data(), lens.size(),
+                             digests.data(), backend);
+      REQUIRE(digests == expected);
+    }
+
+    std::vector<fur::sha1::Digest> digests(lens.size());
+    fur::sha1::digest_many(pieces.data(), lens.data(), lens.size(),
+                           digests.data());
+    REQUIRE(digests == expected);
+  }
+}
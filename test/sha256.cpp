@@ -0,0 +1,32 @@
+#include "sha256/sha256.hpp"
+
+#include <string>
+
+#include "catch2/catch.hpp"
+#include "hash.hpp"
+
+/// Digest of a string as hex
+static std::string hex_digest(const std::string& text) {
+  auto digest = fur::sha256::digest(
+      reinterpret_cast<const uint8_t*>(text.data()), text.size());
+
+  std::string hex;
+  const char* DIGITS = "0123456789abcdef";
+  for (uint8_t byte : digest) {
+    hex += DIGITS[byte >> 4];
+    hex += DIGITS[byte & 15];
+  }
+  return hex;
+}
+
+TEST_CASE("[SHA256] Known digests") {
+  REQUIRE(hex_digest("") ==
+          "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+  REQUIRE(hex_digest("abc") ==
+          "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+  REQUIRE(hex_digest(
+              "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") ==
+          "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+  REQUIRE(hex_digest(std::string(1000000, 'a')) ==
+          "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+}
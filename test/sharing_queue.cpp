@@ -84,4 +84,17 @@ TEST_CASE("[Sharing queue][policy] Mutation") {
     }
 
     REQUIRE(count == TOTAL_COUNT / 2);
-}
\ No newline at end of file
+}
+
+TEST_CASE("[Sharing queue][policy] Size") {
+    fur::mt::SharedQueue<Item> items;
+    REQUIRE(items.size() == 0);
+
+    for (int i = 0; i < 10; i++)
+        items.insert({ i });
+    REQUIRE(items.size() == 10);
+
+    fur::policy::FIFOPolicy<Item> policy;
+    REQUIRE(items.try_extract(policy).valid());
+    REQUIRE(items.size() == 9);
+}
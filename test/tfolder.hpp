@@ -0,0 +1,13 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+/// Creates an empty folder for a test, removing any leftover from previous
+/// runs. Shared by the tests touching the disk.
+inline std::string make_test_folder(const std::string& name) {
+  auto folder = std::filesystem::temp_directory_path() / name;
+  std::filesystem::remove_all(folder);
+  std::filesystem::create_directories(folder);
+  return folder.string();
+}
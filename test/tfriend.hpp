@@ -36,4 +36,9 @@ struct TestingFriend {
   static std::vector<uint8_t>& Bitfield_storage(Bitfield& bf) {
     return bf.storage;
   }
+
+  static void Torrent_reset_peers(Torrent& torrent,
+                                  std::vector<peer::Peer> peers) {
+    torrent.reset_peers(std::move(peers));
+  }
 };
@@ -1,17 +1,187 @@
 #include "torrent.hpp"
 
+#include <chrono>
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
+#include "bencode/bencode_parser.hpp"
 #include "bencode/bencode_value.hpp"
 #include "catch2/catch.hpp"
+#include "config.hpp"
 #include "hash.hpp"
+#include "tfriend.hpp"
 
 using namespace fur;
 using namespace fur::hash;
 using namespace fur::bencode;
 
+TEST_CASE("[Torrent] Peers are banned after too many corrupt pieces") {
+  Torrent torrent;
+  TestingFriend::Torrent_reset_peers(
+      torrent, {peer::Peer("127.0.0.1", 4000), peer::Peer("127.0.0.1", 4001)});
+  REQUIRE(torrent.usable_peers() == 2);
+
+  // Only the last strike bans the peer
+  for (uint32_t i = 1; i < config::PEER_MAX_STRIKES; i++)
+    REQUIRE(!torrent.atomic_add_peer_strike(0));
+  REQUIRE(!torrent.banned(0));
+  REQUIRE(torrent.atomic_add_peer_strike(0));
+  REQUIRE(torrent.banned(0));
+  REQUIRE(!torrent.atomic_add_peer_strike(0));
+  REQUIRE(torrent.usable_peers() == 1);
+
+  // A banned peer is never picked, and gains no score
+  std::mt19937 gen(42);
+  for (int i = 0; i < 1000; i++) REQUIRE(torrent.pick_peer(gen) == 1u);
+  torrent.atomic_record_peer_piece(0, 1024, std::chrono::milliseconds(10),
+                                   std::chrono::milliseconds(20));
+  torrent.refresh_peer_scores();
+  REQUIRE(torrent.peer_scores()[0] == 0);
+  REQUIRE(torrent.peer_scores()[1] > 0);
+
+  // No peer can be picked once all of them are banned
+  for (uint32_t i = 0; i < config::PEER_MAX_STRIKES; i++)
+    torrent.atomic_add_peer_strike(1);
+  REQUIRE(torrent.usable_peers() == 0);
+  REQUIRE(!torrent.pick_peer(gen).has_value());
+
+  // Unknown peers are ignored
+  REQUIRE(!torrent.atomic_add_peer_strike(2));
+  REQUIRE(!torrent.banned(2));
+}
+
+TEST_CASE("[Torrent] Map pieces on files") {
+  // Pieces of 4 bytes over files of 10, 0 and 6 bytes
+  std::vector<File> files = {File{{"a"}, 10}, File{{"e"}, 0},
+                             File{{"dir", "b"}, 6}};
+  PieceLayout layout(files, 4, 4);
+  REQUIRE(layout.pieces_count() == 4);
+  REQUIRE(layout.path(2) == "dir/b");
+
+  auto first = layout.piece(0);
+  REQUIRE(first.index == 0);
+  REQUIRE(first.subpieces.size() == 1);
+  REQUIRE(first.subpieces[0].file == 0);
+  REQUIRE(first.subpieces[0].file_offset == 0);
+  REQUIRE(first.subpieces[0].len == 4);
+
+  // The empty file is skipped
+  auto across = layout.piece(2);
+  REQUIRE(across.subpieces.size() == 2);
+  REQUIRE(across.subpieces[0].file == 0);
+  REQUIRE(across.subpieces[0].file_offset == 8);
+  REQUIRE(across.subpieces[0].len == 2);
+  REQUIRE(across.subpieces[1].file == 2);
+  REQUIRE(across.subpieces[1].file_offset == 0);
+  REQUIRE(across.subpieces[1].len == 2);
+
+  auto last = layout.piece(3);
+  REQUIRE(last.subpieces.size() == 1);
+  REQUIRE(last.subpieces[0].file == 2);
+  REQUIRE(last.subpieces[0].file_offset == 2);
+  REQUIRE(last.subpieces[0].len == 4);
+
+  // Nothing past the end of the torrent
+  REQUIRE(layout.piece(4).subpieces.empty());
+}
+
+/// Bencoded string
+static std::string bstr(const std::string& text) {
+  return std::to_string(text.size()) + ":" + text;
+}
+
+/// Bencoded hybrid torrent with a single file of `data`, optionally breaking
+/// the piece layer
+static std::string hybrid_torrent(const std::vector<uint8_t>& data,
+                                  size_t piece_length, bool tamper) {
+  std::string pieces;
+  std::string layer;
+  for (size_t offset = 0; offset < data.size(); offset += piece_length) {
+    size_t len = std::min(piece_length, data.size() - offset);
+    auto sha1 = fur::sha1::digest(data.data() + offset, len);
+    pieces.append(sha1.begin(), sha1.end());
+    auto node = merkle::data_root(data.data() + offset, len,
+                                  piece_length / merkle::BLOCK_SIZE);
+    layer.append(node.begin(), node.end());
+  }
+  const size_t piece_count = pieces.size() / 20;
+
+  std::vector<merkle::node_t> nodes(piece_count);
+  for (size_t i = 0; i < piece_count; i++)
+    std::copy(layer.begin() + i * 32, layer.begin() + (i + 1) * 32,
+              nodes[i].begin());
+  auto root = merkle::root(nodes, merkle::next_pow2(piece_count),
+                           merkle::zero_subtree(piece_length / 16384));
+  std::string root_str(root.begin(), root.end());
+  if (tamper) layer[0] ^= 1;
+
+  std::string len = std::to_string(data.size());
+  return "d" + bstr("announce") + bstr("http://tracker") + bstr("info") +
+         "d" + bstr("file tree") + "d" + bstr("file") + "d" + bstr("") + "d" +
+         bstr("length") + "i" + len + "e" + bstr("pieces root") +
+         bstr(root_str) + "eee" + bstr("length") + "i" + len + "e" +
+         bstr("meta version") + "i2e" + bstr("name") + bstr("file") +
+         bstr("piece length") + "i" + std::to_string(piece_length) + "e" +
+         bstr("pieces") + bstr(pieces) + "e" + bstr("piece layers") + "d" +
+         bstr(root_str) + bstr(layer) + "ee";
+}
+
+TEST_CASE("[Torrent] Parse hybrid v2 metadata") {
+  std::vector<uint8_t> data(3 * 32768 + 100);
+  for (size_t i = 0; i < data.size(); i++) data[i] = static_cast<uint8_t>(i);
+
+  BencodeParser parser;
+  auto tree = parser.decode(hybrid_torrent(data, 32768, false));
+  REQUIRE(tree.valid());
+  TorrentFile torrent(*(*tree));
+
+  REQUIRE(torrent.v2 != nullptr);
+  REQUIRE(torrent.v2->files.size() == 1);
+  REQUIRE(torrent.v2->files[0].length == data.size());
+  REQUIRE(torrent.v2->files[0].piece_layer.size() == 4);
+
+  // The last piece holds only 100 bytes of the file
+  REQUIRE(torrent.v2->piece_roots.size() == 4);
+  REQUIRE(torrent.v2->piece_roots[3].data_len == 100);
+  REQUIRE(torrent.v2->piece_roots[3].width == 2);
+  REQUIRE(torrent.v2->piece_roots[3].root ==
+          merkle::data_root(data.data() + 3 * 32768, 100, 2));
+
+  // A piece layer not matching the root is ignored
+  auto tampered = parser.decode(hybrid_torrent(data, 32768, true));
+  REQUIRE(tampered.valid());
+  REQUIRE(TorrentFile(*(*tampered)).v2 == nullptr);
+}
+
+TEST_CASE("[Torrent] Info hash over the original bytes") {
+  // The info dict is not canonical, the length has leading zeros
+  const std::string info =
+      "d6:lengthi0042e4:name4:file12:piece lengthi16384e6:pieces20:" +
+      std::string(20, 'x') + "e";
+  const std::string content =
+      "d8:announce14:http://tracker4:info" + info + "e";
+
+  auto torrent = TorrentFile::parse(content);
+  REQUIRE(torrent.valid());
+  REQUIRE(torrent->length == 42);
+  REQUIRE(torrent->info_hash == hash::compute_info_hash(info));
+
+  // Encoding the dict again changes the hash
+  BencodeParser parser;
+  auto tree = parser.decode(content);
+  REQUIRE(TorrentFile(*(*tree)).info_hash != torrent->info_hash);
+
+  REQUIRE(!TorrentFile::parse("d8:announce").valid());
+
+  // Without a name
+  auto missing = TorrentFile::parse(
+      "d8:announce1:a4:infod6:lengthi1e12:piece lengthi1e6:pieces0:ee");
+  REQUIRE(!missing.valid());
+  REQUIRE(missing.error() == bencode::SchemaError::MissingKey);
+}
+
 /// Sequence of hashes for pieces of a Debian torrent. There are 1516 pieces
 /// in total and each occupies 20 bytes for a SHA1 hash. Forward declared here
 /// but provided below in order to now clutter the source file
@@ -0,0 +1,182 @@
+#include "disk/write_behind.hpp"
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "disk/aligned_buffer.hpp"
+#include "download/piece_pool.hpp"
+#include "platform/io.hpp"
+#include "tfolder.hpp"
+
+using namespace fur;
+using namespace fur::disk;
+using namespace fur::download::piece_pool;
+
+/// Borrow a buffer from `pool` holding `content`
+static PieceBuffer make_buffer(PiecePool& pool,
+                               const std::vector<uint8_t>& content) {
+  auto buffer = pool.acquire(content.size());
+  std::copy(content.begin(), content.end(), buffer.begin());
+  return buffer;
+}
+
+static std::vector<uint8_t> read_file(const std::string& filepath) {
+  std::ifstream file(filepath, std::ios::binary);
+  return {std::istreambuf_iterator<char>(file),
+          std::istreambuf_iterator<char>()};
+}
+
+TEST_CASE("[WriteBehind] Adjacent pieces are coalesced") {
+  auto folder = make_test_folder("furrent_test_write_behind");
+  REQUIRE(platform::io::touch(folder + "/file", 4 * 8).valid());
+
+  PiecePool pool(1024 * 1024);
+  std::atomic_size_t written{0};
+  WriteBehind writer(1024 * 1024, std::chrono::milliseconds(10000),
+                     [&](TorrentID, size_t, bool success) {
+                       if (success) written += 1;
+                     });
+
+  // Pieces of 8 bytes, each filled with its index. Arriving out of order and
+  // with a hole that is filled last
+  auto layout = std::make_shared<const PieceLayout>(
+      std::vector<File>{File{{"file"}, 32}}, 8, 4);
+  for (size_t index : {2, 0, 3, 1}) {
+    std::vector<uint8_t> content(8, static_cast<uint8_t>(index));
+    writer.push(0, folder, layout, index, make_buffer(pool, content));
+  }
+  writer.flush(0);
+
+  REQUIRE(written == 4);
+  auto stats = writer.stats();
+  REQUIRE(stats.pieces_written == 4);
+  REQUIRE(stats.writes_issued == 1);
+  REQUIRE(stats.pending_bytes == 0);
+
+  auto content = read_file(folder + "/file");
+  REQUIRE(content.size() == 32);
+  for (size_t i = 0; i < content.size(); i++) REQUIRE(content[i] == i / 8);
+
+  std::filesystem::remove_all(folder);
+}
+
+TEST_CASE("[WriteBehind] Pieces spanning multiple files") {
+  auto folder = make_test_folder("furrent_test_write_behind_multi");
+  REQUIRE(platform::io::touch(folder + "/a", 6).valid());
+  REQUIRE(platform::io::touch(folder + "/b", 10).valid());
+
+  PiecePool pool(1024 * 1024);
+  std::atomic_size_t failed{0};
+  WriteBehind writer(1024 * 1024, std::chrono::milliseconds(10000),
+                     [&](TorrentID, size_t, bool success) {
+                       if (!success) failed += 1;
+                     });
+
+  // File "a" is 6 bytes and file "b" is 10 bytes, pieces are 8 bytes
+  auto layout = std::make_shared<const PieceLayout>(
+      std::vector<File>{File{{"a"}, 6}, File{{"b"}, 10}}, 8, 2);
+  writer.push(0, folder, layout, 1,
+              make_buffer(pool, std::vector<uint8_t>(8, 2)));
+  writer.push(0, folder, layout, 0,
+              make_buffer(pool, {1, 1, 1, 1, 1, 1, 2, 2}));
+  writer.flush(0);
+
+  REQUIRE(failed == 0);
+  // One write for "a" and one for "b"
+  REQUIRE(writer.stats().writes_issued == 2);
+  REQUIRE(read_file(folder + "/a") == std::vector<uint8_t>(6, 1));
+  REQUIRE(read_file(folder + "/b") == std::vector<uint8_t>(10, 2));
+
+  std::filesystem::remove_all(folder);
+}
+
+TEST_CASE("[WriteBehind] Expired pieces are written") {
+  auto folder = make_test_folder("furrent_test_write_behind_expire");
+  REQUIRE(platform::io::touch(folder + "/file", 16).valid());
+
+  PiecePool pool(1024 * 1024);
+  std::atomic_size_t written{0};
+  WriteBehind writer(1024 * 1024, std::chrono::milliseconds(10),
+                     [&](TorrentID, size_t, bool) { written += 1; });
+
+  auto layout = std::make_shared<const PieceLayout>(
+      std::vector<File>{File{{"file"}, 16}}, 8, 2);
+  writer.push(0, folder, layout, 1,
+              make_buffer(pool, std::vector<uint8_t>(8, 1)));
+
+  // No flush, the piece must be written by itself
+  for (int i = 0; i < 100 && written == 0; i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  REQUIRE(written == 1);
+
+  std::filesystem::remove_all(folder);
+}
+
+TEST_CASE("[WriteBehind] Direct I/O with unaligned boundaries") {
+  auto folder = make_test_folder("furrent_test_write_behind_direct");
+
+  // Without direct I/O only the fallback would be tested
+  AlignedBuffer probe(platform::io::DIRECT_IO_ALIGNMENT);
+  REQUIRE(platform::io::touch(folder + "/probe", probe.size()).valid());
+  auto probing = platform::io::write_chunks_direct(
+      folder + "/probe", {platform::io::Chunk{probe.data(), probe.size()}}, 0);
+  if (!probing.valid() &&
+      probing.error() == platform::io::IOError::DirectIOUnsupported) {
+    WARN("Direct I/O is not supported in " << folder << ", skipping");
+    std::filesystem::remove_all(folder);
+    return;
+  }
+  REQUIRE(probing.valid());
+
+  // Two files whose boundaries don't match the direct I/O alignment
+  const size_t A_LEN = 3 * 4096 + 100;
+  const size_t B_LEN = 2 * 4096 + 7;
+  const size_t PIECE_LEN = 5000;
+  REQUIRE(platform::io::touch(folder + "/a", A_LEN).valid());
+  REQUIRE(platform::io::touch(folder + "/b", B_LEN).valid());
+
+  PiecePool pool(1024 * 1024);
+  std::atomic_size_t failed{0};
+  WriteBehind writer(
+      1024 * 1024, std::chrono::milliseconds(10000),
+      [&](TorrentID, size_t, bool success) {
+        if (!success) failed += 1;
+      },
+      true);
+
+  // Torrent content is the sequence 0, 1, 2, ... modulo 251
+  const size_t total = A_LEN + B_LEN;
+  const size_t pieces_count = (total + PIECE_LEN - 1) / PIECE_LEN;
+  auto layout = std::make_shared<const PieceLayout>(
+      std::vector<File>{File{{"a"}, A_LEN}, File{{"b"}, B_LEN}}, PIECE_LEN,
+      pieces_count);
+  for (size_t index = 0; index < pieces_count; index++) {
+    size_t begin = index * PIECE_LEN;
+    size_t end = std::min(begin + PIECE_LEN, total);
+
+    std::vector<uint8_t> content;
+    for (size_t i = begin; i < end; i++)
+      content.push_back(static_cast<uint8_t>(i % 251));
+    writer.push(0, folder, layout, index, make_buffer(pool, content));
+  }
+  writer.flush(0);
+
+  REQUIRE(failed == 0);
+  // Aligned blocks of both files went around the page cache
+  REQUIRE(writer.stats().direct_bytes >= 4 * 4096);
+  auto a = read_file(folder + "/a");
+  auto b = read_file(folder + "/b");
+  REQUIRE(a.size() == A_LEN);
+  REQUIRE(b.size() == B_LEN);
+  for (size_t i = 0; i < A_LEN; i++) REQUIRE(a[i] == i % 251);
+  for (size_t i = 0; i < B_LEN; i++) REQUIRE(b[i] == (A_LEN + i) % 251);
+
+  std::filesystem::remove_all(folder);
+}